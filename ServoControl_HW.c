@@ -1,6 +1,17 @@
 /**
  * Template for Servo Control from FPGA with Hardware Controlled Speed
  *
+ * Usage: ServoControl_HW [choreography]   play a keyframe file (see keyframe.h),
+ *                                         the built-in throw if none is given
+ *        ServoControl_HW -w choreography  write the built-in throw to a file
+ *
+ * Environment:
+ *   SERVO_BACKEND   devmem (default), sim or null, see servoBackend.h
+ *   SERVO_RT_PRIO   real-time mode, see rtMode.h
+ *   SERVO_RT_CPU    CPU to pin to in real-time mode
+ *
+ * Every command is checked against joint limits and collisions (servoSafety.h),
+ * build with -lm.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,24 +19,29 @@
 #include <sys/mman.h>
 #include <time.h>
 
-#define BASE_ADDRESS 0x400D0000
+#include "servoBackend.h"
+#include "servoShadow.h"
+#include "keyframe.h"
+#include "rtMode.h"
+#include "servoSafety.h"
+#include "servoJoints.h"
 
-//Servo motor offsets
-#define Base_OFFSET 0x100
-#define Bicep_OFFSET 0x104
-#define Elbow_OFFSET 0x108
-#define Wrist_OFFSET 0x10C
-#define Gripper_OFFSET 0x110
+/** number of servos (Base, Bicep, Elbow, Wrist, Gripper), one per joint */
+#define SERVO_COUNT JOINT_COUNT
 
-#define REG_WRITE(addr, off, val) (*(volatile int*)(addr+off)=(val))
+#if KEYFRAME_JOINTS != SERVO_COUNT
+#error "keyframes have to hold one position per servo"
+#endif
 
 /**
  * data structure for servo instance
  */
 typedef struct {
-	unsigned char *test_base; /// base address of mapped virtual space
-	int fd;                   /// file desrcriptor for memory map
-	int map_len;              /// size of mapping window
+	tServoBackend backend;    /// register backend (/dev/mem, simulator or null)
+	tServoShadow shadow;      /// shadow copy of the servo registers
+	int deferWrites;          /// 1: registers only reach the FPGA on servo_flush()
+	unsigned char posn[SERVO_COUNT]; /// last commanded position, index 0 (Base) .. 4 (Gripper)
+	tServoSafety safety;      /// joint limits and collision grid checked on every command
 
 } tServo;
 
@@ -37,14 +53,25 @@ tServo gServos;
 
 
 /**
- * This function takes the servo number and the position, and writes the values in
+ * This function takes the joint and the position, and writes the values in
  * appropriate address for the FPGA
- * @param test_base			base pointer for servos
- * @param servo_number		servo number to manipulate
+ * @param joint				joint to manipulate, JOINT_BASE (0) .. JOINT_GRIPPER
  * @param position			new postion in degree (0 .. 180)
  * @param speed				speed to move in degree / 20ms
  */
-void servo_move(unsigned char servo_number, unsigned char position, unsigned char speed);
+void servo_move(unsigned char joint, unsigned char position, unsigned char speed);
+
+/**
+ * Write all servo registers changed since the last flush to the FPGA
+ */
+void servo_flush();
+
+/**
+ * Move all joints, their registers reach the FPGA in one burst
+ * @param pose				new position per joint, index 0 (Base) .. JOINT_COUNT-1 (Gripper)
+ * @param speed				speed per joint in degree / 20ms
+ */
+void servo_writeAll(const unsigned char pose[JOINT_COUNT], const unsigned char speed[JOINT_COUNT]);
 
 
 /**
@@ -53,72 +80,189 @@ void servo_move(unsigned char servo_number, unsigned char position, unsigned cha
  */
 int servo_init() {
 
-	//Open the file regarding memory mapped IO to write values for the FPGA	
-	gServos.fd = open( "/dev/mem", O_RDWR);
-	
-	unsigned long int PhysicalAddress = BASE_ADDRESS;
-	gServos.map_len= 0xFF;  //size of mapping window
-
-	// map physical memory startin at BASE_ADDRESS into own virtual memory
-	gServos.test_base = (unsigned char*)mmap(NULL, gServos.map_len, PROT_READ | PROT_WRITE, MAP_SHARED, gServos.fd, (off_t)PhysicalAddress);
-
-	// did it work?
-	if(gServos.test_base == MAP_FAILED)	{
-		perror("Mapping memory for absolute memory access failed -- Test Try\n");
+	// open register backend selected by SERVO_BACKEND (default /dev/mem)
+	if (servo_backendOpen(&gServos.backend) != 0) {
 		return 1;
 	}
+	shadow_init(&gServos.shadow);
+	safety_init(&gServos.safety);
+	// the pose is unknown until commanded, check the first move against the home position
+	joint_homePose(gServos.posn);
 
-	//Initialize all servo motors to middle position, go there fast
-	servo_move(0, 150, 100);
-	servo_move(1, 150, 100);
-	servo_move(2, 150, 100);
-	servo_move(3, 150, 100);
-	servo_move(4, 150, 100);
-	servo_move(5, 150, 100);
+	//Initialize all servo motors to home position, go there fast
+	const unsigned char speed[JOINT_COUNT] = {JOINT_HOME_SPEED, JOINT_HOME_SPEED, JOINT_HOME_SPEED,
+			JOINT_HOME_SPEED, JOINT_HOME_SPEED};
+	servo_writeAll(gServos.posn, speed);
 
  	return 0;
 }
 
 
 /**
- * This function takes the servo number and the position, and writes the values in
+ * This function takes the joint and the position, and writes the values in
  * appropriate address for the FPGA
- * @param test_base			base pointer for servos
- * @param servo_number		servo number to manipulate
+ * @param joint				joint to manipulate, JOINT_BASE (0) .. JOINT_GRIPPER
  * @param position			new postion in degree (0 .. 180)
  * @param speed				speed to move in degree / 20ms
  */
-void servo_move(unsigned char servo_number, unsigned char position, unsigned char speed) {
+void servo_move(unsigned char joint, unsigned char position, unsigned char speed) {
+
+	if (joint >= JOINT_COUNT) {
+		return;
+	}
+
+	// within the joint limits, an unsafe pose keeps the joint where it is
+	position = safety_check(&gServos.safety, gServos.posn, joint, position);
+	gServos.posn[joint] = position;
 
-	/* writeValue bits 0..7    position
-	 * 			  bits 8..15   speed
-	 * 			  bits 16..31  all 0
-	 */
-	unsigned int writeValue = 0 << 16 | speed << 8 | position;
+	shadow_set(&gServos.shadow, gJoints[joint].offset, joint_regValue(position, speed));
 
-	switch (servo_number) {
-        	case 1:  //Base
-                	REG_WRITE(gServos.test_base, Base_OFFSET, writeValue);
-                	break;
+	// write through unless the caller flushes once per tick
+	if (!gServos.deferWrites) {
+		servo_flush();
+	}
+}
+
+/**
+ * Write all servo registers changed since the last flush to the FPGA
+ */
+void servo_flush() {
+	shadow_flush(&gServos.shadow, &gServos.backend);
+}
 
-           	case 2:  //Bicep
-                	REG_WRITE(gServos.test_base, Bicep_OFFSET, writeValue);
-                	break;
+/**
+ * Move all joints, their registers reach the FPGA in one burst
+ * @param pose				new position per joint, index 0 (Base) .. JOINT_COUNT-1 (Gripper)
+ * @param speed				speed per joint in degree / 20ms
+ */
+void servo_writeAll(const unsigned char pose[JOINT_COUNT], const unsigned char speed[JOINT_COUNT]) {
+	int deferWrites = gServos.deferWrites;
 
-          	case 3:  //Elbow
-                	REG_WRITE(gServos.test_base, Elbow_OFFSET, writeValue);
-                	break;
+	gServos.deferWrites = 1;
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		servo_move(j, pose[j], speed[j]);
+	}
+	servo_flush();
+	gServos.deferWrites = deferWrites;
+}
 
-           	case 4:  //Wrist
-                	REG_WRITE(gServos.test_base, Wrist_OFFSET, writeValue);
-                	break;
+/**
+ * Speeds to move all servos from one pose to another together.
+ * The FPGA moves each servo by its speed value every 20ms. The speed of every
+ * servo is scaled to its own distance so that all of them arrive at the same
+ * time, which is when the longest travelling servo arrives at speed.
+ * @param from				current position per servo, index 0 (Base) .. SERVO_COUNT-1 (Gripper)
+ * @param pose				new position per servo
+ * @param speed				speed of the longest travelling servo in degree / 20ms (>0)
+ * @param speeds			receives the speed per servo, 0 for servos that do not move
+ */
+void servo_poseSpeeds(const unsigned char from[SERVO_COUNT], const unsigned char pose[SERVO_COUNT],
+		unsigned char speed, unsigned char speeds[SERVO_COUNT]) {
+	int dist[SERVO_COUNT];
+	int maxDist = 0;
+
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		dist[j] = abs(pose[j] - from[j]);
+		if (dist[j] > maxDist) {
+			maxDist = dist[j];
+		}
+	}
 
-           	case 5:  //Gripper
-                	REG_WRITE(gServos.test_base, Gripper_OFFSET, writeValue);
-                	break;
+	// number of 20ms periods the longest move needs
+	int numPeriods = (maxDist + speed - 1) / speed;
 
-           	default:
-                	break;
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		// round up so no servo arrives later than the longest one
+		speeds[j] = dist[j] != 0 ? (dist[j] + numPeriods - 1) / numPeriods : 0;
+	}
+}
+
+/**
+ * Move all servos to a new pose together, see servo_poseSpeeds()
+ * @param pose				new position per servo, index 0 (Base) .. SERVO_COUNT-1 (Gripper)
+ * @param speed				speed of the longest travelling servo in degree / 20ms (>0)
+ */
+void servo_movePose(const unsigned char pose[SERVO_COUNT], unsigned char speed) {
+	unsigned char speeds[SERVO_COUNT];
+
+	if (speed == 0) {
+		return;
+	}
+	servo_poseSpeeds(gServos.posn, pose, speed, speeds);
+	// the pose as a whole has to be safe, then each servo_move() finds it so
+	if (safety_checkPose(&gServos.safety, gServos.posn, pose, (1 << SERVO_COUNT) - 1) != 0) {
+		return;
+	}
+
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		if (speeds[j] != 0) {
+			servo_move(j, gServos.posn[j], speeds[j]);
+		}
+	}
+}
+
+/**
+ * Issue a keyframe: move its joints, all registers reach the FPGA in one flush
+ * @param kf				keyframe
+ * @param ctx				unused
+ */
+void servo_keyframe(const tKeyframe *kf, void *ctx) {
+	int deferWrites = gServos.deferWrites;
+
+	// the joints move together, check the pose they lead to rather than each step to it
+	if (safety_checkPose(&gServos.safety, gServos.posn, kf->posn, kf->mask) != 0) {
+		return;
+	}
+
+	gServos.deferWrites = 1;
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		if (kf->mask & (1 << j)) {
+			servo_move(j, gServos.posn[j], kf->speed[j]);
+		}
+	}
+	servo_flush();
+	gServos.deferWrites = deferWrites;
+}
+
+/**
+ * Make a keyframe that moves all servos from one pose to another together
+ * @param kf				receives the keyframe
+ * @param t_ms				time of the keyframe since start in ms
+ * @param from				previous pose
+ * @param pose				new pose
+ * @param speed				speed of the longest travelling servo in degree / 20ms (>0)
+ */
+void servo_poseKeyframe(tKeyframe *kf, unsigned int t_ms, const unsigned char from[SERVO_COUNT],
+		const unsigned char pose[SERVO_COUNT], unsigned char speed) {
+	memset(kf, 0, sizeof(*kf));
+	kf->t_us = t_ms * 1000;
+	servo_poseSpeeds(from, pose, speed, kf->speed);
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		kf->posn[j] = pose[j];
+		if (kf->speed[j] != 0) {
+			kf->mask |= 1 << j;
+		}
+	}
+}
+
+/**
+ * Make a keyframe that moves every servo at a speed of its own, the servos
+ * arrive whenever their speed gets them there
+ * @param kf				receives the keyframe
+ * @param t_ms				time of the keyframe since start in ms
+ * @param pose				new pose
+ * @param speed				speed per servo in degree / 20ms, 0 leaves the servo where it is
+ */
+void servo_speedKeyframe(tKeyframe *kf, unsigned int t_ms, const unsigned char pose[SERVO_COUNT],
+		const unsigned char speed[SERVO_COUNT]) {
+	memset(kf, 0, sizeof(*kf));
+	kf->t_us = t_ms * 1000;
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		kf->posn[j] = pose[j];
+		kf->speed[j] = speed[j];
+		if (speed[j] != 0) {
+			kf->mask |= 1 << j;
+		}
 	}
 }
 
@@ -126,18 +270,55 @@ void servo_move(unsigned char servo_number, unsigned char position, unsigned cha
  * Deinitialize Servos
  */
 void servo_release(){
-	// Releasing the mapping in memory
-	munmap((void *)gServos.test_base, gServos.map_len);
-	close(gServos.fd);
+	servo_flush();
+	// Releasing the register backend
+	gServos.backend.close(&gServos.backend);
 }
 
 
-int main()
+#ifndef SERVO_HW_NO_MAIN
+
+int main(int argc, char *argv[])
 {
 	//Declarations and initialization
 	int servo_number = 0;
 	int position = 0;
   int speed = 0;
+	tKeyframeStream choreo;
+	static tHist lateness;
+	tRtConfig rt;
+
+ // Base, Bicep, Elbow, Wrist, Gripper
+ const unsigned char middle[SERVO_COUNT] = {150, 150, 150, 150, 150};
+ const unsigned char ready[SERVO_COUNT] = {140, 200, 160, 150, 170};
+ const unsigned char cocked[SERVO_COUNT] = {140, 200, 160, 110, 170};
+ const unsigned char grab[SERVO_COUNT] = {140, 200, 160, 110, 60};
+ const unsigned char thrown[SERVO_COUNT] = {140, 240, 240, 240, 240};
+ // the throw itself is not coordinated: every joint snaps at full speed
+ const unsigned char throwSpeed[SERVO_COUNT] = {0, 50, 50, 50, 50};
+
+ // built-in throw, one pose per second starting from the middle position, the
+ // positioning poses arrive with all joints together
+ tKeyframe throwFrames[4];
+ servo_poseKeyframe(&throwFrames[0], 0, middle, ready, 20);
+ servo_poseKeyframe(&throwFrames[1], 1000, ready, cocked, 20);
+ servo_poseKeyframe(&throwFrames[2], 2000, cocked, grab, 20);
+ //throw
+ servo_speedKeyframe(&throwFrames[3], 3000, thrown, throwSpeed);
+
+	if (argc == 3 && strcmp(argv[1], "-w") == 0) {
+		return keyframe_save(argv[2], throwFrames, 4) == 0 ? 0 : -1;
+	}
+	if (rt_configure(&rt) != 0) {
+		return -1;
+	}
+	if (argc == 2) {
+		if (keyframe_open(&choreo, argv[1]) != 0) {
+			return -1;
+		}
+	} else {
+		keyframe_fromArray(&choreo, throwFrames, 4);
+	}
 
 	printf("\n-------------  ATTENTION ROBOT WILL BE MOVING!  --------------------\n\n");
 	printf("Please ensure robot power is OFF. Hold it in middle position. Then, turn it on.\n");
@@ -147,21 +328,13 @@ int main()
 	if (servo_init() != 0) {
 		return -1; // exit if init fails
 	}
- 
- servo_move(1, 140, 20);
- servo_move(2, 200, 20);
- servo_move(3, 160, 20);
- servo_move(5, 170, 20);
- sleep(1);
- servo_move(4, 110, 20);
- sleep(1);
- servo_move(5, 60, 20);
- sleep(1);
- //throw
- servo_move(2, 240, 50);
- servo_move(3, 240, 50);
- servo_move(4, 240, 50);
- servo_move(5, 240, 50);
+
+	// each keyframe is issued at its time, scheduled from the start of the playback
+	hist_init(&lateness, "keyframe lateness");
+	// locks the choreography in memory as well, playback never waits for the disk then
+	rt_enter(&rt);
+	keyframe_play(&choreo, servo_keyframe, NULL, &lateness);
+	keyframe_close(&choreo);
 
 /*
 	do {
@@ -178,14 +351,18 @@ int main()
 			scanf("%d", &position);  //Take the position from user
 
 			//The selected servo will move to the desired position
-			servo_move(servo_number, position, speed);
+			servo_move(servo_number - 1, position, speed);
 		}
 	} while( servo_number != 0 ); // repeat while valid servo number given
  */
 
 	/* deinitialize servos */
 	servo_release();
+	shadow_print(&gServos.shadow, stdout);
+	safety_print(&gServos.safety, stdout);
+	hist_print(&lateness, stdout);
 
 	return 0;
 }
 
+#endif /* SERVO_HW_NO_MAIN */
@@ -1,33 +1,55 @@
 /**
  * Template for Servo Control from FPGA with Software Controlled Speed
  *
+ * Environment:
+ *   SERVO_BACKEND   devmem (default), sim or null, see servoBackend.h
+ *   SERVO_RT_PRIO   real-time mode of the executor thread, see rtMode.h
+ *   SERVO_RT_CPU    CPU to pin it to in real-time mode
+ *   SERVO_TELEMETRY_HZ  sample the registers into shared memory, see telemetry.h
+ *
+ * Moves run on an executor thread (motionExec.h), the prompt takes the next
+ * command while a move is under way and a new target replaces the move in
+ * flight instead of waiting for it.
+ *
+ * Every position written is checked against joint limits and collisions
+ * (servoSafety.h), build with -lm -pthread.
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
-#define BASE_ADDRESS 0x400D0000
-
-//Servo motor offsets
-#define Base_OFFSET 0x100
-#define Bicep_OFFSET 0x104
-#define Elbow_OFFSET 0x108
-#define Wrist_OFFSET 0x10C
-#define Gripper_OFFSET 0x110
+#include "servoBackend.h"
+#include "servoTick.h"
+#include "motionProfile.h"
+#include "latencyHist.h"
+#include "rtMode.h"
+#include "servoSafety.h"
+#include "servoJoints.h"
+#include "telemetry.h"
+#include "motionExec.h"
 
-#define REG_WRITE(addr, off, val) (*(volatile int*)(addr+off)=(val))
-#define REG_READ(addr, off) (*(volatile int*)(addr+off))
+/** number of servos (Base, Bicep, Elbow, Wrist, Gripper), one per joint */
+#define SERVO_COUNT JOINT_COUNT
 
 /**
  * data structure for servo instance
  */
 typedef struct {
-	unsigned char *test_base; /// base address of mapped virtual space
-	int fd;                   /// file desrcriptor for memory map
-	int map_len;              /// size of mapping window
+	tServoBackend backend;    /// register backend (/dev/mem, simulator or null)
+	tHist tickJitter;         /// wake-up jitter of the move ticks
+	unsigned long tickOverruns; /// move ticks missed entirely
+	unsigned char posn[SERVO_COUNT]; /// last written position, index 0 (Base) .. 4 (Gripper)
+	tServoSafety safety;      /// joint limits and collision grid checked on every write
+	tTelemetry telemetry;     /// register sampler, off unless SERVO_TELEMETRY_HZ is set
+	tMotionExec motion;       /// moves in flight, fed by the prompt
+	pthread_t executor;       /// thread running the moves
+	int running;              /// executor thread started
+	volatile int stop;        /// ends the executor thread
+	tHist cmdLatency;         /// command issued until its move started, ns
 
 } tServo;
 
@@ -37,69 +59,93 @@ typedef struct {
  */
 tServo gServos;
 
+/**
+ * Write a position to all servos, the registers are stored in one burst
+ * @param pose			position per joint, index 0 (Base) .. SERVO_COUNT-1 (Gripper)
+ * @return 0 if written, != 0 if the pose is not safe and nothing was written
+ */
+int servo_writeAll(const int pose[SERVO_COUNT]);
+
 /**
  * Initialize servos
  * @return 0 upon success, 1 otherwise
  */
 int servo_init() {
 
-	//Open the file regarding memory mapped IO to write values for the FPGA	
-	gServos.fd = open( "/dev/mem", O_RDWR);
-	
-	unsigned long int PhysicalAddress = BASE_ADDRESS;
-	gServos.map_len= 0xFF;  //size of mapping window
-
-	// map physical memory startin at BASE_ADDRESS into own virtual memory
-	gServos.test_base = (unsigned char*)mmap(NULL, gServos.map_len, PROT_READ | PROT_WRITE, MAP_SHARED, gServos.fd, (off_t)PhysicalAddress);
-
-	// did it work?
-	if(gServos.test_base == MAP_FAILED)	{
-		perror("Mapping memory for absolute memory access failed -- Test Try\n");
+	// open register backend selected by SERVO_BACKEND (default /dev/mem)
+	if (servo_backendOpen(&gServos.backend) != 0) {
 		return 1;
 	}
 
 	//Initialize all servo motors
 	// I assume this is the "sleep" position
-	REG_WRITE(gServos.test_base, Base_OFFSET, 150);
-	REG_WRITE(gServos.test_base, Bicep_OFFSET, 190);
-	REG_WRITE(gServos.test_base, Elbow_OFFSET, 190);
-	REG_WRITE(gServos.test_base, Wrist_OFFSET, 100);
- 	REG_WRITE(gServos.test_base, Gripper_OFFSET, 150);
+	const int sleep[SERVO_COUNT] = {150, 190, 190, 100, 150};
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		gServos.posn[j] = sleep[j];
+	}
+	safety_init(&gServos.safety);
+	servo_writeAll(sleep);
+
+	// sample the registers from here on, the control loop does not wait for it
+	if (telem_start(&gServos.telemetry, &gServos.backend) != 0) {
+		gServos.backend.close(&gServos.backend);
+		return 1;
+	}
 
  	return 0;
 }
 
 /**
- * This function takes the servo number and the position, and writes the values in
+ * This function takes the joint and the position, and writes the values in
  * appropriate address for the FPGA
- * @param test_base			base pointer for servos
- * @param servo_number		servo number to manipulate
- * @param position			new postion
+ * @param joint			joint to manipulate, JOINT_BASE (0) .. JOINT_GRIPPER
+ * @param position		new postion
  */
-void servo_move(int servo_number, int position) {
-	switch (servo_number) {
-        	case 1:  //Base
-                	REG_WRITE(gServos.test_base, Base_OFFSET, position);
-                	break;
+void servo_move(int joint, int position) {
+	if (joint < 0 || joint >= SERVO_COUNT) {
+		return;
+	}
 
-           	case 2:  //Bicep
-                	REG_WRITE(gServos.test_base, Bicep_OFFSET, position);
-                	break;
+	// within the joint limits, an unsafe pose keeps the joint where it is
+	position = safety_check(&gServos.safety, gServos.posn, joint, position);
+	gServos.posn[joint] = position;
 
-          	case 3:  //Elbow
-                	REG_WRITE(gServos.test_base, Elbow_OFFSET, position);
-                	break;
+	gServos.backend.write(&gServos.backend, gJoints[joint].offset, position);
+}
 
-           	case 4:  //Wrist
-                	REG_WRITE(gServos.test_base, Wrist_OFFSET, position);
-                	break;
+/**
+ * Write a position to all servos, the registers are stored in one burst
+ * @param pose			position per joint, index 0 (Base) .. SERVO_COUNT-1 (Gripper)
+ * @return 0 if written, != 0 if the pose is not safe and nothing was written
+ */
+int servo_writeAll(const int pose[SERVO_COUNT]) {
+	unsigned char want[SERVO_COUNT];
+	unsigned int val[SERVO_COUNT];
+
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		int p = joint_clamp(j, pose[j]);
+		gServos.safety.clamped += p != pose[j];
+		want[j] = p;
+	}
+	// the joints move together, an unsafe pose keeps all of them where they are
+	if (safety_checkPose(&gServos.safety, gServos.posn, want, (1 << SERVO_COUNT) - 1) != 0) {
+		return -1;
+	}
 
-           	case 5:  //Gripper
-                	REG_WRITE(gServos.test_base, Gripper_OFFSET, position);
-                	break;
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		val[j] = gServos.posn[j];
+	}
+	gServos.backend.writeBlock(&gServos.backend, Base_OFFSET, val, SERVO_COUNT);
+	return 0;
+}
 
-           	default:
-                	break;
+/**
+ * Read the positions back from the servo registers
+ * @param pose			receives the position per joint, index 0 (Base) .. SERVO_COUNT-1 (Gripper)
+ */
+void servo_readPose(int pose[SERVO_COUNT]) {
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		pose[j] = gServos.backend.read(&gServos.backend, gJoints[j].offset) & 0xFF;
 	}
 }
 
@@ -107,116 +153,213 @@ void servo_move(int servo_number, int position) {
  * Deinitialize Servos
  */
 void servo_release(){
-	// Releasing the mapping in memory
-	munmap((void *)gServos.test_base, gServos.map_len);
-	close(gServos.fd);
+	struct timespec pause = {0, SERVO_PERIOD_NS};
+
+	// let the moves in flight end
+	if (gServos.running) {
+		while (!motion_idle(&gServos.motion)) {
+			nanosleep(&pause, NULL);
+		}
+		gServos.stop = 1;
+		pthread_join(gServos.executor, NULL);
+	}
+
+	// the sampler reads through the backend, stop it first
+	telem_stop(&gServos.telemetry);
+
+	// Releasing the register backend
+	gServos.backend.close(&gServos.backend);
+}
+
+/**
+ * Account for the wake-up jitter of a move tick
+ * @param tick			tick just waited for
+ */
+void servo_tickDone(const tTick *tick) {
+	hist_record(&gServos.tickJitter, tick->late_ns > 0 ? tick->late_ns : 0);
+	if (tick->late_ns >= tick->period_ns) {
+		gServos.tickOverruns += tick->late_ns / tick->period_ns;
+	}
+}
+
+/**
+ * Executor thread: once per servo PWM period (SERVO_PERIOD_NS) take the new
+ * commands and write the next position of all moving joints in one burst.
+ * A position the collision check refuses stops the moves where the servos are.
+ * Only this loop runs in real-time mode, the prompt does not.
+ * @param arg			real-time configuration (tRtConfig)
+ */
+void *servo_executor(void *arg) {
+	tTick tick;
+	int pose[SERVO_COUNT];
+	int held[SERVO_COUNT];
+	unsigned long long latency;
+
+	rt_enter((const tRtConfig *)arg);
+	tick_start(&tick, SERVO_PERIOD_NS);
+	while (!gServos.stop) {
+		tick_wait(&tick);
+		servo_tickDone(&tick);
+		if (motion_tick(&gServos.motion, pose, &latency) > 0 && servo_writeAll(pose) != 0) {
+			for (int j = 0; j < SERVO_COUNT; ++j) {
+				held[j] = gServos.posn[j];
+			}
+			motion_hold(&gServos.motion, held);
+		}
+		if (latency > 0) {
+			hist_record(&gServos.cmdLatency, latency);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start the motion executor from the positions read back from the registers
+ * @param rt			real-time configuration of the executor thread
+ * @return 0 upon success, 1 otherwise
+ */
+int servo_start(const tRtConfig *rt) {
+	int pose[SERVO_COUNT];
+
+	servo_readPose(pose);
+	motion_init(&gServos.motion, pose);
+	hist_init(&gServos.cmdLatency, "command latency");
+	if (pthread_create(&gServos.executor, NULL, servo_executor, (void *)rt) != 0) {
+		printf("Could not start motion executor\n");
+		return 1;
+	}
+	gServos.running = 1;
+	return 0;
+}
+
+/**
+ * Queue a command if the pose it leads to is safe
+ * @param cmd			command
+ * @return 0 if queued, != 0 if refused
+ */
+int servo_command(tMotionCmd *cmd) {
+	int pose[SERVO_COUNT];
+
+	motion_target(&gServos.motion, cmd, pose);
+	if (!safety_poseSafe(&gServos.safety, pose[JOINT_BICEP], pose[JOINT_ELBOW], pose[JOINT_WRIST])) {
+		printf("Target pose would collide, not moving\n");
+		return -1;
+	}
+	motion_command(&gServos.motion, cmd);
+	return 0;
 }
 
 /**
  * Move Servo given a speed.
- * @param servoNr		selected servo number
- * @param from			start position (0-180)
+ * Returns right away, the executor moves the joint from wherever it is, one step
+ * per servo PWM period. A move still in flight for the joint is replaced on the
+ * next tick, continuing with the velocity the joint has.
+ * @param joint			joint to move, JOINT_BASE (0) .. JOINT_GRIPPER
  * @param to			end position (0-180)
  * @param speed			speed (degree/sec) >0
  */
-void servoMove(unsigned int servoNr, int from, int to, int speed)
+void servoMove(int joint, int to, int speed)
 {
-   int numPeriods = (abs(to - from) / speed) * 50000;
-   float increment = (float)(to - from) / (float)numPeriods;
-   
-	
-	switch (servoNr) {
-        	case 1:  //Base
-        			for (int i = 0; i < numPeriods; ++i) {
-                		REG_WRITE(gServos.test_base, Base_OFFSET, (int)(from + (increment * i)));
-                	}
-                	break;
-
-           	case 2:  //Bicep
-           			for (int i = 0; i < numPeriods; ++i) {
-                		REG_WRITE(gServos.test_base, Bicep_OFFSET, (int)(from + (increment * i)));
-                	}
-                	break;
-
-          	case 3:  //Elbow
-          			for (int i = 0; i < numPeriods; ++i) {
-                		REG_WRITE(gServos.test_base, Elbow_OFFSET, (int)(from + (increment * i)));
-                	}
-                	break;
-
-           	case 4:  //Wrist
-           			for (int i = 0; i < numPeriods; ++i) {
-                		REG_WRITE(gServos.test_base, Wrist_OFFSET, (int)(from + (increment * i)));
-                   printf("%d, %d, %d, %f\n", (int)(from + (increment * i)), numPeriods, i, increment);
-                	}
-                	break;
-
-           	case 5:  //Gripper
-           			for (int i = 0; i < numPeriods; ++i) {
-                		REG_WRITE(gServos.test_base, Gripper_OFFSET, (int)(from + (increment * i)));
-                	}
-                	break;
-
-           	default:
-                	break;
+	tMotionCmd cmd;
+
+	if (joint < 0 || joint >= SERVO_COUNT) {
+		return;
 	}
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.mask = 1 << joint;
+	cmd.to[joint] = to;
+	cmd.speed = speed;
+	cmd.profile = PROFILE_LINEAR_ID;
+	servo_command(&cmd);
 }
 
+/**
+ * Move all servos to a new pose together.
+ * Every joint is stepped in the same tick and its rate is scaled to its own
+ * distance, so all joints arrive at the same time. The joint with the longest
+ * travel reaches speed at its peak. Returns right away and replaces the moves
+ * in flight like servoMove().
+ * @param to			end pose, index 0 (Base) .. SERVO_COUNT-1 (Gripper)
+ * @param speed			peak speed of the longest travelling joint (degree/sec) >0
+ * @param profile		velocity profile (linear, trapezoid, s-curve)
+ */
+void servoMovePose(const int to[SERVO_COUNT], int speed, tProfileId profile)
+{
+	tMotionCmd cmd;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.mask = (1 << SERVO_COUNT) - 1;
+	for (int j = 0; j < SERVO_COUNT; ++j) {
+		cmd.to[j] = to[j];
+	}
+	cmd.speed = speed;
+	cmd.profile = profile;
+	servo_command(&cmd);
+}
 
 int main()
 {
 	//Declarations and initialization
 	int servo_number = 0;
-  int lp_base = 150, lp_bicep = 190, lp_elbow = 190, lp_wrist = 100, lp_gripper = 190;
-  int speed, newPosn;
+  int newPose[SERVO_COUNT];
+  int speed, newPosn, profile;
+	tRtConfig rt;
 
 	printf("\n-------------  Robot TESTING  --------------------\n\n");
 
+	if (rt_configure(&rt) != 0) {
+		return -1;
+	}
+
 	/* initialize servos */
 	if (servo_init() != 0) {
 		return -1; // exit if init fails
 	}
+	hist_init(&gServos.tickJitter, "tick wake-up jitter");
+	if (servo_start(&rt) != 0) {
+		servo_release();
+		return -1;
+	}
 
 	do {
-		printf("Enter servo number (1-5) or enter 0 to exit:\n");
+		printf("Enter servo number (1-5), 6 to move all servos together or enter 0 to exit:\n");
 		scanf("%d", &servo_number); //Take the servo number from user
 
-		if (servo_number != 0) {
+		if (servo_number >= 1 && servo_number <= SERVO_COUNT) {
 
     		printf("Enter position (60 - 240):\n");
     		scanf("%d", &newPosn); //Take the position from user
         printf("Enter speed (deg/sec) (1-90):\n");
     		scanf("%d", &speed); //Take the speed from user
-               
-       
-       switch (servo_number) {
-              case 1: 
-                   servoMove(1, lp_base, newPosn, speed);
-                   lp_base = newPosn;
-                   break;
-              case 2: 
-                   servoMove(2, lp_bicep, newPosn, speed);
-                   lp_bicep = newPosn;
-                   break;
-              case 3: 
-                   servoMove(3, lp_elbow, newPosn, speed);
-                   lp_elbow = newPosn;
-                   break;
-              case 4: 
-                   servoMove(4, lp_wrist, newPosn, speed);
-                   lp_wrist = newPosn;
-                   break;
-              case 5: 
-                   servoMove(5, lp_gripper, newPosn, speed);
-                   lp_gripper = newPosn;
-                   break;
-              default: break;
-       }
+
+        servoMove(servo_number - 1, newPosn, speed);
+
+		} else if (servo_number == SERVO_COUNT + 1) {
+
+        printf("Enter Base, Bicep, Elbow, Wrist and Gripper positions (60 - 240):\n");
+        for (int j = 0; j < SERVO_COUNT; ++j) {
+            scanf("%d", &newPose[j]); //Take the pose from user
+        }
+        printf("Enter peak speed (deg/sec) (1-180):\n");
+    		scanf("%d", &speed); //Take the speed from user
+        printf("Enter profile (0 linear, 1 trapezoid, 2 s-curve):\n");
+    		scanf("%d", &profile); //Take the profile from user
+        if (profile < 0 || profile >= PROFILE_COUNT) {
+            profile = PROFILE_LINEAR_ID;
+        }
+
+        servoMovePose(newPose, speed, (tProfileId)profile);
 		}
 	} while( servo_number != 0); // repeat while valid servo number given
 
 	/* deinitialize servos */
 	servo_release();
+	hist_print(&gServos.tickJitter, stdout);
+	hist_print(&gServos.cmdLatency, stdout);
+	printf("joint moves: %llu, replaced in flight: %llu, stopped on a refused pose: %llu\n",
+			gServos.motion.moves, gServos.motion.retargets, gServos.motion.held);
+	printf("ticks missed: %lu\n", gServos.tickOverruns);
+	safety_print(&gServos.safety, stdout);
 
 	return 0;
 }
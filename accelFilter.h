@@ -0,0 +1,218 @@
+/**
+ * Streaming filters for the WiiMote accelerometer
+ *
+ *   none       raw samples
+ *   ema        exponential moving average, fixed point
+ *   oneeuro    One-Euro filter: EMA whose cutoff rises with the speed of the
+ *              signal, little jitter at rest and little lag when moving
+ *   kalman     scalar Kalman filter per axis (random walk model), fixed point;
+ *              Q and R are the same on all axes, so the variance and the gain
+ *              are too and are kept once
+ *
+ * All axes are filtered together. The state is kept per lane in arrays of
+ * FILTER_LANES (X, Y, Z and one spare lane) so every step is a loop the
+ * compiler turns into 128-bit vector code (NEON, SSE). Samples are kept in
+ * Q8, the filter coefficients in Q16.
+ */
+#ifndef ACCEL_FILTER_H
+#define ACCEL_FILTER_H
+
+#include <string.h>
+
+
+/************ FILTER CONSTANTS ************/
+
+/** filtered axes X, Y, Z */
+#define FILTER_AXES 3
+
+/** lanes per step, padded to a whole vector */
+#define FILTER_LANES 4
+
+/** fractional bits of samples and coefficients */
+#define FILTER_SAMPLE_BITS 8
+#define FILTER_COEF_BITS 16
+#define FILTER_COEF_ONE (1 << FILTER_COEF_BITS)
+
+/** EMA weight of a new sample, Q16 (0.25) */
+#define FILTER_EMA_ALPHA (FILTER_COEF_ONE / 4)
+
+/** One-Euro minimum cutoff and speed coefficient, derivative cutoff in Hz */
+#define FILTER_EURO_MIN_CUTOFF 1.0f
+#define FILTER_EURO_BETA 0.05f
+#define FILTER_EURO_D_CUTOFF 1.0f
+
+/** Kalman process and measurement noise variance, in raw units^2 (Q16) */
+#define FILTER_KALMAN_Q (16 << FILTER_COEF_BITS)
+#define FILTER_KALMAN_R (144 << FILTER_COEF_BITS)
+
+/** 2 pi, for cutoff frequencies */
+#define FILTER_TWO_PI 6.2831853f
+
+/** sample period assumed before the second sample, ns */
+#define FILTER_DEFAULT_PERIOD_NS 10000000ULL
+
+
+/************ FILTER TYPES ************/
+
+/**
+ * available filters
+ */
+typedef enum {
+	FILTER_NONE_ID = 0,
+	FILTER_EMA_ID,
+	FILTER_ONE_EURO_ID,
+	FILTER_KALMAN_ID,
+	FILTER_COUNT
+} tFilterId;
+
+/**
+ * filter state for all axes
+ */
+typedef struct {
+	tFilterId id;                  /// selected filter
+	int primed;                    /// 1 once the first sample is in
+	unsigned long long t_ns;       /// time of the previous sample
+	int y[FILTER_LANES];           /// filtered value, Q8 (none, ema, kalman)
+	int p;                         /// kalman: estimate variance of every axis, Q16
+	float fy[FILTER_LANES];        /// one-euro: filtered value
+	float fx[FILTER_LANES];        /// one-euro: previous raw value
+	float fdx[FILTER_LANES];       /// one-euro: filtered derivative
+} tAccelFilter;
+
+/** filter names, indexed by tFilterId */
+static const char *const gFilterNames[FILTER_COUNT] = {"none", "ema", "oneeuro", "kalman"};
+
+
+/************ FILTER FUNCTIONS ************/
+
+/**
+ * Initialize filter
+ * @param id			filter to run
+ */
+static inline void filter_init(tAccelFilter *f, tFilterId id)
+{
+	memset(f, 0, sizeof(*f));
+	f->id = id;
+}
+
+/**
+ * Look up a filter by name
+ * @param name			filter name (gFilterNames), NULL for the default
+ * @param def			filter returned for NULL
+ * @return filter id, FILTER_COUNT if the name is unknown
+ */
+static inline tFilterId filter_byName(const char *name, tFilterId def)
+{
+	if (name == NULL) {
+		return def;
+	}
+	for (int id = 0; id < FILTER_COUNT; ++id) {
+		if (strcmp(name, gFilterNames[id]) == 0) {
+			return (tFilterId)id;
+		}
+	}
+	return FILTER_COUNT;
+}
+
+/**
+ * exponential moving average step, y += alpha * (x - y)
+ */
+static inline void filter_ema(tAccelFilter *f, const int x[FILTER_LANES])
+{
+	for (int a = 0; a < FILTER_LANES; ++a) {
+		f->y[a] += (int)(((long long)(x[a] - f->y[a]) * FILTER_EMA_ALPHA) >> FILTER_COEF_BITS);
+	}
+}
+
+/**
+ * scalar Kalman step per axis: predict (P += Q), then blend in the measurement
+ * with gain K = P / (P + R) and shrink the variance to (1 - K) P. P and K do
+ * not depend on the samples, the one division is done once for all lanes.
+ */
+static inline void filter_kalman(tAccelFilter *f, const int x[FILTER_LANES])
+{
+	f->p += FILTER_KALMAN_Q;
+	const int k = (int)(((long long)f->p << FILTER_COEF_BITS) / (f->p + FILTER_KALMAN_R));
+
+	for (int a = 0; a < FILTER_LANES; ++a) {
+		f->y[a] += (int)(((long long)(x[a] - f->y[a]) * k) >> FILTER_COEF_BITS);
+	}
+	f->p = (int)(((long long)(FILTER_COEF_ONE - k) * f->p) >> FILTER_COEF_BITS);
+}
+
+/**
+ * One-Euro step: the derivative is smoothed with a fixed cutoff, the value with
+ * a cutoff of minCutoff + beta * |derivative|
+ * @param dt			time since the previous sample in s
+ */
+static inline void filter_oneEuro(tAccelFilter *f, const int x[FILTER_LANES], float dt)
+{
+	// alpha = 1 / (1 + tau / dt) with tau = 1 / (2 pi cutoff)
+	const float rate = FILTER_TWO_PI * dt;
+	const float ad = rate * FILTER_EURO_D_CUTOFF / (1.0f + rate * FILTER_EURO_D_CUTOFF);
+
+	for (int a = 0; a < FILTER_LANES; ++a) {
+		float xa = (float)x[a];
+		float dx = (xa - f->fx[a]) / dt;
+		f->fdx[a] += ad * (dx - f->fdx[a]);
+
+		float speed = f->fdx[a] < 0 ? -f->fdx[a] : f->fdx[a];
+		float cutoff = FILTER_EURO_MIN_CUTOFF + FILTER_EURO_BETA * speed / (1 << FILTER_SAMPLE_BITS);
+		float alpha = rate * cutoff / (1.0f + rate * cutoff);
+		f->fy[a] += alpha * (xa - f->fy[a]);
+		f->fx[a] = xa;
+	}
+}
+
+/**
+ * Filter one accelerometer sample
+ * @param in			raw X, Y, Z
+ * @param t_ns			sample time in ns
+ * @param out			filtered X, Y, Z
+ */
+static inline void filter_apply(tAccelFilter *f, const short in[FILTER_AXES], unsigned long long t_ns,
+		int out[FILTER_AXES])
+{
+	int x[FILTER_LANES] = {0};
+
+	for (int a = 0; a < FILTER_AXES; ++a) {
+		x[a] = in[a] * (1 << FILTER_SAMPLE_BITS);
+	}
+
+	if (!f->primed) {
+		// start out at the first sample instead of easing in from 0
+		for (int a = 0; a < FILTER_LANES; ++a) {
+			f->y[a] = x[a];
+			f->fy[a] = f->fx[a] = (float)x[a];
+		}
+		f->p = FILTER_KALMAN_R;
+		f->primed = 1;
+		f->t_ns = t_ns - FILTER_DEFAULT_PERIOD_NS;
+	}
+
+	switch (f->id) {
+	case FILTER_EMA_ID:
+		filter_ema(f, x);
+		break;
+	case FILTER_ONE_EURO_ID:
+		filter_oneEuro(f, x, (t_ns > f->t_ns ? t_ns - f->t_ns : FILTER_DEFAULT_PERIOD_NS) * 1e-9f);
+		for (int a = 0; a < FILTER_LANES; ++a) {
+			f->y[a] = (int)(f->fy[a] + (f->fy[a] < 0 ? -0.5f : 0.5f));
+		}
+		break;
+	case FILTER_KALMAN_ID:
+		filter_kalman(f, x);
+		break;
+	default:
+		memcpy(f->y, x, sizeof(x));
+		break;
+	}
+	f->t_ns = t_ns;
+
+	// back to raw units, rounded
+	for (int a = 0; a < FILTER_AXES; ++a) {
+		out[a] = (f->y[a] + (1 << (FILTER_SAMPLE_BITS - 1))) >> FILTER_SAMPLE_BITS;
+	}
+}
+
+#endif /* ACCEL_FILTER_H */
@@ -0,0 +1,173 @@
+/**
+ * Closed-form kinematics of the arm (Base, Bicep, Elbow, Wrist)
+ *
+ * The base turns the arm plane about the vertical axis. In that plane bicep
+ * and elbow form a two link arm that places the wrist, and the wrist sets the
+ * pitch of the gripper. Given a gripper tip position and pitch the joint
+ * angles follow directly (law of cosines, elbow up), a handful of float
+ * operations and no iteration.
+ *
+ * Coordinates are in mm: x forward, y to the left, z up from the table, origin
+ * below the base axis. Joint angles are in radians: base about z, bicep from
+ * horizontal, elbow and wrist relative to the previous link, positive is up.
+ *
+ * Programs using it have to be linked with -lm.
+ */
+#ifndef ARM_KINEMATICS_H
+#define ARM_KINEMATICS_H
+
+#include <math.h>
+
+
+/************ KINEMATICS CONSTANTS ************/
+
+/** link lengths in mm: table to bicep axis, bicep, forearm, wrist axis to gripper tip */
+#define IK_BASE_HEIGHT 67.0f
+#define IK_BICEP_LEN 146.0f
+#define IK_FOREARM_LEN 187.0f
+#define IK_GRIPPER_LEN 86.0f
+
+/** joints solved for */
+#define IK_JOINTS 4
+
+/** servo position of a joint angle 0 (degree, 150 is the middle) and usable range */
+#define IK_SERVO_MIDDLE 150
+#define IK_SERVO_MIN 60
+#define IK_SERVO_MAX 240
+
+/** radians to degree */
+#define IK_RAD2DEG 57.29578f
+
+
+/************ KINEMATICS TYPES ************/
+
+/**
+ * gripper tip target
+ */
+typedef struct {
+	float x;     /// forward, mm
+	float y;     /// left, mm
+	float z;     /// up, mm
+	float pitch; /// gripper pitch from horizontal, rad
+} tIkTarget;
+
+/**
+ * joint angles, rad
+ */
+typedef struct {
+	float q[IK_JOINTS]; /// Base, Bicep, Elbow, Wrist
+} tIkJoints;
+
+/**
+ * servo calibration of the joints: servo position = middle + sign * (angle - zero) in degree
+ */
+static const float gIkZeroDeg[IK_JOINTS] = {0.0f, 90.0f, -90.0f, 0.0f};
+static const float gIkSign[IK_JOINTS] = {1.0f, 1.0f, 1.0f, -1.0f};
+
+
+/************ KINEMATICS FUNCTIONS ************/
+
+/**
+ * Joint angles that put the gripper tip at a target
+ * @param t				target
+ * @param j				receives the joint angles
+ * @return 0 on success, != 0 if the target is out of reach (j untouched)
+ */
+static inline int ik_solve(const tIkTarget *t, tIkJoints *j)
+{
+	float base = atan2f(t->y, t->x);
+	float r = sqrtf(t->x * t->x + t->y * t->y);
+
+	// wrist axis in the arm plane, relative to the bicep axis
+	float wr = r - IK_GRIPPER_LEN * cosf(t->pitch);
+	float wz = t->z - IK_BASE_HEIGHT - IK_GRIPPER_LEN * sinf(t->pitch);
+	float d2 = wr * wr + wz * wz;
+
+	float c = (d2 - IK_BICEP_LEN * IK_BICEP_LEN - IK_FOREARM_LEN * IK_FOREARM_LEN)
+	        / (2.0f * IK_BICEP_LEN * IK_FOREARM_LEN);
+	if (c < -1.0f || c > 1.0f) {
+		return -1;
+	}
+
+	// elbow up: the forearm bends down from the bicep
+	float elbow = -acosf(c);
+	float bicep = atan2f(wz, wr) - atan2f(IK_FOREARM_LEN * sinf(elbow), IK_BICEP_LEN + IK_FOREARM_LEN * cosf(elbow));
+
+	j->q[0] = base;
+	j->q[1] = bicep;
+	j->q[2] = elbow;
+	j->q[3] = t->pitch - bicep - elbow;
+	return 0;
+}
+
+/**
+ * Gripper tip position and pitch of joint angles
+ * @param j				joint angles
+ * @param t				receives the gripper tip
+ */
+static inline void ik_forward(const tIkJoints *j, tIkTarget *t)
+{
+	float a1 = j->q[1];
+	float a2 = a1 + j->q[2];
+	float a3 = a2 + j->q[3];
+	float r = IK_BICEP_LEN * cosf(a1) + IK_FOREARM_LEN * cosf(a2) + IK_GRIPPER_LEN * cosf(a3);
+
+	t->x = r * cosf(j->q[0]);
+	t->y = r * sinf(j->q[0]);
+	t->z = IK_BASE_HEIGHT + IK_BICEP_LEN * sinf(a1) + IK_FOREARM_LEN * sinf(a2) + IK_GRIPPER_LEN * sinf(a3);
+	t->pitch = a3;
+}
+
+/**
+ * Servo positions of joint angles
+ * @param j				joint angles
+ * @param posn			receives the position per servo, Base .. Wrist
+ * @return 0 if all are in range, != 0 if one had to be clamped
+ */
+static inline int ik_toServo(const tIkJoints *j, unsigned char posn[IK_JOINTS])
+{
+	int clamped = 0;
+
+	for (int k = 0; k < IK_JOINTS; ++k) {
+		float deg = IK_SERVO_MIDDLE + gIkSign[k] * (j->q[k] * IK_RAD2DEG - gIkZeroDeg[k]);
+		int p = (int)(deg + 0.5f);
+
+		if (p < IK_SERVO_MIN) {
+			p = IK_SERVO_MIN;
+			clamped = 1;
+		} else if (p > IK_SERVO_MAX) {
+			p = IK_SERVO_MAX;
+			clamped = 1;
+		}
+		posn[k] = (unsigned char)p;
+	}
+	return clamped;
+}
+
+/**
+ * Joint angles of servo positions, inverse of ik_toServo()
+ * @param posn			position per servo, Base .. Wrist
+ * @param j				receives the joint angles
+ */
+static inline void ik_fromServo(const unsigned char posn[IK_JOINTS], tIkJoints *j)
+{
+	for (int k = 0; k < IK_JOINTS; ++k) {
+		j->q[k] = ((posn[k] - IK_SERVO_MIDDLE) / gIkSign[k] + gIkZeroDeg[k]) / IK_RAD2DEG;
+	}
+}
+
+/**
+ * Gripper tip with every servo in the middle position
+ * @param t				receives the gripper tip
+ */
+static inline void ik_home(tIkTarget *t)
+{
+	tIkJoints j;
+
+	for (int k = 0; k < IK_JOINTS; ++k) {
+		j.q[k] = gIkZeroDeg[k] / IK_RAD2DEG;
+	}
+	ik_forward(&j, t);
+}
+
+#endif /* ARM_KINEMATICS_H */
@@ -0,0 +1,261 @@
+/**
+ * Cycle level model of the servo PWM generator in the FPGA
+ *
+ * Follows the Simulink models the bitstreams are built from. The FPGA runs at
+ * 50 MHz, a clock divider and a PWM counter make a 20 ms PWM period; the pulse
+ * of a servo is high while the PWM counter is at or below its duty value.
+ *
+ *   plain    ServoControl.slx: the duty value is the register, bits 0..7, in
+ *            10 us units, so position 150 is a 1.5 ms pulse. A write takes
+ *            effect at once.
+ *   speed    ServoControlWSpeed.slx: register bits 0..7 are the target, bits
+ *            8..15 the step. The duty value is a counter that starts at 150
+ *            and moves one unit toward the target per step pulse. Step pulses
+ *            are generated in the update window at the start of each period,
+ *            one per divider clock while the divider is at or below step: step
+ *            units (degree) per 20 ms, a step of 0 holds the joint.
+ *   x10      ServoControlWSpeed_x10.slx: the same in 1 us units, the target
+ *            is register * 10 and the counter starts at 1500. The update window
+ *            is 50 clocks long, so at most 50 units (5 degree) per period.
+ *
+ * The model keeps the duty counter of every joint and advances it by whole
+ * windows: a run of periods costs the same as one, so hours of motion
+ * simulate in microseconds. Writes are placed on the clock they happen at, one
+ * landing inside an update window splits the step pulses of that window
+ * between the old and the new register value like the hardware does.
+ */
+#ifndef FPGA_MODEL_H
+#define FPGA_MODEL_H
+
+#include <string.h>
+
+#include "servoJoints.h"
+
+
+/************ MODEL CONSTANTS ************/
+
+/** FPGA clock, Hz */
+#define FPGA_CLOCK_HZ 50000000ULL
+
+/** clocks per PWM period (20 ms) */
+#define FPGA_PERIOD_CLOCKS 1000000ULL
+
+/** ns per clock */
+#define FPGA_NS_PER_CLOCK (1000000000ULL / FPGA_CLOCK_HZ)
+
+
+/************ MODEL TYPES ************/
+
+/**
+ * bitstream variants
+ */
+typedef enum {
+	FPGA_PLAIN = 0,
+	FPGA_SPEED,
+	FPGA_SPEED_X10,
+	FPGA_VARIANTS
+} tFpgaVariant;
+
+/**
+ * variant description
+ */
+typedef struct {
+	const char *name;       /// variant name
+	unsigned int scale;     /// duty units per degree
+	unsigned int window;    /// clocks of the update window, most step pulses per period
+	unsigned int init;      /// duty counter after reset
+} tFpgaDesc;
+
+/**
+ * generator of one joint
+ */
+typedef struct {
+	unsigned int reg;       /// register as last written
+	unsigned int target;    /// duty value headed for, duty units
+	unsigned int step;      /// step pulses per update window
+	unsigned int duty;      /// duty counter, pulse width in duty units
+} tFpgaJoint;
+
+/**
+ * model of the servo block
+ */
+typedef struct {
+	const tFpgaDesc *desc;              /// variant
+	unsigned long long now;             /// clocks simulated since reset
+	tFpgaJoint joint[JOINT_COUNT];      /// generator per joint
+	unsigned long long writes;          /// register writes taken
+} tFpgaModel;
+
+
+/************ MODEL TABLES ************/
+
+static const tFpgaDesc gFpgaVariants[FPGA_VARIANTS] = {
+	{"plain", 1, 0, 150},
+	{"speed", 1, 500, 150},
+	{"x10", 10, 50, 1500},
+};
+
+
+/************ MODEL FUNCTIONS ************/
+
+/**
+ * Reset the model, all joints at the reset duty value
+ * @param variant		bitstream
+ */
+static inline void fpga_init(tFpgaModel *m, tFpgaVariant variant)
+{
+	memset(m, 0, sizeof(*m));
+	m->desc = &gFpgaVariants[variant];
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		m->joint[j].duty = m->desc->init;
+		m->joint[j].target = m->desc->init;
+	}
+}
+
+/**
+ * Move a duty counter by a number of step pulses, it stops at the target
+ */
+static inline void fpga_pulse(tFpgaJoint *fj, unsigned long long pulses)
+{
+	if (fj->duty < fj->target) {
+		fj->duty += pulses < fj->target - fj->duty ? pulses : fj->target - fj->duty;
+	} else {
+		fj->duty -= pulses < fj->duty - fj->target ? pulses : fj->duty - fj->target;
+	}
+}
+
+/**
+ * Step pulses between two clocks of an update window
+ * @param from			first clock, offset into the window
+ * @param to			end clock (exclusive)
+ */
+static inline unsigned int fpga_windowPulses(const tFpgaJoint *fj, unsigned long long from, unsigned long long to)
+{
+	unsigned long long a = from < fj->step ? from : fj->step;
+	unsigned long long b = to < fj->step ? to : fj->step;
+	return (unsigned int)(b - a);
+}
+
+/**
+ * Advance the model to a clock
+ * @param t				clock since reset, not before the model time
+ */
+static inline void fpga_advance(tFpgaModel *m, unsigned long long t)
+{
+	unsigned long long window = m->desc->window;
+
+	while (m->now < t) {
+		unsigned long long off = m->now % FPGA_PERIOD_CLOCKS;
+		unsigned long long start = m->now - off;
+
+		if (off < window) {
+			// inside the update window: the pulses up to t or the window end
+			unsigned long long end = t < start + window ? t - start : window;
+			for (int j = 0; j < JOINT_COUNT; ++j) {
+				fpga_pulse(&m->joint[j], fpga_windowPulses(&m->joint[j], off, end));
+			}
+			m->now = start + end;
+		} else if (t >= start + 2 * FPGA_PERIOD_CLOCKS) {
+			// whole periods up to t at once, every window passes completely
+			unsigned long long periods = (t - start) / FPGA_PERIOD_CLOCKS - 1;
+			for (int j = 0; j < JOINT_COUNT; ++j) {
+				fpga_pulse(&m->joint[j], periods * m->joint[j].step);
+			}
+			m->now = start + (periods + 1) * FPGA_PERIOD_CLOCKS;
+		} else {
+			// rest of the period, nothing moves
+			m->now = t < start + FPGA_PERIOD_CLOCKS ? t : start + FPGA_PERIOD_CLOCKS;
+		}
+	}
+}
+
+/**
+ * Take a register write
+ * @param t				clock of the write, not before the model time
+ * @param off			register offset, Base_OFFSET .. Gripper_OFFSET
+ * @param val			register value
+ * @return 0 on success, != 0 if off is no servo register
+ */
+static inline int fpga_write(tFpgaModel *m, unsigned long long t, unsigned int off, unsigned int val)
+{
+	unsigned int joint = (off - Base_OFFSET) / 4;
+
+	if (off < Base_OFFSET || off % 4 != 0 || joint >= JOINT_COUNT) {
+		return -1;
+	}
+	fpga_advance(m, t);
+
+	tFpgaJoint *fj = &m->joint[joint];
+	fj->reg = val;
+	fj->target = (val & 0xFF) * m->desc->scale;
+	if (m->desc->window == 0) {
+		// no speed control, the duty value is the register
+		fj->duty = fj->target;
+	} else {
+		unsigned int step = (val >> 8) & 0xFF;
+		fj->step = step < m->desc->window ? step : m->desc->window;
+	}
+	m->writes++;
+	return 0;
+}
+
+/**
+ * Clock at which all joints will have reached their target if nothing is written
+ * @return clock, the model time if all stand, ~0ULL if a joint with step 0 never arrives
+ */
+static inline unsigned long long fpga_settleClock(const tFpgaModel *m)
+{
+	unsigned long long settle = m->now;
+	unsigned long long off = m->now % FPGA_PERIOD_CLOCKS;
+	unsigned long long start = m->now - off;
+
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		const tFpgaJoint *fj = &m->joint[j];
+		unsigned int dist = fj->duty < fj->target ? fj->target - fj->duty : fj->duty - fj->target;
+
+		if (dist == 0) {
+			continue;
+		}
+		if (fj->step == 0) {
+			return ~0ULL;
+		}
+		// pulses still due in the current window, then whole windows; pulse k of a
+		// window is counted at the end of its clock k - 1
+		unsigned int done = off < m->desc->window ? fpga_windowPulses(fj, 0, off) : fj->step;
+		unsigned int now = fj->step - done;
+		unsigned long long t;
+		if (dist <= now) {
+			t = start + done + dist;
+		} else {
+			unsigned long long periods = (dist - now + fj->step - 1) / fj->step;
+			unsigned long long last = (dist - now) - (periods - 1) * fj->step;
+			t = start + periods * FPGA_PERIOD_CLOCKS + last;
+		}
+		settle = t > settle ? t : settle;
+	}
+	return settle;
+}
+
+/**
+ * Position of a joint
+ * @return position in degree, fractions in the x10 variant
+ */
+static inline double fpga_position(const tFpgaModel *m, int joint)
+{
+	return (double)m->joint[joint].duty / m->desc->scale;
+}
+
+/**
+ * Servo status register: bit j set while joint j has not reached its target
+ */
+static inline unsigned int fpga_status(const tFpgaModel *m)
+{
+	unsigned int status = 0;
+
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		status |= (m->joint[j].duty != m->joint[j].target) << j;
+	}
+	return status;
+}
+
+#endif /* FPGA_MODEL_H */
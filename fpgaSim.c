@@ -0,0 +1,213 @@
+/**
+ * Replay servo register writes through the model of the FPGA PWM generator
+ *
+ * Usage: fpgaSim [-v plain|speed|x10] [-t]
+ *                     replay the writes the sim backend logged (SERVO_SIM_PATH)
+ *                     and print what the joints actually do
+ *        fpgaSim [-v plain|speed|x10] -b hours
+ *                     simulate hours of a random command stream, report how fast
+ *
+ *   -v   bitstream the board runs, see fpgaModel.h (default speed)
+ *   -t   print the trajectory: every PWM period in which a joint moves
+ *
+ * Run ServoControl_HW, wiimoteServoControl or servoDaemon with SERVO_BACKEND=sim
+ * and SERVO_SIM_PATH set, then run this on the same file. The log keeps the last
+ * SERVO_SIM_LOG_LEN writes; the model starts from reset at the first of them,
+ * with the PWM period aligned to it.
+ *
+ * ServoControl_SW writes bare positions (speed 0), which the speed bitstreams
+ * never move to: replay its writes with -v plain.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "servoBackend.h"
+#include "fpgaModel.h"
+
+
+/************ SIM FUNCTIONS ************/
+
+/**
+ * Print the joint positions and status of the model
+ */
+void fpgaSim_print(const tFpgaModel *m)
+{
+	printf("%12.3f", (double)m->now / FPGA_CLOCK_HZ);
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		printf("  %s %6.1f", gJoints[j].name, fpga_position(m, j));
+	}
+	printf("  status 0x%02x\n", fpga_status(m));
+}
+
+/**
+ * Advance the model to a clock, printing every period something moved in
+ * @param trace			1: print the trajectory
+ */
+void fpgaSim_advance(tFpgaModel *m, unsigned long long t, int trace)
+{
+	if (!trace) {
+		fpga_advance(m, t);
+		return;
+	}
+	// period by period while something moves, at once when all stand
+	while (m->now < t) {
+		unsigned long long next = (m->now / FPGA_PERIOD_CLOCKS + 1) * FPGA_PERIOD_CLOCKS;
+		int moving = fpga_status(m) != 0;
+
+		fpga_advance(m, moving && next < t ? next : t);
+		if (moving) {
+			fpgaSim_print(m);
+		}
+	}
+}
+
+/**
+ * Replay the write log of the sim backend
+ * @param variant		bitstream
+ * @param trace			1: print the trajectory
+ * @return 0 on success, != 0 otherwise
+ */
+int fpgaSim_replay(tFpgaVariant variant, int trace)
+{
+	const char *path = getenv("SERVO_SIM_PATH");
+	tFpgaModel m;
+	unsigned int lag[JOINT_COUNT];
+
+	if (path == NULL) {
+		printf("Set SERVO_SIM_PATH to the file of the sim backend\n");
+		return -1;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror("Could not open simulated register block");
+		return -1;
+	}
+	const tServoSim *sim = (const tServoSim *)mmap(NULL, sizeof(tServoSim), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (sim == MAP_FAILED) {
+		perror("Mapping simulated register block failed");
+		return -1;
+	}
+
+	unsigned long long writes = __atomic_load_n(&sim->writes, __ATOMIC_ACQUIRE);
+	unsigned long long first = writes > SERVO_SIM_LOG_LEN ? writes - SERVO_SIM_LOG_LEN : 0;
+	if (writes == 0) {
+		printf("No writes logged\n");
+		munmap((void *)sim, sizeof(tServoSim));
+		return -1;
+	}
+	if (first > 0) {
+		printf("Only the last %d of %llu writes are logged, replaying those\n", SERVO_SIM_LOG_LEN, writes);
+	}
+
+	fpga_init(&m, variant);
+	memset(lag, 0, sizeof(lag));
+	unsigned long long t0 = sim->log[first & (SERVO_SIM_LOG_LEN - 1)].t_ns;
+	unsigned long long start = servo_nowNs();
+	for (unsigned long long n = first; n < writes; ++n) {
+		const tServoSimWrite *w = &sim->log[n & (SERVO_SIM_LOG_LEN - 1)];
+
+		fpgaSim_advance(&m, (w->t_ns - t0) / FPGA_NS_PER_CLOCK, trace);
+		// how far the joint still was from its last target when the next one came
+		unsigned int joint = (w->off - Base_OFFSET) / 4;
+		if (joint < JOINT_COUNT) {
+			const tFpgaJoint *fj = &m.joint[joint];
+			unsigned int d = fj->duty < fj->target ? fj->target - fj->duty : fj->duty - fj->target;
+			lag[joint] = d > lag[joint] ? d : lag[joint];
+		}
+		fpga_write(&m, m.now, w->off, w->val);
+	}
+	unsigned long long last = m.now;
+	unsigned long long settle = fpga_settleClock(&m);
+	if (settle != ~0ULL) {
+		fpgaSim_advance(&m, settle, trace);
+	}
+	unsigned long long ns = servo_nowNs() - start;
+
+	printf("%s bitstream: %llu writes over %.3f s, simulated in %.3f ms\n", m.desc->name, m.writes,
+			(double)last / FPGA_CLOCK_HZ, ns / 1e6);
+	if (settle == ~0ULL) {
+		printf("joints never settle, status 0x%02x: speed 0 holds them, try -v plain\n", fpga_status(&m));
+	} else {
+		printf("settled %.3f s after the last write\n", (double)(settle - last) / FPGA_CLOCK_HZ);
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		printf("%-8s at %6.1f, target %6.1f, most behind a new command %6.1f degree\n", gJoints[j].name,
+				fpga_position(&m, j), (double)m.joint[j].target / m.desc->scale, (double)lag[j] / m.desc->scale);
+	}
+
+	munmap((void *)sim, sizeof(tServoSim));
+	return 0;
+}
+
+/**
+ * Simulate a random command stream: every period one joint gets a new target and speed
+ * @param variant		bitstream
+ * @param hours			simulated time
+ */
+void fpgaSim_bench(tFpgaVariant variant, double hours)
+{
+	tFpgaModel m;
+	unsigned int seed = 1;
+	unsigned long long periods = (unsigned long long)(hours * 3600 * FPGA_CLOCK_HZ / FPGA_PERIOD_CLOCKS);
+	unsigned long long moved = 0;
+
+	fpga_init(&m, variant);
+	unsigned long long start = servo_nowNs();
+	for (unsigned long long p = 0; p < periods; ++p) {
+		seed = seed * 1103515245 + 12345;
+		int j = (seed >> 16) % JOINT_COUNT;
+		unsigned int val = joint_regValue(gJoints[j].min + (seed >> 8) % (gJoints[j].max - gJoints[j].min + 1),
+				1 + (seed >> 20) % 20);
+		// somewhere in the period, now and then inside the update window
+		fpga_write(&m, p * FPGA_PERIOD_CLOCKS + (seed >> 4) % FPGA_PERIOD_CLOCKS / (1 + (seed & 0xF)),
+				Base_OFFSET + 4 * j, val);
+		moved += fpga_status(&m) != 0;
+	}
+	fpga_advance(&m, periods * FPGA_PERIOD_CLOCKS);
+	unsigned long long ns = servo_nowNs() - start;
+
+	printf("%s bitstream: %.1f h (%llu periods, %llu writes) simulated in %.1f ms: %.0f h of motion per second,"
+			" %.1f ns per write\n", m.desc->name, hours, periods, m.writes, ns / 1e6, hours * 1e9 / ns,
+			(double)ns / m.writes);
+	printf("(a joint was moving in %.1f %% of the periods)\n", 100.0 * moved / periods);
+}
+
+
+int main(int argc, char *argv[])
+{
+	tFpgaVariant variant = FPGA_SPEED;
+	double hours = 0;
+	int trace = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+			for (variant = 0; variant < FPGA_VARIANTS && strcmp(gFpgaVariants[variant].name, argv[i + 1]) != 0;
+					variant++)
+				;
+			if (variant == FPGA_VARIANTS) {
+				printf("Unknown bitstream '%s', use plain, speed or x10\n", argv[i + 1]);
+				return -1;
+			}
+			i++;
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			hours = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-t") == 0) {
+			trace = 1;
+		} else {
+			printf("Usage: fpgaSim [-v plain|speed|x10] [-t]\n"
+			       "       fpgaSim [-v plain|speed|x10] -b hours\n");
+			return -1;
+		}
+	}
+
+	if (hours > 0) {
+		fpgaSim_bench(variant, hours);
+		return 0;
+	}
+	return fpgaSim_replay(variant, trace);
+}
@@ -0,0 +1,321 @@
+/**
+ * Gesture recognizer over the WiiMote accelerometer stream
+ *
+ *   shake      wave the remote left and right, two full swings
+ *   flick      one quick jab forward and back
+ *   twist      roll the remote a quarter turn and back
+ *
+ * Every sample goes into a sliding window of the last GESTURE_WINDOW samples
+ * (X, Y, Z). After each sample the end of the window is correlated with a
+ * template of every gesture at GESTURE_SCALES durations, so slow and quick
+ * gestures both match. The score is the normalized cross-correlation over
+ * all axes: offsets (gravity, how the remote is held) drop out with the window
+ * mean and the amplitude with the window energy, 1 is a perfect match.
+ * Windows with less motion than GESTURE_MIN_RMS never match, noise at rest
+ * correlates with anything now and then, and neither do windows with one half
+ * nearly still (GESTURE_MIN_HALF): a single bump next to rest looks like a
+ * flick once the mean is gone.
+ *
+ * A template at or above GESTURE_THRESHOLD does not trigger right away: the
+ * score keeps rising while more of the gesture comes into the window, so the
+ * best match is only taken once no better one came for GESTURE_SETTLE
+ * samples. That puts the trigger at the end of the gesture, GESTURE_SETTLE
+ * samples late. A long gesture performed unevenly can still trigger before it
+ * ends, when the part seen so far matches better than the whole; servoBench
+ * counts how often.
+ *
+ * The window is kept twice in a row, so its latest samples are always one
+ * contiguous block, and samples are stored per lane in arrays of
+ * GESTURE_LANES (X, Y, Z and a spare lane) like accelFilter.h: the
+ * correlation kernels are loops the compiler turns into 128-bit vector
+ * multiply-accumulates (NEON, SSE) already at -O2. Samples and templates are
+ * 32 bit for that, 16 bit ones need widening that -O2 does not vectorize.
+ * The templates are built once and shared by the windows of all remotes.
+ */
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <string.h>
+#include <math.h>
+
+
+/************ GESTURE CONSTANTS ************/
+
+/** lanes per sample, X, Y, Z padded to a whole vector */
+#define GESTURE_LANES 4
+
+/** samples in the window, a power of two and at least the longest template */
+#define GESTURE_WINDOW 64
+
+/** durations each gesture is matched at */
+#define GESTURE_SCALES 5
+
+/** template lengths in samples, 0.28 to 0.64 s at the 100 Hz report rate, about 20 % apart */
+#define GESTURE_LENGTHS {28, 34, 42, 52, 64}
+
+/** amplitude of the templates */
+#define GESTURE_TEMPLATE_AMPLITUDE 100.0f
+
+/** samples are clipped to this, so the sums fit in 32 bits */
+#define GESTURE_CLIP 2047
+
+/** correlation that triggers a gesture */
+#define GESTURE_THRESHOLD 0.85f
+
+/** samples the best match has to stay unbeaten before it triggers */
+#define GESTURE_SETTLE 3
+
+/** least share of the window energy in either half, each around its own mean */
+#define GESTURE_MIN_HALF 0.1f
+
+/** least RMS motion per axis in the window, raw units */
+#define GESTURE_MIN_RMS 15.0f
+
+
+/************ GESTURE TYPES ************/
+
+/**
+ * recognized gestures
+ */
+typedef enum {
+	GESTURE_NONE = 0,
+	GESTURE_SHAKE,
+	GESTURE_FLICK,
+	GESTURE_TWIST,
+	GESTURE_COUNT
+} tGestureId;
+
+/**
+ * one gesture at one duration, zero mean per lane
+ */
+typedef struct {
+	int t[GESTURE_WINDOW][GESTURE_LANES] __attribute__((aligned(16))); /// samples, the first len used
+	float norm;                 /// sqrt of the template energy
+} tGestureTemplate;
+
+/**
+ * templates of all gestures, read only once built
+ */
+typedef struct {
+	int len[GESTURE_SCALES];                                /// template length per scale
+	tGestureTemplate tmpl[GESTURE_SCALES][GESTURE_COUNT];   /// per scale and gesture, GESTURE_NONE unused
+} tGestureSet;
+
+/**
+ * sliding window of one accelerometer
+ */
+typedef struct {
+	const tGestureSet *set;     /// templates, NULL: recognizer off
+	int ring[2 * GESTURE_WINDOW][GESTURE_LANES] __attribute__((aligned(16))); /// samples, each stored at i and i + GESTURE_WINDOW
+	unsigned int n;             /// samples pushed
+	int holdoff;                /// samples before the next gesture can trigger
+	float score;                /// best correlation after the last sample
+	tGestureId best;            /// gesture with that score
+	tGestureId candidate;       /// best match above the threshold waiting to settle, GESTURE_NONE if none
+	float candidateScore;       /// its score
+	int candidateLen;           /// its template length
+	int candidateAge;           /// samples since it was found
+	unsigned long long triggered[GESTURE_COUNT]; /// gestures recognized
+} tGestureWindow;
+
+/** gesture names, indexed by tGestureId */
+static const char *const gGestureNames[GESTURE_COUNT] = {"none", "shake", "flick", "twist"};
+
+
+/************ GESTURE FUNCTIONS ************/
+
+/**
+ * Shape of a gesture
+ * @param u				time through the gesture, 0 .. 1
+ * @param out			acceleration X, Y, Z, in g
+ */
+static inline void gesture_shape(tGestureId id, float u, float out[3])
+{
+	const float pi = 3.14159265f;
+
+	out[0] = out[1] = out[2] = 0;
+	switch (id) {
+	case GESTURE_SHAKE:
+		// sideways, two swings
+		out[0] = sinf(4 * pi * u);
+		break;
+	case GESTURE_FLICK:
+		// forward and back, the tip dips with it
+		out[1] = sinf(2 * pi * u);
+		out[2] = -0.3f * sinf(2 * pi * u);
+		break;
+	case GESTURE_TWIST: {
+		// gravity turns from Z into X and back
+		float roll = pi / 2 * sinf(pi * u);
+		out[0] = sinf(roll);
+		out[2] = cosf(roll);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/**
+ * Build the templates of all gestures
+ */
+static inline void gesture_build(tGestureSet *set)
+{
+	const int lengths[GESTURE_SCALES] = GESTURE_LENGTHS;
+
+	memset(set, 0, sizeof(*set));
+	for (int k = 0; k < GESTURE_SCALES; ++k) {
+		int len = lengths[k];
+		set->len[k] = len;
+		for (int g = GESTURE_NONE + 1; g < GESTURE_COUNT; ++g) {
+			tGestureTemplate *tp = &set->tmpl[k][g];
+			float v[GESTURE_WINDOW][3], mean[3] = {0, 0, 0};
+			double energy = 0;
+
+			for (int i = 0; i < len; ++i) {
+				gesture_shape((tGestureId)g, (i + 0.5f) / len, v[i]);
+				for (int a = 0; a < 3; ++a) {
+					mean[a] += v[i][a] / len;
+				}
+			}
+			for (int i = 0; i < len; ++i) {
+				for (int a = 0; a < 3; ++a) {
+					tp->t[i][a] = (int)lrintf((v[i][a] - mean[a]) * GESTURE_TEMPLATE_AMPLITUDE);
+					energy += (double)tp->t[i][a] * tp->t[i][a];
+				}
+			}
+			tp->norm = (float)sqrt(energy);
+		}
+	}
+}
+
+/**
+ * Start an empty window
+ * @param set			templates, NULL turns the recognizer off
+ */
+static inline void gesture_init(tGestureWindow *w, const tGestureSet *set)
+{
+	memset(w, 0, sizeof(*w));
+	w->set = set;
+}
+
+/**
+ * Correlate the latest samples with one template
+ * @param x				oldest of the len latest samples
+ * @return sum of sample times template over all lanes
+ */
+static inline int gesture_dot(const int (*x)[GESTURE_LANES], const tGestureTemplate *tp, int len)
+{
+	int acc[GESTURE_LANES] = {0};
+
+	for (int i = 0; i < len; ++i) {
+		for (int l = 0; l < GESTURE_LANES; ++l) {
+			acc[l] += x[i][l] * tp->t[i][l];
+		}
+	}
+	return acc[0] + acc[1] + acc[2] + acc[3];
+}
+
+/**
+ * Energy of the latest samples around their mean
+ * @param x				oldest of the len latest samples
+ * @return sum over all lanes of the squared deviations
+ */
+static inline float gesture_energy(const int (*x)[GESTURE_LANES], int len)
+{
+	int sum[GESTURE_LANES] = {0};
+	int sq[GESTURE_LANES] = {0};
+	float energy = 0;
+
+	for (int i = 0; i < len; ++i) {
+		for (int l = 0; l < GESTURE_LANES; ++l) {
+			sum[l] += x[i][l];
+			sq[l] += x[i][l] * x[i][l];
+		}
+	}
+	for (int l = 0; l < GESTURE_LANES; ++l) {
+		energy += sq[l] - (float)sum[l] * sum[l] / len;
+	}
+	return energy;
+}
+
+/**
+ * Add a sample and look for a gesture ending with it
+ * @param x, y, z		acceleration, raw units
+ * @return gesture recognized, GESTURE_NONE if none
+ */
+static inline tGestureId gesture_push(tGestureWindow *w, int x, int y, int z)
+{
+	unsigned int slot = w->n & (GESTURE_WINDOW - 1);
+	const int s[GESTURE_LANES] = {
+		x < -GESTURE_CLIP ? -GESTURE_CLIP : x > GESTURE_CLIP ? GESTURE_CLIP : x,
+		y < -GESTURE_CLIP ? -GESTURE_CLIP : y > GESTURE_CLIP ? GESTURE_CLIP : y,
+		z < -GESTURE_CLIP ? -GESTURE_CLIP : z > GESTURE_CLIP ? GESTURE_CLIP : z,
+		0
+	};
+
+	memcpy(w->ring[slot], s, sizeof(s));
+	memcpy(w->ring[slot + GESTURE_WINDOW], s, sizeof(s));
+	w->n++;
+	w->score = 0;
+	w->best = GESTURE_NONE;
+	if (w->set == NULL) {
+		return GESTURE_NONE;
+	}
+	if (w->holdoff > 0) {
+		// the gesture just recognized is still in the window
+		w->holdoff--;
+		return GESTURE_NONE;
+	}
+
+	int bestLen = 0;
+	for (int k = 0; k < GESTURE_SCALES; ++k) {
+		int len = w->set->len[k];
+		if (w->n < (unsigned int)len) {
+			break;
+		}
+		// the latest len samples, ending with this one in the second copy
+		const int (*win)[GESTURE_LANES] = &w->ring[slot + GESTURE_WINDOW + 1 - len];
+		float energy = gesture_energy(win, len);
+		if (energy < GESTURE_MIN_RMS * GESTURE_MIN_RMS * 3 * len) {
+			continue;
+		}
+		// the motion has to fill the window, not sit in one half of it
+		if (gesture_energy(win, len / 2) < GESTURE_MIN_HALF * energy
+		 || gesture_energy(win + len / 2, len - len / 2) < GESTURE_MIN_HALF * energy) {
+			continue;
+		}
+		float scale = 1.0f / sqrtf(energy);
+		for (int g = GESTURE_NONE + 1; g < GESTURE_COUNT; ++g) {
+			const tGestureTemplate *tp = &w->set->tmpl[k][g];
+			// the template has zero mean, so the window mean drops out of the dot product
+			float score = gesture_dot(win, tp, len) * scale / tp->norm;
+			if (score > w->score) {
+				w->score = score;
+				w->best = (tGestureId)g;
+				bestLen = len;
+			}
+		}
+	}
+
+	if (w->score >= GESTURE_THRESHOLD && w->score > w->candidateScore) {
+		// more of the gesture in the window, or a better one
+		w->candidate = w->best;
+		w->candidateScore = w->score;
+		w->candidateLen = bestLen;
+		w->candidateAge = 0;
+		return GESTURE_NONE;
+	}
+	if (w->candidate == GESTURE_NONE || ++w->candidateAge < GESTURE_SETTLE) {
+		return GESTURE_NONE;
+	}
+
+	tGestureId id = w->candidate;
+	w->holdoff = w->candidateLen - w->candidateAge;
+	w->candidate = GESTURE_NONE;
+	w->candidateScore = 0;
+	w->triggered[id]++;
+	return id;
+}
+
+#endif /* GESTURE_H */
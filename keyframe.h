@@ -0,0 +1,226 @@
+/**
+ * Keyframe choreography files and their playback
+ *
+ * A choreography is a header followed by fixed size keyframes sorted by time.
+ * Each keyframe holds its time relative to the start of the playback, a mask
+ * of the joints it moves and a position and speed per joint. Files are memory
+ * mapped and streamed: pages are read in as playback reaches them and dropped
+ * again once played, so routines of any length run in a few pages of memory.
+ *
+ * Playback waits for each keyframe with clock_nanosleep() on an absolute
+ * CLOCK_MONOTONIC deadline computed from the start time, so waiting never
+ * accumulates drift. The next keyframe is read (and its page faulted in)
+ * before sleeping, not after waking up.
+ */
+#ifndef KEYFRAME_H
+#define KEYFRAME_H
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "servoTick.h"
+#include "latencyHist.h"
+
+
+/************ KEYFRAME CONSTANTS ************/
+
+/** file magic and version */
+#define KEYFRAME_MAGIC "KEYF"
+#define KEYFRAME_VERSION 1
+
+/** joints per keyframe (Base, Bicep, Elbow, Wrist, Gripper) */
+#define KEYFRAME_JOINTS 5
+
+/** played bytes dropped from memory at once */
+#define KEYFRAME_DROP_LEN (64 * 1024)
+
+
+/************ KEYFRAME TYPES ************/
+
+/**
+ * choreography file header
+ */
+typedef struct {
+	char magic[4];          /// KEYFRAME_MAGIC
+	unsigned short version; /// KEYFRAME_VERSION
+	unsigned short joints;  /// KEYFRAME_JOINTS
+} tKeyframeHeader;
+
+/**
+ * one keyframe
+ */
+typedef struct {
+	unsigned int t_us;                      /// time since start of playback in us
+	unsigned char mask;                     /// bit j set: joint j moves
+	unsigned char posn[KEYFRAME_JOINTS];    /// position per joint in degree
+	unsigned char speed[KEYFRAME_JOINTS];   /// speed per joint in degree / 20ms
+	unsigned char reserved;                 /// 0
+} tKeyframe;
+
+/**
+ * keyframe source, a mapped file or an array in memory
+ */
+typedef struct {
+	const tKeyframe *frames; /// keyframes
+	size_t count;            /// number of keyframes
+	void *map;               /// mapping of the whole file, NULL for an array
+	size_t mapLen;           /// size of the mapping
+	size_t dropped;          /// bytes of the mapping already dropped
+} tKeyframeStream;
+
+/**
+ * called by keyframe_play() at the time of each keyframe
+ */
+typedef void (*tKeyframeIssue)(const tKeyframe *kf, void *ctx);
+
+
+/************ KEYFRAME FUNCTIONS ************/
+
+/**
+ * Use keyframes in memory as source
+ * @param frames		keyframes sorted by time
+ * @param count			number of keyframes
+ */
+static inline void keyframe_fromArray(tKeyframeStream *ks, const tKeyframe *frames, size_t count)
+{
+	memset(ks, 0, sizeof(*ks));
+	ks->frames = frames;
+	ks->count = count;
+}
+
+/**
+ * Map a choreography file as source
+ * @param path			file name
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int keyframe_open(tKeyframeStream *ks, const char *path)
+{
+	struct stat st;
+	const tKeyframeHeader *header;
+
+	memset(ks, 0, sizeof(*ks));
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(tKeyframeHeader)) {
+		printf("Could not open choreography '%s'\n", path);
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	ks->mapLen = st.st_size;
+	ks->map = mmap(NULL, ks->mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ks->map == MAP_FAILED) {
+		perror("Mapping choreography failed");
+		ks->map = NULL;
+		return -1;
+	}
+
+	header = (const tKeyframeHeader *)ks->map;
+	if (memcmp(header->magic, KEYFRAME_MAGIC, 4) != 0 || header->version != KEYFRAME_VERSION
+	 || header->joints != KEYFRAME_JOINTS) {
+		printf("'%s' is not a choreography for %d joints\n", path, KEYFRAME_JOINTS);
+		munmap(ks->map, ks->mapLen);
+		ks->map = NULL;
+		return -1;
+	}
+	ks->frames = (const tKeyframe *)(header + 1);
+	ks->count = (ks->mapLen - sizeof(*header)) / sizeof(tKeyframe);
+	madvise(ks->map, ks->mapLen, MADV_SEQUENTIAL);
+	return 0;
+}
+
+/**
+ * Release the source
+ */
+static inline void keyframe_close(tKeyframeStream *ks)
+{
+	if (ks->map != NULL) {
+		munmap(ks->map, ks->mapLen);
+		ks->map = NULL;
+	}
+}
+
+/**
+ * Write keyframes to a choreography file
+ * @param path			file name
+ * @param frames		keyframes sorted by time
+ * @param count			number of keyframes
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int keyframe_save(const char *path, const tKeyframe *frames, size_t count)
+{
+	tKeyframeHeader header = {{'K', 'E', 'Y', 'F'}, KEYFRAME_VERSION, KEYFRAME_JOINTS};
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL) {
+		printf("Could not open choreography '%s'\n", path);
+		return -1;
+	}
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1
+	      && fwrite(frames, sizeof(tKeyframe), count, file) == count;
+	if (fclose(file) != 0 || !ok) {
+		printf("Could not write choreography '%s'\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * give the pages of a mapped file back once played
+ * @param played		number of keyframes issued so far
+ */
+static inline void keyframe_drop(tKeyframeStream *ks, size_t played)
+{
+	size_t end = sizeof(tKeyframeHeader) + played * sizeof(tKeyframe);
+
+	if (ks->map == NULL || end - ks->dropped < KEYFRAME_DROP_LEN) {
+		return;
+	}
+	// whole pages only, the page holding the current keyframe stays
+	end &= ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+	madvise((char *)ks->map + ks->dropped, end - ks->dropped, MADV_DONTNEED);
+	ks->dropped = end;
+}
+
+/**
+ * Play all keyframes, each one issued at its time after the start
+ * @param issue			called with each keyframe when it is due
+ * @param ctx			passed on to issue
+ * @param lateness		receives how late each keyframe was issued in ns, may be NULL
+ * @return number of keyframes issued
+ */
+static inline size_t keyframe_play(tKeyframeStream *ks, tKeyframeIssue issue, void *ctx, tHist *lateness)
+{
+	struct timespec start, due, now;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ks->count; ++i) {
+		// copy first so the page is faulted in before sleeping
+		tKeyframe kf = ks->frames[i];
+
+		due = start;
+		tick_tsAdd(&due, (long long)kf.t_us * 1000);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+			;
+
+		if (lateness != NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long long late = tick_tsDiff(&now, &due);
+			hist_record(lateness, late > 0 ? late : 0);
+		}
+		issue(&kf, ctx);
+		keyframe_drop(ks, i + 1);
+	}
+	return i;
+}
+
+#endif /* KEYFRAME_H */
@@ -0,0 +1,126 @@
+/**
+ * Low overhead latency histograms (HDR style, log-linear buckets)
+ *
+ * Values up to 2^HIST_SUB_BITS are counted exactly, above that every power of
+ * two is split into 2^HIST_SUB_BITS buckets, so any recorded value is
+ * reported within ~3% regardless of magnitude. Recording is a few shifts and
+ * one increment, no allocation and no locking (one writer per histogram).
+ */
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdio.h>
+#include <string.h>
+
+
+/************ HISTOGRAM CONSTANTS ************/
+
+/** log2 of the buckets per power of two */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+
+/** number of buckets to cover all 64 bit values */
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+
+/************ HISTOGRAM TYPES ************/
+
+/**
+ * latency histogram
+ */
+typedef struct {
+	const char *name;                          /// printed name
+	unsigned long long count;                  /// values recorded
+	unsigned long long max;                    /// largest value recorded
+	unsigned long long buckets[HIST_BUCKETS];  /// counts per bucket
+} tHist;
+
+
+/************ HISTOGRAM FUNCTIONS ************/
+
+/**
+ * Initialize histogram
+ * @param name			printed name
+ */
+static inline void hist_init(tHist *h, const char *name)
+{
+	memset(h, 0, sizeof(*h));
+	h->name = name;
+}
+
+/**
+ * bucket index of a value
+ */
+static inline unsigned int hist_bucket(unsigned long long v)
+{
+	if (v < HIST_SUB) {
+		return (unsigned int)v;
+	}
+	unsigned int e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return (e + 1) * HIST_SUB + (unsigned int)((v >> e) - HIST_SUB);
+}
+
+/**
+ * largest value falling into a bucket
+ */
+static inline unsigned long long hist_bucketMax(unsigned int idx)
+{
+	if (idx < HIST_SUB) {
+		return idx;
+	}
+	unsigned int e = idx / HIST_SUB - 1;
+	unsigned long long m = idx % HIST_SUB + HIST_SUB;
+	return ((m + 1) << e) - 1;
+}
+
+/**
+ * Record a value
+ * @param v				value, e.g. latency in ns
+ */
+static inline void hist_record(tHist *h, unsigned long long v)
+{
+	h->buckets[hist_bucket(v)]++;
+	h->count++;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+/**
+ * Value at a percentile
+ * @param p				percentile (0 .. 100)
+ * @return upper bound of the bucket holding the percentile, 0 if empty
+ */
+static inline unsigned long long hist_percentile(const tHist *h, double p)
+{
+	unsigned long long rank = (unsigned long long)(p / 100.0 * h->count + 0.5);
+	unsigned long long seen = 0;
+
+	if (rank == 0) {
+		rank = 1;
+	}
+	for (unsigned int i = 0; i < HIST_BUCKETS; ++i) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			unsigned long long v = hist_bucketMax(i);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+/**
+ * Print count, p50, p99, p99.9 and max of a histogram of ns values in us
+ * @param out			stream to print to
+ */
+static inline void hist_print(const tHist *h, FILE *out)
+{
+	fprintf(out, "%-20s n=%-8llu p50=%9.1f p99=%9.1f p99.9=%9.1f max=%9.1f us\n",
+			h->name, h->count,
+			hist_percentile(h, 50.0) / 1000.0,
+			hist_percentile(h, 99.0) / 1000.0,
+			hist_percentile(h, 99.9) / 1000.0,
+			h->max / 1000.0);
+}
+
+#endif /* LATENCY_HIST_H */
@@ -0,0 +1,277 @@
+/**
+ * Preemptible motion executor
+ *
+ * The executor owns the move in flight of every joint and advances all of them
+ * once per servo tick. Commands come from another thread through a lock-free
+ * ring (spscRing.h) and may arrive at any time: a command for a joint that is
+ * still moving does not wait for the move to end, it replaces it on the very
+ * next tick. The new move starts where the joint is and with the velocity it
+ * has, so position and velocity stay continuous:
+ *
+ *   p(k) = p0 + (target - p0) s(k/T) + v0 T c(k/T)
+ *
+ * s is the motion profile (motionProfile.h) and c(u) = u - 2u^2 + u^3 the cubic
+ * that starts with slope 1 and ends at 0 with slope 0, so the carried velocity
+ * v0 dies out over the T ticks of the move. Trapezoid and s-curve start with
+ * zero velocity of their own and blend without a kink, linear keeps its
+ * constant step on top of the carried velocity.
+ *
+ * Targets are clamped into the joint limits when a command is applied. When
+ * the servos refuse a position on the way (the collision check of the caller),
+ * motion_hold() stops the moves where the servos are, so the executor never
+ * goes on from positions that were not written.
+ *
+ * Positions are kept in Q16 degree, velocities in Q16 degree per tick.
+ */
+#ifndef MOTION_EXEC_H
+#define MOTION_EXEC_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "motionProfile.h"
+#include "servoJoints.h"
+#include "servoBackend.h"
+#include "spscRing.h"
+
+
+/************ MOTION CONSTANTS ************/
+
+/** shortest move starting from a moving joint, ticks the carried velocity dies out over */
+#define MOTION_BLEND_TICKS 10
+
+/** c(i / N) = u - 2u^2 + u^3 in Q16 */
+#define MOTION_CARRY(i) ((int)(PROFILE_ONE * \
+	((long long)(i) * PROFILE_N * PROFILE_N - 2LL * (i) * (i) * PROFILE_N + (long long)(i) * (i) * (i)) \
+	/ ((long long)PROFILE_N * PROFILE_N * PROFILE_N)))
+
+
+/************ MOTION TYPES ************/
+
+/**
+ * command to the executor: move the joints in mask to their target
+ */
+typedef struct {
+	unsigned int mask;          /// joints to move, bit j for joint j
+	int to[JOINT_COUNT];        /// target per joint, degree
+	int speed;                  /// peak speed of the longest travelling joint, degree / second
+	tProfileId profile;         /// velocity profile
+	unsigned long long t_ns;    /// time the command was issued, servo_nowNs()
+} tMotionCmd;
+
+/**
+ * move in flight of one joint
+ */
+typedef struct {
+	const int *table;           /// profile of the move
+	int from;                   /// position the move started at, Q16
+	long long dist;             /// target - from, Q16
+	long long carry;            /// velocity carried in times move length, Q16
+	unsigned int x;             /// table position, see tProfileRun
+	unsigned int dx;            /// table advance per tick
+	int left;                   /// ticks left, 0 if the joint stands
+	int pos;                    /// position after the last tick, Q16
+	int vel;                    /// position change of the last tick, Q16
+	int target;                 /// end position, degree
+} tMotionJoint;
+
+/**
+ * executor of all joints
+ */
+typedef struct {
+	tMotionJoint joint[JOINT_COUNT]; /// move in flight per joint
+	tSpscRing commands;         /// tMotionCmd, pushed by one thread, taken by the executor
+	unsigned long long issued;  /// commands pushed (command thread)
+	unsigned long long applied; /// commands taken and applied (executor)
+	unsigned long long moves;   /// joint moves started
+	unsigned long long retargets; /// joint moves replaced before they ended
+	unsigned long long held;    /// ticks the moves were stopped because the servos refused the pose
+} tMotionExec;
+
+
+/************ MOTION TABLES ************/
+
+static const int gMotionCarry[PROFILE_N + 1] = PROFILE_TABLE(MOTION_CARRY);
+
+
+/************ MOTION FUNCTIONS ************/
+
+/**
+ * Initialize the executor with all joints standing
+ * @param pose			position per joint, degree
+ */
+static inline void motion_init(tMotionExec *mx, const int pose[JOINT_COUNT])
+{
+	memset(mx, 0, sizeof(*mx));
+	spsc_init(&mx->commands, sizeof(tMotionCmd));
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		mx->joint[j].pos = pose[j] << 16;
+		mx->joint[j].target = pose[j];
+	}
+}
+
+/**
+ * Queue a command, never waits for a move to end (command thread only)
+ * @param cmd			command, t_ns is set here
+ */
+static inline void motion_command(tMotionExec *mx, tMotionCmd *cmd)
+{
+	cmd->t_ns = servo_nowNs();
+	// commands must not get lost, the executor takes them every tick
+	while (spsc_full(&mx->commands)) {
+		sched_yield();
+	}
+	spsc_push(&mx->commands, cmd);
+	mx->issued++;
+}
+
+/**
+ * End pose a command leads to, to check it before it is queued (command thread only)
+ * @param pose			receives the target per joint, degree: the command's, clamped into
+ * the joint limits, for the joints in its mask, the target of the move in flight for the others
+ */
+static inline void motion_target(const tMotionExec *mx, const tMotionCmd *cmd, int pose[JOINT_COUNT])
+{
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		pose[j] = (cmd->mask & (1 << j)) ? joint_clamp(j, cmd->to[j])
+		        : __atomic_load_n(&mx->joint[j].target, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Start a move from where the joint is and how fast it moves there
+ * @param to			end position, degree
+ * @param numPeriods	ticks of the move (>0)
+ */
+static inline void motion_retarget(tMotionExec *mx, int joint, int to, tProfileId profile, int numPeriods)
+{
+	tMotionJoint *mj = &mx->joint[joint];
+
+	mx->retargets += mj->left > 0;
+	mx->moves++;
+	mj->table = gProfiles[profile].table;
+	mj->from = mj->pos;
+	mj->dist = ((long long)to << 16) - mj->pos;
+	mj->carry = (long long)mj->vel * numPeriods;
+	mj->x = 0;
+	mj->dx = (unsigned int)((1ULL << 32) / numPeriods);
+	mj->left = numPeriods;
+	__atomic_store_n(&mj->target, to, __ATOMIC_RELAXED);
+}
+
+/**
+ * Apply a command: the joints in its mask head for their targets, all arriving together
+ */
+static inline void motion_apply(tMotionExec *mx, const tMotionCmd *cmd)
+{
+	int maxDist = 0, moving = 0;
+
+	if (cmd->speed <= 0 || cmd->profile < 0 || cmd->profile >= PROFILE_COUNT) {
+		return;
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		if (cmd->mask & (1 << j)) {
+			int dist = abs((joint_clamp(j, cmd->to[j]) << 16) - mx->joint[j].pos) >> 16;
+			maxDist = dist > maxDist ? dist : maxDist;
+			moving |= mx->joint[j].vel != 0;
+		}
+	}
+
+	// the longest travel determines the ticks for everyone, a moving joint needs time to turn
+	int numPeriods = profile_periods(cmd->profile, maxDist, cmd->speed, SERVO_TICKS_PER_SEC);
+	if (moving && numPeriods < MOTION_BLEND_TICKS) {
+		numPeriods = MOTION_BLEND_TICKS;
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		if (cmd->mask & (1 << j)) {
+			motion_retarget(mx, j, joint_clamp(j, cmd->to[j]), cmd->profile, numPeriods);
+		}
+	}
+}
+
+/**
+ * Advance one joint one tick
+ */
+static inline void motion_advance(tMotionJoint *mj)
+{
+	int pos;
+
+	if (mj->left <= 0) {
+		mj->vel = 0;
+		return;
+	}
+	if (--mj->left == 0) {
+		pos = mj->target << 16;
+	} else {
+		mj->x += mj->dx;
+		int s = profile_lookup(mj->table, mj->x);
+		int c = profile_lookup(gMotionCarry, mj->x);
+		pos = mj->from + (int)((mj->dist * s + mj->carry * c) >> 16);
+	}
+	mj->vel = pos - mj->pos;
+	mj->pos = pos;
+}
+
+/**
+ * One executor tick: take the commands issued since the last one, advance all joints
+ * @param pose			receives the position per joint, degree
+ * @param latency		receives the longest time a command taken this tick was pending, ns
+ * @return number of joints moving, 0 if all stand
+ */
+static inline int motion_tick(tMotionExec *mx, int pose[JOINT_COUNT], unsigned long long *latency)
+{
+	tMotionCmd cmd;
+	int moving = 0;
+
+	*latency = 0;
+	while (spsc_pop(&mx->commands, &cmd)) {
+		unsigned long long waited = servo_nowNs() - cmd.t_ns;
+		*latency = waited > *latency ? waited : *latency;
+		motion_apply(mx, &cmd);
+		__atomic_store_n(&mx->applied, mx->applied + 1, __ATOMIC_RELEASE);
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		moving += mx->joint[j].left > 0;
+		motion_advance(&mx->joint[j]);
+		pose[j] = (mx->joint[j].pos + (1 << 15)) >> 16;
+	}
+	return moving;
+}
+
+/**
+ * Stop all joints at the positions the servos hold, after the pose of a tick
+ * was refused: the moves in flight end there, the next command starts from there
+ * @param pose			position per joint the servos hold, degree
+ */
+static inline void motion_hold(tMotionExec *mx, const int pose[JOINT_COUNT])
+{
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		tMotionJoint *mj = &mx->joint[j];
+		mj->pos = pose[j] << 16;
+		mj->vel = 0;
+		__atomic_store_n(&mj->target, pose[j], __ATOMIC_RELAXED);
+		__atomic_store_n(&mj->left, 0, __ATOMIC_RELAXED);
+	}
+	mx->held++;
+}
+
+/**
+ * Check if all joints stand and no command is pending (command thread only)
+ * @return 1 if idle, 0 otherwise
+ */
+static inline int motion_idle(const tMotionExec *mx)
+{
+	// a command taken but not applied yet counts as pending
+	if (__atomic_load_n(&mx->applied, __ATOMIC_ACQUIRE) != mx->issued) {
+		return 0;
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		if (__atomic_load_n(&mx->joint[j].left, __ATOMIC_RELAXED) > 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#endif /* MOTION_EXEC_H */
@@ -0,0 +1,172 @@
+/**
+ * Motion profiles for servo moves
+ *
+ * A profile is a normalized position curve s(u) from s(0) = 0 to s(1) = 1,
+ * sampled at PROFILE_N + 1 points in Q16. The tables are static const arrays
+ * whose entries are integer constant expressions, so the compiler evaluates
+ * them at compile time. Running a profile costs one table lookup, one
+ * interpolation between neighbouring entries and one scale per tick.
+ *
+ *   linear      constant velocity, peak velocity = average velocity
+ *   trapezoid   constant acceleration for the first and last quarter of the
+ *               move, peak velocity 4/3 of average
+ *   s-curve     minimum jerk quintic 10u^3 - 15u^4 + 6u^5, zero velocity and
+ *               acceleration at both ends, peak velocity 15/8 of average
+ *
+ * The smooth starts and stops allow a higher peak speed than the linear ramp
+ * before the arm starts to shake or overshoot.
+ */
+#ifndef MOTION_PROFILE_H
+#define MOTION_PROFILE_H
+
+
+/************ PROFILE CONSTANTS ************/
+
+/** intervals per profile table (power of 2) */
+#define PROFILE_N 64
+#define PROFILE_N_BITS 6
+
+/** 1.0 in Q16 */
+#define PROFILE_ONE 65536LL
+
+/** trapezoid: s(i) with acceleration over the first and last N/4 samples */
+#define PROFILE_TRAP(i) ((int)( \
+	(i) < PROFILE_N / 4 \
+		? PROFILE_ONE * 8 * (i) * (i) / (3LL * PROFILE_N * PROFILE_N) \
+	: (i) <= 3 * PROFILE_N / 4 \
+		? PROFILE_ONE * (8LL * (i) - PROFILE_N) / (6LL * PROFILE_N) \
+	: PROFILE_ONE - PROFILE_ONE * 8 * (PROFILE_N - (i)) * (PROFILE_N - (i)) / (3LL * PROFILE_N * PROFILE_N)))
+
+/** s-curve: minimum jerk quintic 10u^3 - 15u^4 + 6u^5 with u = i / N */
+#define PROFILE_SCURVE(i) ((int)(PROFILE_ONE * \
+	(10LL * (i) * (i) * (i) * PROFILE_N * PROFILE_N \
+	 - 15LL * (i) * (i) * (i) * (i) * PROFILE_N \
+	 + 6LL * (i) * (i) * (i) * (i) * (i)) \
+	/ ((long long)PROFILE_N * PROFILE_N * PROFILE_N * PROFILE_N * PROFILE_N)))
+
+/** linear: s(i) = i / N */
+#define PROFILE_LINEAR(i) ((int)(PROFILE_ONE * (i) / PROFILE_N))
+
+/* expand M(0) .. M(PROFILE_N) as initializer list */
+#define PROFILE_REP8(M, b) M(b), M(b + 1), M(b + 2), M(b + 3), M(b + 4), M(b + 5), M(b + 6), M(b + 7),
+#define PROFILE_TABLE(M) { \
+	PROFILE_REP8(M, 0) PROFILE_REP8(M, 8) PROFILE_REP8(M, 16) PROFILE_REP8(M, 24) \
+	PROFILE_REP8(M, 32) PROFILE_REP8(M, 40) PROFILE_REP8(M, 48) PROFILE_REP8(M, 56) \
+	M(PROFILE_N) }
+
+
+/************ PROFILE TYPES ************/
+
+/**
+ * available profiles
+ */
+typedef enum {
+	PROFILE_LINEAR_ID = 0,
+	PROFILE_TRAPEZOID_ID,
+	PROFILE_SCURVE_ID,
+	PROFILE_COUNT
+} tProfileId;
+
+/**
+ * profile description
+ */
+typedef struct {
+	const char *name;   /// profile name
+	const int *table;   /// s(i / PROFILE_N) in Q16, PROFILE_N + 1 entries
+	int peakNum;        /// peak velocity / average velocity = peakNum / peakDen
+	int peakDen;
+} tProfile;
+
+/**
+ * state of one joint running a profile
+ */
+typedef struct {
+	const int *table;   /// profile table
+	int from;           /// start position
+	int dist;           /// signed distance to the end position
+	unsigned int x;     /// table position, PROFILE_N_BITS.(32 - PROFILE_N_BITS) fixed point
+	unsigned int dx;    /// table advance per tick
+	int left;           /// ticks left
+} tProfileRun;
+
+
+/************ PROFILE TABLES ************/
+
+static const int gProfileLinear[PROFILE_N + 1] = PROFILE_TABLE(PROFILE_LINEAR);
+static const int gProfileTrapezoid[PROFILE_N + 1] = PROFILE_TABLE(PROFILE_TRAP);
+static const int gProfileSCurve[PROFILE_N + 1] = PROFILE_TABLE(PROFILE_SCURVE);
+
+static const tProfile gProfiles[PROFILE_COUNT] = {
+	{"linear", gProfileLinear, 1, 1},
+	{"trapezoid", gProfileTrapezoid, 4, 3},
+	{"s-curve", gProfileSCurve, 15, 8},
+};
+
+
+/************ PROFILE FUNCTIONS ************/
+
+/**
+ * Number of servo periods a profiled move takes so its peak speed is speed
+ * @param id			profile
+ * @param dist			distance in degree
+ * @param speed			peak speed in degree per second (>0)
+ * @param ticksPerSec	periods per second
+ * @return number of periods, at least 1
+ */
+static inline int profile_periods(tProfileId id, int dist, int speed, int ticksPerSec)
+{
+	long long num = (long long)dist * ticksPerSec * gProfiles[id].peakNum;
+	long long den = (long long)speed * gProfiles[id].peakDen;
+	int numPeriods = (int)((num + den / 2) / den);
+	return numPeriods > 0 ? numPeriods : 1;
+}
+
+/**
+ * Prepare a profiled move
+ * @param id			profile
+ * @param from			start position
+ * @param to			end position
+ * @param numPeriods	number of ticks of the move (>0)
+ */
+static inline void profile_start(tProfileRun *run, tProfileId id, int from, int to, int numPeriods)
+{
+	run->table = gProfiles[id].table;
+	run->from = from;
+	run->dist = to - from;
+	run->x = 0;
+	// whole table (PROFILE_N intervals) in numPeriods ticks
+	run->dx = (unsigned int)((1ULL << 32) / numPeriods);
+	run->left = numPeriods;
+}
+
+/**
+ * Look a profile up between its table entries
+ * @param table			profile table
+ * @param x				table position, PROFILE_N_BITS.(32 - PROFILE_N_BITS) fixed point
+ * @return s(x) in Q16
+ */
+static inline int profile_lookup(const int *table, unsigned int x)
+{
+	unsigned int idx = x >> (32 - PROFILE_N_BITS);
+	unsigned int frac = (x >> (16 - PROFILE_N_BITS)) & 0xFFFF;
+	int s0 = table[idx];
+
+	return s0 + (int)(((long long)(table[idx + 1] - s0) * frac) >> 16);
+}
+
+/**
+ * Advance one tick
+ * @return position after the tick, exactly the end position on the last tick
+ */
+static inline int profile_next(tProfileRun *run)
+{
+	if (--run->left <= 0) {
+		return run->from + run->dist;
+	}
+	run->x += run->dx;
+
+	int s = profile_lookup(run->table, run->x);
+	return run->from + (int)(((long long)run->dist * s + (PROFILE_ONE / 2)) >> 16);
+}
+
+#endif /* MOTION_PROFILE_H */
@@ -0,0 +1,233 @@
+/**
+ * epoll based input reactor
+ *
+ * Watches any number of file descriptors (e.g. the WiiMote event files) plus
+ * an optional periodic timerfd and calls the handler of whichever becomes
+ * ready first. A button press is handled as soon as epoll wakes up, no matter
+ * whether accelerometer packets are arriving. A source can have a hangup
+ * handler of its own, e.g. for an input device that was unplugged.
+ */
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+
+/************ REACTOR CONSTANTS ************/
+
+/** maximum number of watched file descriptors */
+#define REACTOR_MAX_SOURCES 16
+
+
+/************ REACTOR TYPES ************/
+
+/**
+ * handler called when a source is readable
+ * @param fd			ready file descriptor
+ * @param ctx			context given when the source was added
+ */
+typedef void (*tReactorHandler)(int fd, void *ctx);
+
+/**
+ * one watched file descriptor
+ */
+typedef struct {
+	int fd;                  /// watched file descriptor
+	tReactorHandler handler; /// called when fd is readable
+	tReactorHandler hangup;  /// called instead of handler when fd hung up, NULL: handler sees it
+	void *ctx;               /// passed to handler
+} tReactorSource;
+
+/**
+ * structure for reactor object
+ */
+typedef struct {
+	int epfd;                                       /// epoll instance
+	int timerfd;                                    /// periodic tick, -1 if none
+	int count;                                      /// number of sources
+	tReactorSource sources[REACTOR_MAX_SOURCES];    /// watched sources
+	tReactorSource tick;                            /// tick handler behind timerfd
+	volatile int stop;                              /// set to leave reactor_run()
+} tReactor;
+
+
+/************ REACTOR FUNCTIONS ************/
+
+/**
+ * Initialize reactor
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int reactor_init(tReactor *r)
+{
+	r->count = 0;
+	r->stop = 0;
+	r->timerfd = -1;
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epfd == -1) {
+		perror("Could not create epoll instance");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Watch a file descriptor for input and hangup
+ * @param fd			file descriptor, should be O_NONBLOCK so handlers can drain it
+ * @param handler		called whenever fd is readable
+ * @param hangup		called once fd hung up or failed, has to remove it; NULL: handler is called
+ * @param ctx			passed to both handlers
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int reactor_watch(tReactor *r, int fd, tReactorHandler handler, tReactorHandler hangup, void *ctx)
+{
+	struct epoll_event ev;
+	int slot;
+
+	// reuse a slot given up by reactor_remove() first
+	for (slot = 0; slot < r->count && r->sources[slot].handler != NULL; ++slot)
+		;
+	if (slot == REACTOR_MAX_SOURCES) {
+		printf("Too many reactor sources\n");
+		return -1;
+	}
+
+	r->sources[slot].fd = fd;
+	r->sources[slot].handler = handler;
+	r->sources[slot].hangup = hangup;
+	r->sources[slot].ctx = ctx;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &r->sources[slot];
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		perror("Could not add source to epoll");
+		r->sources[slot].handler = NULL;
+		return -1;
+	}
+	if (slot == r->count) {
+		r->count++;
+	}
+	return 0;
+}
+
+/**
+ * Watch a file descriptor for input
+ * @param fd			file descriptor, should be O_NONBLOCK so handlers can drain it
+ * @param handler		called whenever fd is readable
+ * @param ctx			passed to handler
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int reactor_add(tReactor *r, int fd, tReactorHandler handler, void *ctx)
+{
+	return reactor_watch(r, fd, handler, NULL, ctx);
+}
+
+/**
+ * Stop watching a file descriptor (it stays open), e.g. a client that hung up
+ * @param fd			file descriptor given to reactor_add()
+ */
+static inline void reactor_remove(tReactor *r, int fd)
+{
+	for (int slot = 0; slot < r->count; ++slot) {
+		if (r->sources[slot].handler != NULL && r->sources[slot].fd == fd) {
+			epoll_ctl(r->epfd, EPOLL_CTL_DEL, fd, NULL);
+			// pending events of this epoll_wait() find no handler here, or the
+			// non-blocking fd of whoever reused the slot with nothing to read
+			r->sources[slot].handler = NULL;
+			r->sources[slot].fd = -1;
+			return;
+		}
+	}
+}
+
+/**
+ * timer handler: consume the expiration count, then call the tick handler
+ */
+static inline void reactor_timerHandler(int fd, void *ctx)
+{
+	unsigned long long expirations;
+	tReactorSource *tick = (tReactorSource *)ctx;
+
+	if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+		tick->handler(fd, tick->ctx);
+	}
+}
+
+/**
+ * Add a periodic tick, e.g. the control loop at the servo PWM period
+ * @param period_ns		tick period in ns
+ * @param handler		called once per tick
+ * @param ctx			passed to handler
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int reactor_addTimer(tReactor *r, long period_ns, tReactorHandler handler, void *ctx)
+{
+	struct itimerspec its;
+
+	r->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (r->timerfd == -1) {
+		perror("Could not create timerfd");
+		return -1;
+	}
+
+	its.it_interval.tv_sec = period_ns / 1000000000L;
+	its.it_interval.tv_nsec = period_ns % 1000000000L;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(r->timerfd, 0, &its, NULL) == -1) {
+		perror("Could not arm timerfd");
+		return -1;
+	}
+
+	r->tick.fd = r->timerfd;
+	r->tick.handler = handler;
+	r->tick.ctx = ctx;
+	return reactor_add(r, r->timerfd, reactor_timerHandler, &r->tick);
+}
+
+/**
+ * Dispatch ready sources until r->stop is set by a handler
+ * @return 0 on regular stop, != 0 on error
+ */
+static inline int reactor_run(tReactor *r)
+{
+	struct epoll_event events[REACTOR_MAX_SOURCES];
+
+	while (!r->stop) {
+		int n = epoll_wait(r->epfd, events, REACTOR_MAX_SOURCES, -1);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait failed");
+			return -1;
+		}
+		for (int i = 0; i < n && !r->stop; ++i) {
+			tReactorSource *src = (tReactorSource *)events[i].data.ptr;
+			if (src->handler == NULL) {
+				continue;
+			}
+			if (src->hangup != NULL && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+				src->hangup(src->fd, src->ctx);
+			} else {
+				src->handler(src->fd, src->ctx);
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * close the reactor (watched file descriptors stay open)
+ */
+static inline void reactor_close(tReactor *r)
+{
+	if (r->timerfd != -1) {
+		close(r->timerfd);
+	}
+	close(r->epfd);
+}
+
+#endif /* REACTOR_H */
@@ -0,0 +1,148 @@
+/**
+ * Opt-in real-time mode for the servo control thread
+ *
+ * Environment:
+ *   SERVO_RT_PRIO   SCHED_FIFO priority (1 .. 99) of the control thread, real-time mode is off if unset
+ *   SERVO_RT_CPU    CPU the control thread is pinned to, not pinned if unset
+ *
+ * Entering real-time mode locks all current and future memory, keeps malloc
+ * from giving memory back to the kernel, pre-faults the stack, pins the
+ * calling thread and switches it to SCHED_FIFO. Without the privileges
+ * needed (root or CAP_SYS_NICE / CAP_IPC_LOCK with a sufficient rlimit) the
+ * steps that fail are reported and the program keeps running as before.
+ */
+#ifndef RT_MODE_H
+#define RT_MODE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+/************ RT CONSTANTS ************/
+
+/** stack pre-faulted on entering real-time mode, bytes */
+#define RT_STACK_PREFAULT (256 * 1024)
+
+/** highest CPU number that can be pinned to + 1 */
+#define RT_CPU_MAX 1024
+
+
+/************ RT TYPES ************/
+
+/**
+ * real-time configuration
+ */
+typedef struct {
+	int prio;   /// SCHED_FIFO priority, 0: real-time mode off
+	int cpu;    /// CPU to pin to, -1: not pinned
+} tRtConfig;
+
+
+/************ RT FUNCTIONS ************/
+
+/**
+ * Read the real-time configuration from the environment
+ * @return 0 on success, != 0 if a setting is invalid
+ */
+static inline int rt_configure(tRtConfig *rt)
+{
+	const char *prio = getenv("SERVO_RT_PRIO");
+	const char *cpu = getenv("SERVO_RT_CPU");
+
+	rt->prio = 0;
+	rt->cpu = -1;
+	if (prio != NULL) {
+		rt->prio = atoi(prio);
+		if (rt->prio < sched_get_priority_min(SCHED_FIFO) || rt->prio > sched_get_priority_max(SCHED_FIFO)) {
+			printf("SERVO_RT_PRIO must be %d .. %d\n",
+					sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+			return -1;
+		}
+	}
+	if (cpu != NULL) {
+		rt->cpu = atoi(cpu);
+		if (rt->cpu < 0 || rt->cpu >= RT_CPU_MAX) {
+			printf("SERVO_RT_CPU must be a CPU number\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * touch the stack so later calls do not fault its pages in
+ */
+static inline void rt_prefaultStack(void)
+{
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+
+	memset((void *)stack, 0, sizeof(stack));
+}
+
+/**
+ * Pin the calling thread to a CPU
+ * @param cpu			CPU number (< RT_CPU_MAX)
+ * @return 0 on success, != 0 otherwise
+ */
+static inline int rt_pin(int cpu)
+{
+	// raw syscall, the glibc wrapper and cpu_set_t need _GNU_SOURCE
+	unsigned long mask[RT_CPU_MAX / (8 * sizeof(unsigned long))];
+
+	memset(mask, 0, sizeof(mask));
+	mask[cpu / (8 * sizeof(unsigned long))] = 1UL << (cpu % (8 * sizeof(unsigned long)));
+	// tid 0 is the calling thread only, threads started earlier are not pinned
+	return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0 ? -1 : 0;
+}
+
+/**
+ * Enter real-time mode with the calling thread
+ * @return 0 if every step succeeded, != 0 otherwise (the program can go on without)
+ */
+static inline int rt_enter(const tRtConfig *rt)
+{
+	int failed = 0;
+
+	if (rt->prio == 0 && rt->cpu < 0) {
+		return 0;
+	}
+
+	if (rt->prio != 0) {
+		// no page faults once running: lock everything mapped now and later,
+		// keep freed heap mapped and never serve malloc() from fresh mmap()s
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+			perror("Real-time mode: mlockall failed");
+			failed = 1;
+		}
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+		rt_prefaultStack();
+	}
+
+	if (rt->cpu >= 0 && rt_pin(rt->cpu) != 0) {
+		perror("Real-time mode: pinning to CPU failed");
+		failed = 1;
+	}
+
+	if (rt->prio != 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt->prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+			perror("Real-time mode: SCHED_FIFO failed");
+			failed = 1;
+		}
+	}
+
+	printf("Real-time mode: priority %d, CPU %d%s\n", rt->prio, rt->cpu,
+			failed ? " (incomplete, see above)" : "");
+	return failed ? -1 : 0;
+}
+
+#endif /* RT_MODE_H */
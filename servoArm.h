@@ -0,0 +1,294 @@
+/**
+ * Arm instances and the scheduler driving them
+ *
+ * A tServoArm is everything one arm needs: its own register backend (see
+ * servo_backendOpenArm()), shadow registers, safety grid and motion executor
+ * (motionExec.h) with the moves in flight. Nothing of it is global, so one
+ * process can drive as many arms as the cell has.
+ *
+ * The scheduler runs one worker thread per core, up to the number of arms.
+ * Arm n belongs to worker n % workers for good: it is only ever ticked by that
+ * thread, so arms need no locks. Every servo tick (SERVO_PERIOD_NS) a worker
+ * advances all of its arms and flushes their changed registers. Commands for
+ * an arm come from one other thread through the arm's executor ring. A command
+ * whose end pose would collide is refused right away; a pose on the way that
+ * the collision check refuses stops the moves of the arm where it is.
+ *
+ * Workers are pinned to consecutive CPUs, from SERVO_RT_CPU on if set, and run
+ * real-time if SERVO_RT_PRIO is set (rtMode.h). Build with -lm -pthread.
+ */
+#ifndef SERVO_ARM_H
+#define SERVO_ARM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "servoBackend.h"
+#include "servoShadow.h"
+#include "servoSafety.h"
+#include "servoJoints.h"
+#include "servoTick.h"
+#include "motionExec.h"
+#include "rtMode.h"
+
+
+/************ ARM CONSTANTS ************/
+
+/** most arms per process */
+#define ARM_MAX 64
+
+/** most scheduler workers */
+#define ARM_MAX_WORKERS 64
+
+
+/************ ARM TYPES ************/
+
+/**
+ * one arm
+ */
+typedef struct {
+	int index;                      /// arm number, selects the register block
+	tServoBackend backend;          /// register backend of this arm
+	tServoShadow shadow;            /// register cache, flushed once per tick
+	tServoSafety safety;            /// joint limits and collision grid
+	unsigned char posn[JOINT_COUNT]; /// last commanded position per joint
+	tMotionExec motion;             /// moves in flight, fed by the command thread
+	unsigned long long ticks;       /// ticks the arm was advanced
+	unsigned long long refused;     /// commands refused, their end pose would collide (command thread)
+} tServoArm;
+
+typedef struct tArmScheduler tArmScheduler;
+
+/**
+ * scheduler thread, owns every nth arm
+ */
+typedef struct {
+	tArmScheduler *sched;           /// scheduler the worker belongs to
+	int index;                      /// worker number, its arms are index, index + workers, ...
+	pthread_t thread;               /// the thread
+	unsigned long long ticks;       /// ticks run
+	unsigned long long overruns;    /// ticks missed, the arms took longer than a period
+	unsigned long long busy_ns;     /// time spent ticking arms
+} tArmWorker;
+
+/**
+ * scheduler of all arms
+ */
+struct tArmScheduler {
+	tServoArm *arms;                /// arms driven
+	int count;                      /// number of arms
+	int workers;                    /// number of worker threads
+	int cpus;                       /// CPUs online
+	long period_ns;                 /// tick period, 0: tick as fast as possible
+	tRtConfig rt;                   /// real-time settings of the workers
+	volatile int stop;              /// ends the workers
+	tArmWorker worker[ARM_MAX_WORKERS]; /// worker threads
+};
+
+
+/************ ARM FUNCTIONS ************/
+
+/**
+ * Open an arm and move it to its home pose
+ * @param index			arm number
+ * @param safety		collision grid to copy, NULL builds one
+ * @return 0 on success, != 0 otherwise
+ */
+static inline int arm_open(tServoArm *arm, int index, const tServoSafety *safety)
+{
+	int pose[JOINT_COUNT];
+
+	memset(arm, 0, sizeof(*arm));
+	arm->index = index;
+	if (servo_backendOpenArm(&arm->backend, index) != 0) {
+		return -1;
+	}
+	shadow_init(&arm->shadow);
+	// the grid only depends on the arm geometry, every arm can share the same
+	if (safety != NULL) {
+		memcpy(&arm->safety, safety, sizeof(arm->safety));
+		arm->safety.clamped = 0;
+		arm->safety.blocked = 0;
+	} else {
+		safety_init(&arm->safety);
+	}
+
+	joint_homePose(arm->posn);
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		pose[j] = arm->posn[j];
+		shadow_set(&arm->shadow, gJoints[j].offset, joint_regValue(arm->posn[j], JOINT_HOME_SPEED));
+	}
+	shadow_flush(&arm->shadow, &arm->backend);
+	motion_init(&arm->motion, pose);
+	return 0;
+}
+
+/**
+ * Release an arm
+ */
+static inline void arm_close(tServoArm *arm)
+{
+	arm->backend.close(&arm->backend);
+}
+
+/**
+ * Pass a command to an arm, never waits for its moves (command thread only)
+ * @return 0 if queued, != 0 if refused because its end pose would collide
+ */
+static inline int arm_command(tServoArm *arm, tMotionCmd *cmd)
+{
+	int pose[JOINT_COUNT];
+
+	motion_target(&arm->motion, cmd, pose);
+	if (!safety_poseSafe(&arm->safety, pose[JOINT_BICEP], pose[JOINT_ELBOW], pose[JOINT_WRIST])) {
+		arm->refused++;
+		return -1;
+	}
+	motion_command(&arm->motion, cmd);
+	return 0;
+}
+
+/**
+ * Advance an arm one tick: next position of every moving joint, checked and
+ * written in one flush. Each register gets the step of this tick as speed, so
+ * the FPGA speed limiter arrives with the tick. If the pose is refused the
+ * moves stop at the positions written last, instead of going on without the servos.
+ */
+static inline void arm_tick(tServoArm *arm)
+{
+	int pose[JOINT_COUNT];
+	unsigned char want[JOINT_COUNT];
+	unsigned char from[JOINT_COUNT];
+	unsigned long long latency;
+	unsigned int mask = 0;
+
+	arm->ticks++;
+	if (motion_tick(&arm->motion, pose, &latency) == 0) {
+		return;
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		want[j] = joint_clamp(j, pose[j]);
+		mask |= (want[j] != arm->posn[j]) << j;
+	}
+	memcpy(from, arm->posn, sizeof(from));
+	if (mask == 0) {
+		return;
+	}
+	if (safety_checkPose(&arm->safety, arm->posn, want, mask) != 0) {
+		for (int j = 0; j < JOINT_COUNT; ++j) {
+			pose[j] = arm->posn[j];
+		}
+		motion_hold(&arm->motion, pose);
+		return;
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		if (mask & (1 << j)) {
+			int step = abs(arm->posn[j] - from[j]);
+			shadow_set(&arm->shadow, gJoints[j].offset, joint_regValue(arm->posn[j], step));
+		}
+	}
+	shadow_flush(&arm->shadow, &arm->backend);
+}
+
+/**
+ * worker thread: tick its arms every period
+ */
+static inline void *arm_worker(void *arg)
+{
+	tArmWorker *w = (tArmWorker *)arg;
+	tArmScheduler *s = w->sched;
+	tRtConfig rt = s->rt;
+	tTick tick;
+
+	// one core per worker, real-time only if asked for
+	rt.cpu = ((s->rt.cpu >= 0 ? s->rt.cpu : 0) + w->index) % s->cpus;
+	if (rt.prio != 0) {
+		rt_enter(&rt);
+	} else if (rt_pin(rt.cpu) != 0) {
+		perror("Pinning arm worker failed");
+	}
+
+	tick_start(&tick, s->period_ns);
+	while (!s->stop) {
+		if (s->period_ns > 0) {
+			w->overruns += tick_wait(&tick);
+		}
+		unsigned long long start = servo_nowNs();
+		for (int i = w->index; i < s->count; i += s->workers) {
+			arm_tick(&s->arms[i]);
+		}
+		w->busy_ns += servo_nowNs() - start;
+		w->ticks++;
+	}
+	return NULL;
+}
+
+/**
+ * Start ticking arms, one worker per core but no more than arms
+ * @param arms			opened arms
+ * @param count			number of arms (<= ARM_MAX)
+ * @param period_ns		tick period, SERVO_PERIOD_NS; 0 ticks as fast as possible (benchmarks)
+ * @param rt			real-time settings, see rtMode.h
+ * @return 0 on success, != 0 otherwise (no worker runs)
+ */
+static inline int arm_schedStart(tArmScheduler *s, tServoArm *arms, int count, long period_ns, const tRtConfig *rt)
+{
+	memset(s, 0, sizeof(*s));
+	s->arms = arms;
+	s->count = count;
+	s->period_ns = period_ns;
+	s->rt = *rt;
+	s->cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	s->cpus = s->cpus > 0 && s->cpus <= RT_CPU_MAX ? s->cpus : 1;
+	s->workers = count < s->cpus ? count : s->cpus;
+	if (s->workers > ARM_MAX_WORKERS) {
+		s->workers = ARM_MAX_WORKERS;
+	}
+	if (s->workers < 1) {
+		s->workers = 1;
+	}
+
+	for (int i = 0; i < s->workers; ++i) {
+		s->worker[i].sched = s;
+		s->worker[i].index = i;
+		if (pthread_create(&s->worker[i].thread, NULL, arm_worker, &s->worker[i]) != 0) {
+			printf("Could not start arm worker %d\n", i);
+			s->stop = 1;
+			while (--i >= 0) {
+				pthread_join(s->worker[i].thread, NULL);
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Stop the workers, moves in flight stop where they are
+ */
+static inline void arm_schedStop(tArmScheduler *s)
+{
+	s->stop = 1;
+	for (int i = 0; i < s->workers; ++i) {
+		pthread_join(s->worker[i].thread, NULL);
+	}
+}
+
+/**
+ * Print the tick counters of the workers
+ * @param out			stream to print to
+ */
+static inline void arm_schedPrint(const tArmScheduler *s, FILE *out)
+{
+	for (int i = 0; i < s->workers; ++i) {
+		const tArmWorker *w = &s->worker[i];
+		fprintf(out, "worker %d: %d arms, %llu ticks, %llu missed, %.1f us per tick\n", i,
+				(s->count - i + s->workers - 1) / s->workers, w->ticks, w->overruns,
+				w->ticks ? w->busy_ns / 1e3 / w->ticks : 0.0);
+	}
+}
+
+#endif /* SERVO_ARM_H */
@@ -0,0 +1,354 @@
+/**
+ * Register backends for the servo FPGA block
+ *
+ * The servo programs write their registers through a tServoBackend instead of
+ * a raw pointer, so they can run on the board (/dev/mem), against a simulated
+ * register block in shared memory, or against nothing at all. The backend is
+ * picked by name, usually from the SERVO_BACKEND environment variable:
+ *
+ *   devmem   map BASE_ADDRESS through /dev/mem (default, needs the board)
+ *   sim      shared memory copy of the register block, every write is
+ *            timestamped into a log. Uses SERVO_SIM_PATH as backing file if
+ *            set (so other processes can map it), an anonymous memfd otherwise.
+ *   null     discard all writes, reads return 0
+ *
+ * A process driving several arms opens one backend per arm with
+ * servo_backendOpenArm(). Arm n maps its own register block: the nth address
+ * of SERVO_ARM_BASES (comma separated) if set, BASE_ADDRESS + n *
+ * SERVO_ARM_STRIDE otherwise. The simulator of arm n > 0 uses
+ * SERVO_SIM_PATH.n as backing file, arm 0 SERVO_SIM_PATH itself.
+ */
+#ifndef SERVO_BACKEND_H
+#define SERVO_BACKEND_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+/************ BACKEND CONSTANTS ************/
+
+#define BASE_ADDRESS 0x400D0000
+
+/** distance of the register blocks of consecutive arms if SERVO_ARM_BASES is not set */
+#define SERVO_ARM_STRIDE 0x10000
+
+/** end of the servo register block (last register at 0x110) */
+#define SERVO_REG_END 0x114
+
+/** number of writes kept in the simulator log (power of 2) */
+#define SERVO_SIM_LOG_LEN 4096
+
+#define REG_WRITE(addr, off, val) (*(volatile int*)(addr+off)=(val))
+#define REG_READ(addr, off) (*(volatile int*)(addr+off))
+
+
+/************ BACKEND TYPES ************/
+
+/**
+ * one logged register write of the simulator
+ */
+typedef struct {
+	unsigned long long t_ns; /// CLOCK_MONOTONIC time of the write
+	unsigned int off;        /// register offset
+	unsigned int val;        /// value written
+} tServoSimWrite;
+
+/**
+ * layout of the simulator shared memory
+ */
+typedef struct {
+	unsigned char regs[SERVO_REG_END];       /// mirror of the register window
+	unsigned long long writes;               /// total writes so far, next log slot is writes % SERVO_SIM_LOG_LEN
+	tServoSimWrite log[SERVO_SIM_LOG_LEN];   /// ring of the most recent writes
+} tServoSim;
+
+typedef struct tServoBackend tServoBackend;
+
+/**
+ * register backend: operations plus the state they work on
+ */
+struct tServoBackend {
+	const char *name;                                                      /// backend name
+	int (*open)(tServoBackend *be);                                        /// 0 upon success, 1 otherwise
+	void (*write)(tServoBackend *be, unsigned int off, unsigned int val);  /// write register at off
+	void (*writeBlock)(tServoBackend *be, unsigned int off, const unsigned int *val, unsigned int count); /// write count consecutive registers from off on
+	unsigned int (*read)(tServoBackend *be, unsigned int off);             /// read register at off
+	void (*close)(tServoBackend *be);                                      /// release the backend
+
+	unsigned char *test_base; /// base address of mapped register window
+	int fd;                   /// file descriptor for memory map
+	int map_len;              /// size of mapping window
+	unsigned long base;       /// physical address of the register block (devmem)
+	int arm;                  /// arm the register block belongs to
+	tServoSim *sim;           /// simulator state (sim backend only)
+};
+
+
+/************ BACKEND FUNCTIONS ************/
+
+/**
+ * current CLOCK_MONOTONIC time
+ * @return time in ns
+ */
+static inline unsigned long long servo_nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*---- /dev/mem ----*/
+
+static inline int servo_devmemOpen(tServoBackend *be)
+{
+	//Open the file regarding memory mapped IO to write values for the FPGA
+	be->fd = open("/dev/mem", O_RDWR);
+	if (be->fd == -1) {
+		perror("Could not open /dev/mem");
+		return 1;
+	}
+
+	unsigned long int PhysicalAddress = be->base;
+	be->map_len = SERVO_REG_END;  //size of mapping window
+
+	// map physical memory startin at the arm's base address into own virtual memory
+	be->test_base = (unsigned char*)mmap(NULL, be->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, be->fd, (off_t)PhysicalAddress);
+
+	// did it work?
+	if (be->test_base == MAP_FAILED) {
+		perror("Mapping memory for absolute memory access failed -- Test Try\n");
+		close(be->fd);
+		return 1;
+	}
+	return 0;
+}
+
+static inline void servo_devmemWrite(tServoBackend *be, unsigned int off, unsigned int val)
+{
+	REG_WRITE(be->test_base, off, val);
+}
+
+static inline void servo_devmemWriteBlock(tServoBackend *be, unsigned int off, const unsigned int *val, unsigned int count)
+{
+	// back to back ascending stores, one call for the whole run
+	volatile unsigned int *reg = (volatile unsigned int *)(be->test_base + off);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		reg[i] = val[i];
+	}
+}
+
+static inline unsigned int servo_devmemRead(tServoBackend *be, unsigned int off)
+{
+	return REG_READ(be->test_base, off);
+}
+
+static inline void servo_devmemClose(tServoBackend *be)
+{
+	// Releasing the mapping in memory
+	munmap((void *)be->test_base, be->map_len);
+	close(be->fd);
+}
+
+/*---- shared memory simulator ----*/
+
+static inline int servo_simOpen(tServoBackend *be)
+{
+	const char *path = getenv("SERVO_SIM_PATH");
+	char armPath[256];
+
+	if (path != NULL && be->arm > 0) {
+		snprintf(armPath, sizeof(armPath), "%s.%d", path, be->arm);
+		path = armPath;
+	}
+	if (path != NULL) {
+		be->fd = open(path, O_RDWR | O_CREAT, 0644);
+	} else {
+		// anonymous shared memory, still reachable through /proc/<pid>/fd
+		be->fd = syscall(SYS_memfd_create, "servo-sim", 0);
+	}
+	if (be->fd == -1) {
+		perror("Could not create simulated register block");
+		return 1;
+	}
+
+	be->map_len = sizeof(tServoSim);
+	if (ftruncate(be->fd, be->map_len) != 0) {
+		perror("Could not size simulated register block");
+		close(be->fd);
+		return 1;
+	}
+
+	be->sim = (tServoSim *)mmap(NULL, be->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, be->fd, 0);
+	if (be->sim == MAP_FAILED) {
+		perror("Mapping simulated register block failed");
+		close(be->fd);
+		return 1;
+	}
+	be->test_base = be->sim->regs;
+	return 0;
+}
+
+static inline void servo_simWrite(tServoBackend *be, unsigned int off, unsigned int val)
+{
+	tServoSim *sim = be->sim;
+	unsigned long long n = sim->writes;
+	tServoSimWrite *entry = &sim->log[n & (SERVO_SIM_LOG_LEN - 1)];
+
+	REG_WRITE(be->test_base, off, val);
+
+	entry->t_ns = servo_nowNs();
+	entry->off = off;
+	entry->val = val;
+	// publish the entry after it is complete, readers may be in another process
+	__atomic_store_n(&sim->writes, n + 1, __ATOMIC_RELEASE);
+}
+
+static inline void servo_simWriteBlock(tServoBackend *be, unsigned int off, const unsigned int *val, unsigned int count)
+{
+	tServoSim *sim = be->sim;
+	unsigned long long n = sim->writes;
+	unsigned long long now = servo_nowNs();
+
+	// one time stamp and one publish for the whole run, still one log entry per register
+	for (unsigned int i = 0; i < count; ++i) {
+		tServoSimWrite *entry = &sim->log[(n + i) & (SERVO_SIM_LOG_LEN - 1)];
+
+		REG_WRITE(be->test_base, off + 4 * i, val[i]);
+		entry->t_ns = now;
+		entry->off = off + 4 * i;
+		entry->val = val[i];
+	}
+	__atomic_store_n(&sim->writes, n + count, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int servo_simRead(tServoBackend *be, unsigned int off)
+{
+	return REG_READ(be->test_base, off);
+}
+
+static inline void servo_simClose(tServoBackend *be)
+{
+	munmap((void *)be->sim, be->map_len);
+	close(be->fd);
+}
+
+/*---- null sink ----*/
+
+static inline int servo_nullOpen(tServoBackend *be)
+{
+	be->fd = -1;
+	be->map_len = 0;
+	return 0;
+}
+
+static inline void servo_nullWrite(tServoBackend *be, unsigned int off, unsigned int val)
+{
+	(void)be; (void)off; (void)val;
+}
+
+static inline void servo_nullWriteBlock(tServoBackend *be, unsigned int off, const unsigned int *val, unsigned int count)
+{
+	(void)be; (void)off; (void)val; (void)count;
+}
+
+static inline unsigned int servo_nullRead(tServoBackend *be, unsigned int off)
+{
+	(void)be; (void)off;
+	return 0;
+}
+
+static inline void servo_nullClose(tServoBackend *be)
+{
+	(void)be;
+}
+
+/**
+ * Select a backend by name.
+ * @param be			backend to set up (not opened yet)
+ * @param name			"devmem", "sim" or "null", NULL selects "devmem"
+ * @return 0 upon success, 1 for an unknown name
+ */
+static inline int servo_backendSelect(tServoBackend *be, const char *name)
+{
+	memset(be, 0, sizeof(*be));
+	be->base = BASE_ADDRESS;
+
+	if (name == NULL || strcmp(name, "devmem") == 0) {
+		be->name = "devmem";
+		be->open = servo_devmemOpen;
+		be->write = servo_devmemWrite;
+		be->writeBlock = servo_devmemWriteBlock;
+		be->read = servo_devmemRead;
+		be->close = servo_devmemClose;
+	} else if (strcmp(name, "sim") == 0) {
+		be->name = "sim";
+		be->open = servo_simOpen;
+		be->write = servo_simWrite;
+		be->writeBlock = servo_simWriteBlock;
+		be->read = servo_simRead;
+		be->close = servo_simClose;
+	} else if (strcmp(name, "null") == 0) {
+		be->name = "null";
+		be->open = servo_nullOpen;
+		be->write = servo_nullWrite;
+		be->writeBlock = servo_nullWriteBlock;
+		be->read = servo_nullRead;
+		be->close = servo_nullClose;
+	} else {
+		printf("Unknown servo backend '%s'\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Select the backend named by SERVO_BACKEND (default devmem) and open it.
+ * @param be			backend to open
+ * @return 0 upon success, 1 otherwise
+ */
+static inline int servo_backendOpen(tServoBackend *be)
+{
+	if (servo_backendSelect(be, getenv("SERVO_BACKEND")) != 0) {
+		return 1;
+	}
+	return be->open(be);
+}
+
+/**
+ * Select the backend named by SERVO_BACKEND and open the register block of one arm.
+ * @param be			backend to open
+ * @param arm			arm number, 0 is the arm of single arm programs
+ * @return 0 upon success, 1 otherwise
+ */
+static inline int servo_backendOpenArm(tServoBackend *be, int arm)
+{
+	const char *bases = getenv("SERVO_ARM_BASES");
+
+	if (servo_backendSelect(be, getenv("SERVO_BACKEND")) != 0) {
+		return 1;
+	}
+	be->arm = arm;
+	be->base = BASE_ADDRESS + (unsigned long)arm * SERVO_ARM_STRIDE;
+	if (bases != NULL) {
+		// nth entry of the list
+		for (int n = 0; n < arm && bases != NULL; ++n) {
+			bases = strchr(bases, ',');
+			bases = bases != NULL ? bases + 1 : NULL;
+		}
+		if (bases == NULL) {
+			printf("SERVO_ARM_BASES has no address for arm %d\n", arm);
+			return 1;
+		}
+		be->base = strtoul(bases, NULL, 0);
+	}
+	return be->open(be);
+}
+
+#endif /* SERVO_BACKEND_H */
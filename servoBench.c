@@ -0,0 +1,1278 @@
+/**
+ * Benchmarks for the servo control hot paths
+ *
+ * Runs without the board: gcc -O2 -pthread -o servoBench servoBench.c -lm
+ *
+ * The arm scheduler is measured last, with 1 to ARM_MAX simulated arms
+ * ticked as fast as the workers can: arm ticks per second over arm count
+ * shows how it scales with the cores.
+ *
+ * Usage: servoBench [-j results.json] [wiimote log]
+ *   -j   also write the results as JSON ("-" for stdout) to track them between versions
+ * With a log recorded by wiimoteServoControl (WIIMOTE_RECORD) the accelerometer
+ * filters are checked on the recorded motion and the whole input -> filter ->
+ * actuation loop is driven by it, otherwise by a synthetic session.
+ *
+ * wiimoteServoControl.c is built in (without its main()) so its servo and
+ * WiiMote functions are measured as they are, not as copies.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <sys/utsname.h>
+
+#include "servoTick.h"
+#include "servoInterp.h"
+#include "accelFilter.h"
+#include "wiimoteLog.h"
+#include "telemetry.h"
+#include "motionExec.h"
+#include "servoArm.h"
+#include "gesture.h"
+
+#define WIIMOTE_NO_MAIN
+#include "wiimoteServoControl.c"
+
+
+/************ BENCH CONSTANTS ************/
+
+/** joints stepped per tick */
+#define BENCH_JOINTS 5
+
+/** repetitions of the move sweep */
+#define BENCH_REPEAT 20
+
+/** accelerometer samples filtered, 100 Hz like the WiiMote */
+#define BENCH_FILTER_SAMPLES 200000
+#define BENCH_FILTER_PERIOD_NS 10000000ULL
+
+/** noise added to the accelerometer samples, +- raw units */
+#define BENCH_FILTER_NOISE 20
+
+/** frames a tilt is held in the tilt range check, 1 s */
+#define BENCH_TILT_FRAMES 100
+
+/** per sample cost budget of a filter, ns */
+#define BENCH_FILTER_BUDGET_NS 300
+
+/** per solve budget of the inverse kinematics, ns */
+#define BENCH_IK_BUDGET_NS 10000
+
+/** WiiMote accelerometer rate the inverse kinematics has to keep up with, Hz */
+#define BENCH_ACCEL_RATE 100
+
+/** per command budget of the safety check, ns */
+#define BENCH_SAFETY_BUDGET_NS 50
+
+/** ns per accelerometer sample allowed for the gesture recognizer, the report period is 10 ms */
+#define BENCH_GESTURE_BUDGET_NS 2000
+
+/** accelerometer samples run through the gesture recognizer, 50 minutes at 100 Hz */
+#define BENCH_GESTURE_SAMPLES 300000
+
+/** samples from the start of one synthetic gesture to the next */
+#define BENCH_GESTURE_SPACING 150
+
+/** samples before and after its end a gesture may be recognized */
+#define BENCH_GESTURE_EARLY 16
+#define BENCH_GESTURE_LATE 16
+
+/** every this many synthetic gestures one is motion that is no gesture */
+#define BENCH_GESTURE_OTHER 4
+
+/** per sample budget of the telemetry sampler, ns */
+#define BENCH_TELEM_BUDGET_NS 200
+
+/** per tick budget of the motion executor, ns */
+#define BENCH_MOTION_BUDGET_NS 500
+
+/** executor ticks between new targets */
+#define BENCH_MOTION_RETARGET 7
+
+/** wall time each arm count is scheduled, ns */
+#define BENCH_ARMS_NS 400000000ULL
+
+/** new pose for every arm this often, ns */
+#define BENCH_ARMS_COMMAND_NS 1000000ULL
+
+/** grid steps per axis of the inverse kinematics targets */
+#define BENCH_IK_STEPS 40
+
+/** servo_move() and register write calls per benchmark */
+#define BENCH_SERVO_CALLS 10000000
+
+/** input events per pipe fill, must fit into the pipe (64 KiB) */
+#define BENCH_EVENTS_PER_FILL 2048
+
+/** pipe fills per parsing benchmark */
+#define BENCH_FILLS 200
+
+/** accelerometer frames of the synthetic session for the full loop */
+#define BENCH_LOOP_FRAMES 20000
+
+/** most results kept for the JSON output */
+#define BENCH_MAX_RESULTS 48
+
+
+/************ BENCH TYPES ************/
+
+/**
+ * result of one benchmark
+ */
+typedef struct {
+	char name[40];            /// benchmark name
+	unsigned long long ops;   /// operations done
+	unsigned long long ns;    /// wall clock time
+	unsigned long long misses; /// moves that did not end on the target
+	double error;             /// filters: RMS deviation from the noise free signal, ik: RMS position error in mm, < 0 if not applicable
+	double budget;            /// ns per op allowed, 0 if none
+} tBenchResult;
+
+
+/** keeps the compiler from dropping the computed positions */
+volatile int gSink;
+
+/** all results so far, for the JSON output */
+tBenchResult gResults[BENCH_MAX_RESULTS];
+int gResultCount;
+
+
+/************ BENCH FUNCTIONS ************/
+
+/**
+ * current CLOCK_MONOTONIC time
+ * @return time in ns
+ */
+static unsigned long long bench_nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * start a result
+ * @param name			benchmark name
+ */
+static tBenchResult bench_result(const char *name)
+{
+	tBenchResult r;
+
+	memset(&r, 0, sizeof(r));
+	snprintf(r.name, sizeof(r.name), "%s", name);
+	r.error = -1;
+	return r;
+}
+
+/**
+ * print one result and keep it for the JSON output
+ */
+static void bench_print(const tBenchResult *r)
+{
+	if (gResultCount < BENCH_MAX_RESULTS) {
+		gResults[gResultCount++] = *r;
+	}
+
+	const char *over = r->budget > 0 && (double)r->ns / r->ops > r->budget ? "  OVER BUDGET" : "";
+
+	if (r->error >= 0) {
+		printf("%-24s %12llu ops %10.2f ns/op  rms error %.2f%s\n", r->name, r->ops, (double)r->ns / r->ops,
+				r->error, over);
+	} else {
+		printf("%-24s %12llu ops %10.2f ns/op  misses %llu%s\n",
+				r->name, r->ops, (double)r->ns / r->ops, r->misses, over);
+	}
+}
+
+/**
+ * Interpolate a sweep of moves per joint with the float path servoMove() used
+ * before: (int)(from + increment * i)
+ */
+static tBenchResult bench_interpFloat(void)
+{
+	tBenchResult r = bench_result("interp float");
+	unsigned long long start = bench_nowNs();
+
+	for (int rep = 0; rep < BENCH_REPEAT; ++rep) {
+		for (int from = 60; from <= 240; from += 30) {
+			for (int to = 60; to <= 240; to += 7) {
+				for (int speed = 5; speed <= 90; speed += 17) {
+					int numPeriods = interp_periods(abs(to - from), speed, SERVO_TICKS_PER_SEC);
+					float increment[BENCH_JOINTS];
+					int posn = 0;
+
+					for (int j = 0; j < BENCH_JOINTS; ++j) {
+						increment[j] = (float)(to - from - j) / (float)numPeriods;
+					}
+					for (int i = 1; i <= numPeriods; ++i) {
+						for (int j = 0; j < BENCH_JOINTS; ++j) {
+							posn = (int)(from + (increment[j] * i));
+							gSink = posn;
+						}
+					}
+					r.ops += (unsigned long long)numPeriods * BENCH_JOINTS;
+					if (posn != to - (BENCH_JOINTS - 1)) {
+						r.misses++;
+					}
+				}
+			}
+		}
+	}
+	r.ns = bench_nowNs() - start;
+	return r;
+}
+
+/**
+ * Same sweep with the Q16.16 error diffusion interpolator
+ */
+static tBenchResult bench_interpFixed(void)
+{
+	tBenchResult r = bench_result("interp fixed Q16.16");
+	unsigned long long start = bench_nowNs();
+
+	for (int rep = 0; rep < BENCH_REPEAT; ++rep) {
+		for (int from = 60; from <= 240; from += 30) {
+			for (int to = 60; to <= 240; to += 7) {
+				for (int speed = 5; speed <= 90; speed += 17) {
+					int numPeriods = interp_periods(abs(to - from), speed, SERVO_TICKS_PER_SEC);
+					tInterp ip[BENCH_JOINTS];
+					int posn = 0;
+
+					for (int j = 0; j < BENCH_JOINTS; ++j) {
+						interp_start(&ip[j], from, to - j, numPeriods);
+					}
+					for (int i = 1; i <= numPeriods; ++i) {
+						for (int j = 0; j < BENCH_JOINTS; ++j) {
+							posn = interp_next(&ip[j]);
+							gSink = posn;
+						}
+					}
+					r.ops += (unsigned long long)numPeriods * BENCH_JOINTS;
+					if (posn != to - (BENCH_JOINTS - 1)) {
+						r.misses++;
+					}
+				}
+			}
+		}
+	}
+	r.ns = bench_nowNs() - start;
+	return r;
+}
+
+
+/**
+ * reproducible noise in -BENCH_FILTER_NOISE .. BENCH_FILTER_NOISE
+ * @param state			generator state
+ */
+static int bench_noise(unsigned int *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return (int)((*state >> 16) % (2 * BENCH_FILTER_NOISE + 1)) - BENCH_FILTER_NOISE;
+}
+
+/**
+ * Filter noisy accelerometer samples, per sample cost and accuracy
+ * @param name			benchmark name
+ * @param id			filter
+ * @param clean			noise free samples, X Y Z per sample
+ * @param count			number of samples
+ */
+static tBenchResult bench_filter(const char *name, tFilterId id, const short (*clean)[FILTER_AXES], size_t count)
+{
+	tBenchResult r = bench_result(name);
+	short (*noisy)[FILTER_AXES] = malloc(count * sizeof(*noisy));
+	int (*out)[FILTER_AXES] = malloc(count * sizeof(*out));
+	unsigned int seed = 1;
+	tAccelFilter f;
+	double sum = 0;
+
+	r.ops = count;
+	r.budget = BENCH_FILTER_BUDGET_NS;
+
+	for (size_t i = 0; i < count; ++i) {
+		for (int a = 0; a < FILTER_AXES; ++a) {
+			noisy[i][a] = clean[i][a] + bench_noise(&seed);
+		}
+	}
+
+	filter_init(&f, id);
+	unsigned long long start = bench_nowNs();
+	for (size_t i = 0; i < count; ++i) {
+		filter_apply(&f, noisy[i], i * BENCH_FILTER_PERIOD_NS, out[i]);
+	}
+	r.ns = bench_nowNs() - start;
+
+	for (size_t i = 0; i < count; ++i) {
+		for (int a = 0; a < FILTER_AXES; ++a) {
+			double d = out[i][a] - clean[i][a];
+			sum += d * d;
+		}
+	}
+	r.error = sqrt(sum / (count * FILTER_AXES));
+	free(noisy);
+	free(out);
+	return r;
+}
+
+/**
+ * Run all filters on a synthetic tilt motion, a slow sine per axis
+ */
+static void bench_filterSynthetic(void)
+{
+	short (*clean)[FILTER_AXES] = malloc(BENCH_FILTER_SAMPLES * sizeof(*clean));
+	char name[40];
+
+	for (size_t i = 0; i < BENCH_FILTER_SAMPLES; ++i) {
+		for (int a = 0; a < FILTER_AXES; ++a) {
+			clean[i][a] = (short)lrint(100 * sin(2 * M_PI * (0.2 + 0.1 * a) * i * BENCH_FILTER_PERIOD_NS / 1e9));
+		}
+	}
+	for (int id = 0; id < FILTER_COUNT; ++id) {
+		snprintf(name, sizeof(name), "filter %s", gFilterNames[id]);
+		tBenchResult r = bench_filter(name, (tFilterId)id, clean, BENCH_FILTER_SAMPLES);
+		bench_print(&r);
+	}
+	free(clean);
+}
+
+/**
+ * Check the tilt -> position mapping of control_apply() with every filter: the
+ * remote held level, then tilted 1 g to either side for a second, has to end
+ * up in the middle and at both ends of the commanded range
+ */
+static tBenchResult bench_tilt(void)
+{
+	const int tilts[] = {0, ACCEL_FULL_TILT, -ACCEL_FULL_TILT};
+	const int expect[] = {150, SERVO_POSN_MAX, SERVO_POSN_MIN};
+	tBenchResult r = bench_result("tilt 1 g -> range");
+	static tControl ctl;
+	tInputFrame in;
+
+	unsigned long long start = bench_nowNs();
+	for (int id = 0; id < FILTER_COUNT; ++id) {
+		memset(&ctl, 0, sizeof(ctl));
+		filter_init(&ctl.filter, (tFilterId)id);
+		memset(&in, 0, sizeof(in));
+		in.accel.updated = WIIMOTE_AXIS_X | WIIMOTE_AXIS_Y | WIIMOTE_AXIS_Z;
+		in.accel.z = ACCEL_FULL_TILT;
+
+		for (size_t k = 0; k < sizeof(tilts) / sizeof(tilts[0]); ++k) {
+			for (int i = 0; i < BENCH_TILT_FRAMES; ++i) {
+				unsigned long long t_us = (r.ops + 1) * (BENCH_FILTER_PERIOD_NS / 1000);
+				in.accel.time.tv_sec = t_us / 1000000;
+				in.accel.time.tv_usec = t_us % 1000000;
+				in.accel.x = tilts[k];
+				control_apply(&ctl, &in);
+				r.ops++;
+			}
+			if (ctl.position != expect[k]) {
+				printf("(filter %s: tilt %d ends at %ld, expected %d)\n", gFilterNames[id], tilts[k],
+						ctl.position, expect[k]);
+				r.misses++;
+			}
+		}
+	}
+	r.ns = bench_nowNs() - start;
+	return r;
+}
+
+/**
+ * Run all filters on the accelerometer frames of a recorded WiiMote session,
+ * with noise added on top of the recorded motion
+ * @param path			log file
+ * @return 0 on success, != 0 otherwise.
+ */
+static int bench_filterReplay(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	tWiiLogHeader header;
+	tWiiLogRecord rec;
+	short (*clean)[FILTER_AXES] = NULL;
+	short frame[FILTER_AXES] = {0};
+	size_t count = 0, cap = 0;
+	char name[40];
+
+	if (file == NULL || fread(&header, sizeof(header), 1, file) != 1
+	 || memcmp(header.magic, WIILOG_MAGIC, 4) != 0) {
+		printf("'%s' is not a WiiMote log\n", path);
+		if (file != NULL) {
+			fclose(file);
+		}
+		return -1;
+	}
+
+	// one sample per SYN_REPORT of event0, like wiimote_accelFrameGet()
+	while (fread(&rec, sizeof(rec), 1, file) == 1) {
+		if (rec.dev != WIILOG_DEV_EVT0) {
+			continue;
+		}
+		if (rec.type == EV_ABS && rec.code >= ABS_RX && rec.code <= ABS_RZ) {
+			frame[rec.code - ABS_RX] = rec.value;
+		} else if (rec.type == EV_SYN && rec.code == SYN_REPORT) {
+			if (count == cap) {
+				cap = cap ? 2 * cap : 1024;
+				clean = realloc(clean, cap * sizeof(*clean));
+			}
+			memcpy(clean[count++], frame, sizeof(frame));
+		}
+	}
+	fclose(file);
+
+	printf("\n%s: %zu accelerometer frames\n", path, count);
+	for (int id = 0; id < FILTER_COUNT && count != 0; ++id) {
+		snprintf(name, sizeof(name), "replay %s", gFilterNames[id]);
+		tBenchResult r = bench_filter(name, (tFilterId)id, clean, count);
+		bench_print(&r);
+	}
+	free(clean);
+	return 0;
+}
+
+
+/**
+ * Inverse kinematics over a grid of gripper targets around the arm. Targets out
+ * of reach count as misses, the error is how far forward kinematics of the
+ * solution lands from the target.
+ */
+static tBenchResult bench_ik(void)
+{
+	tBenchResult r = bench_result("ik solve");
+	static tIkTarget targets[BENCH_IK_STEPS * BENCH_IK_STEPS * BENCH_IK_STEPS];
+	static tIkJoints joints[BENCH_IK_STEPS * BENCH_IK_STEPS * BENCH_IK_STEPS];
+	static int failed[BENCH_IK_STEPS * BENCH_IK_STEPS * BENCH_IK_STEPS];
+	const int count = BENCH_IK_STEPS * BENCH_IK_STEPS * BENCH_IK_STEPS;
+	double sum = 0;
+
+	// x 50 .. 350, y -200 .. 200, z 0 .. 350, gripper level
+	for (int i = 0; i < count; ++i) {
+		targets[i].x = 50 + 300.0f * (i % BENCH_IK_STEPS) / BENCH_IK_STEPS;
+		targets[i].y = -200 + 400.0f * (i / BENCH_IK_STEPS % BENCH_IK_STEPS) / BENCH_IK_STEPS;
+		targets[i].z = 350.0f * (i / (BENCH_IK_STEPS * BENCH_IK_STEPS)) / BENCH_IK_STEPS;
+		targets[i].pitch = 0;
+	}
+
+	unsigned long long start = bench_nowNs();
+	for (int i = 0; i < count; ++i) {
+		failed[i] = ik_solve(&targets[i], &joints[i]);
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = count;
+	r.budget = BENCH_IK_BUDGET_NS;
+
+	int solved = 0;
+	for (int i = 0; i < count; ++i) {
+		tIkTarget t;
+		if (failed[i]) {
+			r.misses++;
+			continue;
+		}
+		ik_forward(&joints[i], &t);
+		sum += (t.x - targets[i].x) * (t.x - targets[i].x) + (t.y - targets[i].y) * (t.y - targets[i].y)
+		     + (t.z - targets[i].z) * (t.z - targets[i].z);
+		solved++;
+	}
+	r.error = solved ? sqrt(sum / solved) : 0;
+	return r;
+}
+
+/**
+ * Safety check of single joint commands against the collision grid, random
+ * joints and positions slightly beyond the joint limits. Commands refused as
+ * unsafe count as misses.
+ */
+static tBenchResult bench_safety(void)
+{
+	tBenchResult r = bench_result("safety check");
+	static tServoSafety safety;
+	unsigned char posn[SAFETY_JOINTS];
+	unsigned int seed = 1;
+
+	unsigned long long start = bench_nowNs();
+	safety_init(&safety);
+	printf("(safety grid: %d^3 cells, %zu bytes, built in %.1f ms)\n", SAFETY_CELLS, sizeof(safety.grid),
+			(bench_nowNs() - start) / 1e6);
+
+	memset(posn, IK_SERVO_MIDDLE, sizeof(posn));
+	start = bench_nowNs();
+	for (int i = 0; i < BENCH_SERVO_CALLS; ++i) {
+		seed = seed * 1103515245 + 12345;
+		int joint = (seed >> 16) % SAFETY_JOINTS;
+		posn[joint] = safety_check(&safety, posn, joint, 50 + (seed >> 8) % 200);
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = BENCH_SERVO_CALLS;
+	r.budget = BENCH_SAFETY_BUDGET_NS;
+	r.misses = safety.blocked;
+	return r;
+}
+
+/**
+ * servo_move() of wiimoteServoControl: pack position and speed, dispatch to the
+ * register and update the shadow, flushed after every 5 calls like a control tick
+ * @param name			benchmark name
+ * @param backend		register backend
+ */
+static tBenchResult bench_servoMove(const char *name, const char *backend)
+{
+	tBenchResult r = bench_result(name);
+
+	if (servo_backendSelect(&gServos.backend, backend) != 0 || gServos.backend.open(&gServos.backend) != 0) {
+		return r;
+	}
+	shadow_init(&gServos.shadow);
+	safety_init(&gServos.safety);
+	memset(gServos.posn, IK_SERVO_MIDDLE, sizeof(gServos.posn));
+	gServos.deferWrites = 1;
+
+	unsigned long long start = bench_nowNs();
+	for (int i = 0; i < BENCH_SERVO_CALLS; ++i) {
+		// position changes every 8 calls, most writes reach the backend
+		servo_move(i % JOINT_COUNT, 60 + (i >> 3) % 180, 10);
+		if (i % 5 == 4) {
+			servo_flush();
+		}
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = BENCH_SERVO_CALLS;
+
+	gServos.backend.close(&gServos.backend);
+	return r;
+}
+
+/**
+ * servo_writeAll() of wiimoteServoControl: every call moves all joints (within
+ * +-8 degree of home, always safe) and stores the registers in one burst. One op
+ * is one register, comparable to the servo_move() benchmark.
+ * @param name			benchmark name
+ * @param backend		register backend
+ */
+static tBenchResult bench_writeAll(const char *name, const char *backend)
+{
+	tBenchResult r = bench_result(name);
+	const unsigned char speed[JOINT_COUNT] = {10, 10, 10, 10, 10};
+	unsigned char pose[JOINT_COUNT];
+
+	if (servo_backendSelect(&gServos.backend, backend) != 0 || gServos.backend.open(&gServos.backend) != 0) {
+		return r;
+	}
+	shadow_init(&gServos.shadow);
+	safety_init(&gServos.safety);
+	joint_homePose(gServos.posn);
+
+	unsigned long long start = bench_nowNs();
+	for (int i = 0; i < BENCH_SERVO_CALLS / JOINT_COUNT; ++i) {
+		for (int j = 0; j < JOINT_COUNT; ++j) {
+			pose[j] = gJoints[j].home - 8 + (i + j) % 16;
+		}
+		servo_writeAll(pose, speed);
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = BENCH_SERVO_CALLS / JOINT_COUNT * JOINT_COUNT;
+	r.misses = gServos.safety.blocked;
+	printf("(%llu register writes in %llu bursts)\n", gServos.shadow.issued, gServos.shadow.bursts);
+
+	gServos.backend.close(&gServos.backend);
+	return r;
+}
+
+/**
+ * Register writes to the simulated register block
+ * @param name			benchmark name
+ * @param logged		0: raw REG_WRITE, 1: through the backend, timestamped into the log
+ */
+static tBenchResult bench_regWrite(const char *name, int logged)
+{
+	tBenchResult r = bench_result(name);
+	tServoBackend be;
+
+	if (servo_backendSelect(&be, "sim") != 0 || be.open(&be) != 0) {
+		return r;
+	}
+
+	unsigned long long start = bench_nowNs();
+	for (int i = 0; i < BENCH_SERVO_CALLS; ++i) {
+		if (logged) {
+			be.write(&be, Base_OFFSET + 4 * (i % 5), i);
+		} else {
+			REG_WRITE(be.test_base, Base_OFFSET + 4 * (i % 5), i);
+		}
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = BENCH_SERVO_CALLS;
+
+	be.close(&be);
+	return r;
+}
+
+/**
+ * Telemetry sampler: one sample reads all joint registers of the simulated block
+ * into the ring, then a monitor reads every sample back. The ring is a private
+ * buffer here, a running program's shared ring is left alone. Samples a reader
+ * rejects count as misses.
+ */
+static tBenchResult bench_telemetry(void)
+{
+	tBenchResult r = bench_result("telemetry sample sim");
+	static tTelemShm shm;
+	tTelemetry tm;
+	tTelemSample s;
+
+	memset(&tm, 0, sizeof(tm));
+	if (servo_backendSelect(&gServos.backend, "sim") != 0 || gServos.backend.open(&gServos.backend) != 0) {
+		return r;
+	}
+	tm.shm = &shm;
+	tm.backend = &gServos.backend;
+
+	unsigned long long start = bench_nowNs();
+	for (int i = 0; i < BENCH_SERVO_CALLS; ++i) {
+		telem_sample(&tm);
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = BENCH_SERVO_CALLS;
+	r.budget = BENCH_TELEM_BUDGET_NS;
+
+	unsigned long long head = telem_head(&tm);
+	start = bench_nowNs();
+	for (unsigned long long n = head - TELEM_RING_LEN; n < head; ++n) {
+		r.misses += telem_read(&tm, n, &s) != 0;
+	}
+	printf("(monitor reads %.1f ns/sample)\n", (double)(bench_nowNs() - start) / TELEM_RING_LEN);
+
+	gServos.backend.close(&gServos.backend);
+	return r;
+}
+
+/**
+ * Motion executor ticks with all joints moving. Every BENCH_MOTION_RETARGET
+ * ticks a new pose is commanded, most of them while the last one is still in
+ * flight, so the cost includes taking commands and blending into them.
+ */
+static tBenchResult bench_motion(void)
+{
+	tBenchResult r = bench_result("motion executor tick");
+	static tMotionExec mx;
+	tMotionCmd cmd;
+	int pose[JOINT_COUNT];
+	unsigned long long latency;
+	unsigned int seed = 1;
+
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		pose[j] = gJoints[j].home;
+	}
+	motion_init(&mx, pose);
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.mask = (1 << JOINT_COUNT) - 1;
+	cmd.speed = 90;
+	cmd.profile = PROFILE_SCURVE_ID;
+
+	unsigned long long start = bench_nowNs();
+	for (int i = 0; i < BENCH_SERVO_CALLS / JOINT_COUNT; ++i) {
+		if (i % BENCH_MOTION_RETARGET == 0) {
+			for (int j = 0; j < JOINT_COUNT; ++j) {
+				seed = seed * 1103515245 + 12345;
+				cmd.to[j] = gJoints[j].min + (seed >> 16) % (gJoints[j].max - gJoints[j].min + 1);
+			}
+			motion_command(&mx, &cmd);
+		}
+		r.misses += motion_tick(&mx, pose, &latency) == 0;
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = BENCH_SERVO_CALLS / JOINT_COUNT;
+	r.budget = BENCH_MOTION_BUDGET_NS;
+	printf("(%llu joint moves, %llu replaced in flight)\n", mx.moves, mx.retargets);
+	return r;
+}
+
+/**
+ * uniform random number
+ * @param state			generator state
+ * @return lo .. hi
+ */
+static float bench_uniform(unsigned int *state, float lo, float hi)
+{
+	*state = *state * 1103515245u + 12345u;
+	return lo + (hi - lo) * (float)(*state >> 8) / (float)(1u << 24);
+}
+
+/**
+ * One sample of a gesture performed by hand rather than by gesture_shape():
+ * time warped, paused in between, its amplitude swelling and leaking into the
+ * other axes
+ * @param k				sample since the start of the gesture
+ * @param len			samples of the gesture without the pause
+ * @param pause			sample the pause starts at and its length
+ * @param warp			time warp, u = v + warp sin(2 pi v) / (2 pi), |warp| < 1 keeps time going forward
+ * @param swell			amplitude change over the gesture
+ * @param leak			part of each axis leaking into the others
+ * @param out			acceleration X, Y, Z, in g
+ */
+static void bench_gestureSample(tGestureId id, int k, int len, const int pause[2], float warp, float swell,
+		const float leak[3][3], float out[3])
+{
+	float rest[3], d[3];
+
+	k = k < pause[0] ? k : k < pause[0] + pause[1] ? pause[0] : k - pause[1];
+	float v = (k + 0.5f) / len;
+	float u = v + warp * sinf(2 * (float)M_PI * v) / (2 * (float)M_PI);
+
+	// only the motion is distorted, not the gravity a twist starts and ends with
+	gesture_shape(id, 0, rest);
+	gesture_shape(id, u, out);
+	for (int a = 0; a < 3; ++a) {
+		d[a] = (out[a] - rest[a]) * (1 + swell * sinf(2 * (float)M_PI * u));
+	}
+	for (int a = 0; a < 3; ++a) {
+		out[a] = rest[a] + d[a] + leak[a][0] * d[0] + leak[a][1] * d[1] + leak[a][2] * d[2];
+	}
+}
+
+/**
+ * One sample of motion that is no gesture, acceleration in g added to gravity
+ * @param kind			0: slow tilt there and back, 1: single bump, 2: circling the remote
+ * @param k				sample since the start of the motion
+ * @param len			samples of the motion
+ * @param axis			axis it happens on
+ * @param size			tilt angle in rad, bump height or circle radius in g
+ * @param out			acceleration X, Y, Z, in g
+ */
+static void bench_motionSample(int kind, int k, int len, int axis, float size, float out[3])
+{
+	const float pi = (float)M_PI;
+	float u = (k + 0.5f) / len;
+
+	out[0] = out[1] = 0;
+	out[2] = 1;
+	switch (kind) {
+	case 0: {
+		// turned in the first third, held, turned back in the last third
+		float ramp = u < 1.0f / 3 ? 3 * u : u > 2.0f / 3 ? 3 * (1 - u) : 1;
+		float angle = size * (3 * ramp * ramp - 2 * ramp * ramp * ramp);
+		out[axis] = sinf(angle);
+		out[2] = cosf(angle);
+		break;
+	}
+	case 1:
+		out[axis] += size * sinf(pi * u);
+		break;
+	default:
+		// two turns, easing in and out
+		out[axis] += size * sinf(pi * u) * sinf(4 * pi * u);
+		out[1 - axis] += size * sinf(pi * u) * cosf(4 * pi * u);
+		break;
+	}
+}
+
+/**
+ * Run the gesture recognizer over a synthetic session: the remote held level
+ * with noise and a slow tilt, every BENCH_GESTURE_SPACING samples a random
+ * gesture of random length (0.28 to 0.72 s) and strength, performed unevenly
+ * (bench_gestureSample()), or every BENCH_GESTURE_OTHER-th time motion that is
+ * no gesture. Gestures not recognized, recognitions of a wrong gesture, outside
+ * BENCH_GESTURE_EARLY .. BENCH_GESTURE_LATE around its end or of no gesture
+ * count as misses.
+ */
+static tBenchResult bench_gesture(void)
+{
+	enum { COUNT = BENCH_GESTURE_SAMPLES / BENCH_GESTURE_SPACING };
+	tBenchResult r = bench_result("gesture recognizer");
+	static short samples[BENCH_GESTURE_SAMPLES][FILTER_AXES];
+	static int truthId[COUNT], truthEnd[COUNT], found[COUNT];
+	static int hitAt[BENCH_GESTURE_SAMPLES / 8], hitId[BENCH_GESTURE_SAMPLES / 8];
+	static tGestureSet set;
+	static tGestureWindow w;
+	unsigned int seed = 1, noise = 7;
+	int hits = 0, gestures = 0, others = 0;
+
+	// the remote held level (Z is gravity), tilting slowly, with the gestures on top
+	for (int n = 0; n < COUNT; ++n) {
+		int begin = n * BENCH_GESTURE_SPACING + BENCH_GESTURE_SPACING / 4;
+		int other = n % BENCH_GESTURE_OTHER == BENCH_GESTURE_OTHER - 1;
+		int id = GESTURE_NONE + 1 + (int)bench_uniform(&seed, 0, GESTURE_COUNT - 1);
+		int len = (int)bench_uniform(&seed, 28, 73);
+		int pause[2] = {(int)bench_uniform(&seed, len / 4, 3 * len / 4), (int)bench_uniform(&seed, 0, len / 6)};
+		float warp = bench_uniform(&seed, -0.3f, 0.3f);
+		float swell = bench_uniform(&seed, -0.3f, 0.3f);
+		float amplitude = id == GESTURE_TWIST ? 100 : bench_uniform(&seed, 80, 200);
+		float leak[3][3];
+		for (int a = 0; a < 3; ++a) {
+			for (int b = 0; b < 3; ++b) {
+				leak[a][b] = a == b ? 0 : bench_uniform(&seed, -0.25f, 0.25f);
+			}
+		}
+		int kind = (int)bench_uniform(&seed, 0, 3);
+		int axis = (int)bench_uniform(&seed, 0, 2);
+		float size = kind == 0 ? bench_uniform(&seed, 0.3f, 1.2f) : bench_uniform(&seed, 0.5f, 2.0f);
+		int total = other ? (kind == 1 ? len / 3 : 3 * len / 2) : len + pause[1];
+
+		truthId[n] = other ? GESTURE_NONE : id;
+		truthEnd[n] = begin + total;
+		gestures += !other;
+		others += other;
+		for (int i = n * BENCH_GESTURE_SPACING; i < (n + 1) * BENCH_GESTURE_SPACING; ++i) {
+			float g[3] = {0, 0, 1};
+			float tilt = 30 * sinf(2 * (float)M_PI * 0.2f * i / BENCH_ACCEL_RATE);
+			float scale = 100;
+			if (i >= begin && i < begin + total) {
+				if (other) {
+					bench_motionSample(kind, i - begin, total, axis, size, g);
+				} else {
+					bench_gestureSample((tGestureId)id, i - begin, len, pause, warp, swell, leak, g);
+				}
+			}
+			// a twist turns gravity, the others add to it
+			if (!other && id != GESTURE_TWIST) {
+				scale = amplitude;
+				g[2] += 100 / amplitude - (i >= begin && i < begin + total ? 0 : 1);
+			}
+			samples[i][0] = (short)lrintf(tilt + scale * g[0]) + bench_noise(&noise);
+			samples[i][1] = (short)lrintf(scale * g[1]) + bench_noise(&noise);
+			samples[i][2] = (short)lrintf(scale * g[2]) + bench_noise(&noise);
+		}
+	}
+
+	gesture_build(&set);
+	gesture_init(&w, &set);
+	unsigned long long start = bench_nowNs();
+	for (int i = 0; i < BENCH_GESTURE_SAMPLES; ++i) {
+		tGestureId id = gesture_push(&w, samples[i][0], samples[i][1], samples[i][2]);
+		if (id != GESTURE_NONE && hits < BENCH_GESTURE_SAMPLES / 8) {
+			hitAt[hits] = i;
+			hitId[hits++] = id;
+		}
+	}
+	r.ns = bench_nowNs() - start;
+	r.ops = BENCH_GESTURE_SAMPLES;
+	r.budget = BENCH_GESTURE_BUDGET_NS;
+
+	// a recognition belongs to the motion in whose slot it falls
+	int recognized = 0, early = 0, wrong = 0, mistaken = 0, moving = 0;
+	long long delay = 0, earliest = 0, latest = 0;
+	memset(found, 0, sizeof(found));
+	for (int h = 0; h < hits; ++h) {
+		int n = hitAt[h] / BENCH_GESTURE_SPACING;
+		int d = hitAt[h] - truthEnd[n];
+		if (truthId[n] == GESTURE_NONE) {
+			// a flick moves the arm, the other gestures only change modes
+			moving += hitId[h] == GESTURE_FLICK;
+			mistaken++;
+			continue;
+		}
+		if (!found[n] && hitId[h] == truthId[n] && d < -BENCH_GESTURE_EARLY) {
+			early++;
+			continue;
+		}
+		if (found[n] || hitId[h] != truthId[n] || d > BENCH_GESTURE_LATE) {
+			wrong++;
+			continue;
+		}
+		found[n] = 1;
+		recognized++;
+		delay += d;
+		earliest = recognized == 1 || d < earliest ? d : earliest;
+		latest = recognized == 1 || d > latest ? d : latest;
+	}
+	r.misses = gestures - recognized + wrong + mistaken;
+	printf("(%d gestures, %d recognized, %d too early, %d false; %d other motions, %d taken for gestures; "
+			"recognized %lld to %lld ms after the gesture ended, mean %.0f ms)\n",
+			gestures, recognized, early, wrong, others, mistaken, earliest * 1000 / BENCH_ACCEL_RATE,
+			latest * 1000 / BENCH_ACCEL_RATE, recognized ? 1000.0 * delay / recognized / BENCH_ACCEL_RATE : 0.0);
+	printf("(%d of the other motions taken for a flick, which moves the arm while \"-\" is held)\n", moving);
+	return r;
+}
+
+/**
+ * Tick simulated arms on the scheduler, free running, while new poses keep coming
+ * @param count			number of arms
+ * @param safety		collision grid all arms copy
+ */
+static tBenchResult bench_arms(int count, const tServoSafety *safety)
+{
+	static tServoArm arms[ARM_MAX];
+	static tArmScheduler sched;
+	tBenchResult r;
+	tMotionCmd cmd;
+	tRtConfig rt = {0, -1};
+	char name[40];
+	unsigned int seed = 1;
+
+	snprintf(name, sizeof(name), "arm ticks, %d arms", count);
+	r = bench_result(name);
+	for (int i = 0; i < count; ++i) {
+		if (arm_open(&arms[i], i, safety) != 0) {
+			while (--i >= 0) {
+				arm_close(&arms[i]);
+			}
+			return r;
+		}
+	}
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.mask = (1 << JOINT_COUNT) - 1;
+	cmd.speed = 90;
+	cmd.profile = PROFILE_SCURVE_ID;
+
+	struct timespec pause = {0, BENCH_ARMS_COMMAND_NS};
+	unsigned long long start = bench_nowNs();
+	if (arm_schedStart(&sched, arms, count, 0, &rt) != 0) {
+		for (int i = 0; i < count; ++i) {
+			arm_close(&arms[i]);
+		}
+		return r;
+	}
+	while (bench_nowNs() - start < BENCH_ARMS_NS) {
+		for (int i = 0; i < count; ++i) {
+			for (int j = 0; j < JOINT_COUNT; ++j) {
+				seed = seed * 1103515245 + 12345;
+				cmd.to[j] = gJoints[j].min + (seed >> 16) % (gJoints[j].max - gJoints[j].min + 1);
+			}
+			arm_command(&arms[i], &cmd);
+		}
+		nanosleep(&pause, NULL);
+	}
+	arm_schedStop(&sched);
+	r.ns = bench_nowNs() - start;
+
+	// ticks the workers missed, free running there are none; refused poses are counted apart
+	unsigned long long refused = 0, blocked = 0;
+	for (int i = 0; i < sched.workers; ++i) {
+		r.misses += sched.worker[i].overruns;
+	}
+	for (int i = 0; i < count; ++i) {
+		r.ops += arms[i].ticks;
+		refused += arms[i].refused;
+		blocked += arms[i].safety.blocked;
+		arm_close(&arms[i]);
+	}
+	printf("(%d workers, %.0f arm ticks/s, %.0f per arm, one arm needs %ld; "
+			"%llu commands refused, %llu moves stopped on the way)\n", sched.workers, 1e9 * r.ops / r.ns,
+			1e9 * r.ops / r.ns / count, SERVO_TICKS_PER_SEC, refused, blocked);
+	return r;
+}
+
+/**
+ * Scale the arm scheduler from 1 to ARM_MAX arms on simulated register blocks
+ */
+static void bench_armScaling(void)
+{
+	static tServoSafety safety;
+
+	// every arm gets its own anonymous register block
+	setenv("SERVO_BACKEND", "sim", 1);
+	unsetenv("SERVO_SIM_PATH");
+	unsetenv("SERVO_ARM_BASES");
+	safety_init(&safety);
+	for (int count = 1; count <= ARM_MAX; count *= 2) {
+		tBenchResult r = bench_arms(count, &safety);
+		bench_print(&r);
+	}
+}
+
+/**
+ * Parse input events from a pipe standing in for an event file. The pipe is
+ * filled before each timed run, so only reading and parsing is measured.
+ * @param name			benchmark name
+ * @param packets		packets written per fill
+ * @param size			size of all packets in bytes
+ * @param parse			0: wiimote_accelFrameGet(), 1: wiimote_buttonGet(), 2: wiimote_accelGet()
+ */
+static tBenchResult bench_parse(const char *name, const void *packets, size_t size, int parse)
+{
+	tBenchResult r = bench_result(name);
+	tWiiMoteAccelFrame frame;
+	int fds[2];
+
+	if (pipe(fds) != 0) {
+		perror("Could not create pipe");
+		return r;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	gWiiMote.remote[0].fileEvt0 = fds[0];
+	gWiiMote.remote[0].fileEvt2 = fds[0];
+
+	for (int fill = 0; fill < BENCH_FILLS; ++fill) {
+		if (write(fds[1], packets, size) != (ssize_t)size) {
+			perror("Could not fill pipe");
+			break;
+		}
+
+		unsigned long long start = bench_nowNs();
+		switch (parse) {
+		case 0:
+			while (wiimote_accelFrameGet(&gWiiMote.remote[0], &frame) != 0) {
+				gSink = frame.x;
+			}
+			break;
+		case 1:
+			for (int i = 0; i < BENCH_EVENTS_PER_FILL; ++i) {
+				gSink = wiimote_buttonGet(&gWiiMote.remote[0]).code;
+			}
+			break;
+		default:
+			for (int i = 0; i < BENCH_EVENTS_PER_FILL; ++i) {
+				gSink = wiimote_accelGet(&gWiiMote.remote[0]).value;
+			}
+			break;
+		}
+		r.ns += bench_nowNs() - start;
+		r.ops += BENCH_EVENTS_PER_FILL;
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	return r;
+}
+
+/**
+ * Run the three WiiMote parsers on typical packets
+ */
+static void bench_parseAll(void)
+{
+	static struct input_event evts[BENCH_EVENTS_PER_FILL];
+	static unsigned char legacy[BENCH_EVENTS_PER_FILL][WIIMOTE_EVT0_PKT_SIZE];
+	tBenchResult r;
+
+	// accelerometer: X, Y, Z, SYN_REPORT per frame
+	memset(evts, 0, sizeof(evts));
+	for (int i = 0; i < BENCH_EVENTS_PER_FILL; ++i) {
+		evts[i].type = (i % 4 == 3) ? EV_SYN : EV_ABS;
+		evts[i].code = (i % 4 == 3) ? SYN_REPORT : WIIMOTE_EVT0_ACCEL_X + i % 4;
+		evts[i].value = i % 200 - 100;
+	}
+	r = bench_parse("parse accel frames", evts, sizeof(evts), 0);
+	bench_print(&r);
+
+	// buttons: key press or release followed by SYN_REPORT
+	memset(evts, 0, sizeof(evts));
+	for (int i = 0; i < BENCH_EVENTS_PER_FILL; ++i) {
+		evts[i].type = (i % 2 == 1) ? EV_SYN : EV_KEY;
+		evts[i].code = (i % 2 == 1) ? SYN_REPORT : 0x130;
+		evts[i].value = (i / 2) % 2;
+	}
+	r = bench_parse("parse buttons", evts, sizeof(evts), 1);
+	bench_print(&r);
+
+	// legacy 16 byte packets of the 32 bit board
+	memset(legacy, 0, sizeof(legacy));
+	for (int i = 0; i < BENCH_EVENTS_PER_FILL; ++i) {
+		legacy[i][WIIMOTE_EVT0_CODE] = WIIMOTE_EVT0_ACCEL_X;
+		legacy[i][WIIMOTE_EVT0_VALUE_L] = i & 0xFF;
+	}
+	r = bench_parse("parse accel legacy", legacy, sizeof(legacy), 2);
+	bench_print(&r);
+}
+
+/**
+ * write a synthetic session: "A" held, then the X axis tilted back and forth by 1 g
+ * @param path			log file to create
+ * @return 0 on success, != 0 otherwise.
+ */
+static int bench_writeSession(const char *path)
+{
+	tWiiLog log;
+	struct input_event evt;
+
+	if (wiilog_open(&log, path) != 0) {
+		return -1;
+	}
+	memset(&evt, 0, sizeof(evt));
+	evt.time.tv_sec = 1;
+	evt.type = EV_KEY;
+	evt.code = 0x130;
+	evt.value = 1;
+	wiilog_record(&log, WIILOG_DEV_EVT2, &evt);
+	evt.type = EV_SYN;
+	evt.code = SYN_REPORT;
+	evt.value = 0;
+	wiilog_record(&log, WIILOG_DEV_EVT2, &evt);
+
+	for (int i = 0; i < BENCH_LOOP_FRAMES; ++i) {
+		unsigned long long t_us = 1000000ULL + (i + 1) * (BENCH_FILTER_PERIOD_NS / 1000);
+		evt.time.tv_sec = t_us / 1000000;
+		evt.time.tv_usec = t_us % 1000000;
+		for (int a = 0; a < FILTER_AXES; ++a) {
+			evt.type = EV_ABS;
+			evt.code = WIIMOTE_EVT0_ACCEL_X + a;
+			evt.value = (int)lrint(ACCEL_FULL_TILT * sin(2 * M_PI * 0.3 * i * BENCH_FILTER_PERIOD_NS / 1e9)) * (a == 0);
+			wiilog_record(&log, WIILOG_DEV_EVT0, &evt);
+		}
+		evt.type = EV_SYN;
+		evt.code = SYN_REPORT;
+		evt.value = 0;
+		wiilog_record(&log, WIILOG_DEV_EVT0, &evt);
+	}
+	wiilog_close(&log);
+	return 0;
+}
+
+/**
+ * The whole control path on the recorded time line: replay -> input thread ->
+ * ring -> filter -> servo_move() -> simulated registers, as fast as it goes
+ * @param path			log file, NULL for a synthetic session
+ */
+static tBenchResult bench_loop(const char *path)
+{
+	tBenchResult r = bench_result("loop input -> actuation");
+	static tControl ctl;
+	char tmp[] = "/tmp/servoBench-XXXXXX";
+
+	if (path == NULL) {
+		int fd = mkstemp(tmp);
+		if (fd == -1 || bench_writeSession(tmp) != 0) {
+			perror("Could not write synthetic session");
+			return r;
+		}
+		close(fd);
+		path = tmp;
+	}
+
+	setenv("SERVO_BACKEND", "sim", 1);
+	unsetenv("SERVO_SIM_PATH");
+	unsetenv("WIIMOTE_RECORD");
+	setenv("WIIMOTE_REPLAY", path, 1);
+	setenv("WIIMOTE_REPLAY_FAST", "1", 1);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.prevPosn = 150;
+	ctl.speed = 10;
+	ctl.virtualTime = 1;
+	joint_homePose(ctl.storedPose);
+	filter_init(&ctl.filter, FILTER_ONE_EURO_ID);
+
+	int failed = wiimote_init() != 0;
+	if (path == tmp) {
+		unlink(tmp); // stays mapped
+	}
+	if (failed || servo_init() != 0) {
+		return r;
+	}
+	gServos.deferWrites = 1;
+	spsc_init(&ctl.ring, sizeof(tInputFrame));
+	if (reactor_init(&ctl.reactor) != 0 || input_addSources(&ctl) != 0) {
+		return r;
+	}
+
+	unsigned long long start = bench_nowNs();
+	if (pthread_create(&ctl.input, NULL, input_thread, &ctl) != 0 || wiimote_start() != 0) {
+		return r;
+	}
+	control_runVirtual(&ctl);
+	pthread_join(ctl.input, NULL);
+	r.ns = bench_nowNs() - start;
+
+	// per recorded event, frames lost on the way are misses
+	r.ops = gWiiMote.replay.count;
+	r.misses = ctl.ring.drops;
+	printf("(%llu control ticks, %llu register writes)\n", ctl.ticks, gServos.shadow.issued);
+
+	reactor_close(&ctl.reactor);
+	wiimote_close();
+	servo_release();
+	return r;
+}
+
+/**
+ * Write all results as JSON
+ * @param path			file name, "-" for stdout
+ * @return 0 on success, != 0 otherwise.
+ */
+static int bench_json(const char *path)
+{
+	FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	struct utsname host;
+
+	if (out == NULL) {
+		printf("Could not open '%s'\n", path);
+		return -1;
+	}
+	uname(&host);
+
+	fprintf(out, "{\n  \"machine\": \"%s\",\n  \"time\": %lld,\n  \"results\": [\n",
+			host.machine, (long long)time(NULL));
+	for (int i = 0; i < gResultCount; ++i) {
+		const tBenchResult *r = &gResults[i];
+		fprintf(out, "    {\"name\": \"%s\", \"ops\": %llu, \"ns\": %llu, \"ns_per_op\": %.3f, \"misses\": %llu",
+				r->name, r->ops, r->ns, r->ops ? (double)r->ns / r->ops : 0.0, r->misses);
+		if (r->error >= 0) {
+			fprintf(out, ", \"rms_error\": %.3f", r->error);
+		}
+		if (r->budget > 0) {
+			fprintf(out, ", \"budget_ns\": %.0f", r->budget);
+		}
+		fprintf(out, "}%s\n", i + 1 < gResultCount ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return 0;
+}
+
+
+/************** MAIN ***********************/
+
+int main(int argc, char *argv[])
+{
+	tBenchResult r;
+	const char *json = NULL;
+	const char *session = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			json = argv[++i];
+		} else {
+			session = argv[i];
+		}
+	}
+
+	printf("\n-------------  servo benchmarks  --------------------\n\n");
+
+	r = bench_interpFloat();
+	bench_print(&r);
+	r = bench_interpFixed();
+	bench_print(&r);
+
+	r = bench_servoMove("servo_move null", "null");
+	bench_print(&r);
+	r = bench_servoMove("servo_move sim", "sim");
+	bench_print(&r);
+	r = bench_writeAll("servo_writeAll sim", "sim");
+	bench_print(&r);
+	r = bench_regWrite("REG_WRITE sim block", 0);
+	bench_print(&r);
+	r = bench_regWrite("backend sim write", 1);
+	bench_print(&r);
+	r = bench_telemetry();
+	bench_print(&r);
+	r = bench_motion();
+	bench_print(&r);
+
+	bench_parseAll();
+	bench_filterSynthetic();
+	r = bench_tilt();
+	bench_print(&r);
+
+	r = bench_ik();
+	bench_print(&r);
+	printf("(%llu targets out of reach, %.0f solves/s, the accelerometer delivers %d/s)\n",
+			r.misses, 1e9 * r.ops / r.ns, BENCH_ACCEL_RATE);
+	r = bench_safety();
+	bench_print(&r);
+	r = bench_gesture();
+	bench_print(&r);
+
+	if (session != NULL && bench_filterReplay(session) != 0) {
+		return -1;
+	}
+
+	r = bench_loop(session);
+	bench_print(&r);
+
+	bench_armScaling();
+
+	if (json != NULL && bench_json(json) != 0) {
+		return -1;
+	}
+	return 0;
+}
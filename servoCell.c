@@ -0,0 +1,143 @@
+/**
+ * Drive all arms of a cell from one process
+ *
+ * Usage: servoCell
+ *
+ * Opens SERVO_ARMS arms (servoArm.h), each with its own register block, and
+ * ticks them on one scheduler thread per core. Commands are read from stdin,
+ * one per line, arms and joints counted from 1:
+ *
+ *   arm joint position speed                    move one joint (speed in degree/sec)
+ *   arm 6 base bicep elbow wrist gripper speed  move all joints of the arm together
+ *   0                                           wait for all moves, then exit
+ *
+ * A command replaces the move in flight of the joints it names on the next
+ * tick, see motionExec.h.
+ *
+ * Environment:
+ *   SERVO_ARMS        number of arms, 1 .. 64 (default 1)
+ *   SERVO_BACKEND     devmem (default), sim or null, see servoBackend.h
+ *   SERVO_ARM_BASES   register block per arm, see servoBackend.h
+ *   SERVO_RT_PRIO     real-time mode of the workers, see rtMode.h
+ *   SERVO_RT_CPU      CPU of the first worker
+ *
+ * Build with -lm -pthread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "servoArm.h"
+
+
+/************ CELL CONSTANTS ************/
+
+/** profile of commanded moves */
+#define CELL_PROFILE PROFILE_SCURVE_ID
+
+
+/************ CELL VARIABLES ************/
+
+/** all arms of the cell */
+tServoArm gArms[ARM_MAX];
+
+/** scheduler ticking them */
+tArmScheduler gSched;
+
+
+/************ CELL FUNCTIONS ************/
+
+/**
+ * Parse and pass on one command line
+ * @param line			command
+ * @param count			number of arms
+ * @return 1 to exit, 0 otherwise
+ */
+int cell_command(const char *line, int count)
+{
+	tMotionCmd cmd;
+	int arm, joint, p[JOINT_COUNT], speed;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.profile = CELL_PROFILE;
+	int n = sscanf(line, "%d %d %d %d %d %d %d %d", &arm, &joint, &p[0], &p[1], &p[2], &p[3], &p[4], &speed);
+	if (n == 1 && arm == 0) {
+		return 1;
+	}
+	if (n < 4 || arm < 1 || arm > count) {
+		printf("Expected: arm(1-%d) joint(1-5) position speed, arm 6 <5 positions> speed, or 0\n", count);
+		return 0;
+	}
+
+	if (joint >= 1 && joint <= JOINT_COUNT) {
+		cmd.mask = 1 << (joint - 1);
+		cmd.to[joint - 1] = p[0];
+		cmd.speed = p[1];
+	} else if (joint == JOINT_COUNT + 1 && n == 8) {
+		cmd.mask = (1 << JOINT_COUNT) - 1;
+		memcpy(cmd.to, p, sizeof(cmd.to));
+		cmd.speed = speed;
+	} else {
+		printf("Joint must be 1 .. %d, or %d with all positions\n", JOINT_COUNT, JOINT_COUNT + 1);
+		return 0;
+	}
+	if (arm_command(&gArms[arm - 1], &cmd) != 0) {
+		printf("Arm %d: target pose would collide, not moving\n", arm);
+	}
+	return 0;
+}
+
+
+int main()
+{
+	struct timespec pause = {0, SERVO_PERIOD_NS};
+	const char *arms = getenv("SERVO_ARMS");
+	int count = arms != NULL ? atoi(arms) : 1;
+	char line[256];
+	tRtConfig rt;
+
+	if (count < 1 || count > ARM_MAX) {
+		printf("SERVO_ARMS must be 1 .. %d\n", ARM_MAX);
+		return -1;
+	}
+	if (rt_configure(&rt) != 0) {
+		return -1;
+	}
+
+	// the collision grid is built once and copied to the other arms
+	for (int i = 0; i < count; ++i) {
+		if (arm_open(&gArms[i], i, i > 0 ? &gArms[0].safety : NULL) != 0) {
+			while (--i >= 0) {
+				arm_close(&gArms[i]);
+			}
+			return -1;
+		}
+	}
+	if (arm_schedStart(&gSched, gArms, count, SERVO_PERIOD_NS, &rt) != 0) {
+		for (int i = 0; i < count; ++i) {
+			arm_close(&gArms[i]);
+		}
+		return -1;
+	}
+	printf("%d arms on %d workers, enter commands (0 exits)\n", count, gSched.workers);
+
+	while (fgets(line, sizeof(line), stdin) != NULL && !cell_command(line, count))
+		;
+
+	// let the moves in flight end
+	for (int i = 0; i < count; ++i) {
+		while (!motion_idle(&gArms[i].motion)) {
+			nanosleep(&pause, NULL);
+		}
+	}
+	arm_schedStop(&gSched);
+	arm_schedPrint(&gSched, stdout);
+	for (int i = 0; i < count; ++i) {
+		printf("arm %d: joint moves %llu, replaced in flight %llu, register writes %llu, refused %llu, "
+				"stopped on the way %llu\n", i + 1, gArms[i].motion.moves, gArms[i].motion.retargets,
+				gArms[i].shadow.issued, gArms[i].refused, gArms[i].motion.held);
+		arm_close(&gArms[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,301 @@
+/**
+ * Command line client of servoDaemon
+ *
+ * Usage: servoClient base bicep elbow wrist gripper [speed]
+ *                                   move all joints to a pose (degree, speed in degree / 20ms)
+ *        servoClient -j joint position [speed]
+ *                                   move one joint, 1 (Base) .. 5 (Gripper)
+ *        servoClient -p choreography
+ *                                   play a keyframe file (see keyframe.h), replacing
+ *                                   whatever this client had queued, runs until the
+ *                                   last keyframe is sent
+ *        servoClient -s count [batch]
+ *                                   stream count setpoints around the home pose in
+ *                                   batches, report the rate they were acked at
+ *
+ * Messages are sent without waiting for their acks, up to CLIENT_WINDOW of them
+ * may be unacked at any time. Choreographies are the exception: the daemon
+ * queues only so many keyframes, so they are sent at most CLIENT_HORIZON_NS
+ * before they are due, topped up whenever less than half of that is left, one
+ * message at a time. What a full queue refused is sent again after
+ * CLIENT_BACKOFF_NS.
+ *
+ * Environment:
+ *   SERVO_SOCKET    socket of the daemon, /tmp/servoDaemon.sock if unset
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "servoBackend.h"
+#include "servoProtocol.h"
+#include "servoJoints.h"
+
+
+/************ CLIENT CONSTANTS ************/
+
+/** messages in flight before waiting for an ack */
+#define CLIENT_WINDOW 64
+
+/** speed if none is given, degree / 20ms */
+#define CLIENT_DEFAULT_SPEED 10
+
+/** keyframes per message when streaming, if not given */
+#define CLIENT_DEFAULT_BATCH 100
+
+/** choreography keyframes are sent this long before they are due */
+#define CLIENT_HORIZON_NS 2000000000ULL
+
+/** wait before resending what a full queue refused */
+#define CLIENT_BACKOFF_NS 100000000ULL
+
+
+/************ CLIENT TYPES ************/
+
+/**
+ * connection with its outstanding messages
+ */
+typedef struct {
+	int fd;                      /// socket to the daemon
+	unsigned int seq;            /// sequence number of the next message
+	unsigned int unacked;        /// messages sent, ack not read yet
+	unsigned long long frames;   /// keyframes accepted by the daemon
+	unsigned long long errors;   /// messages not fully accepted
+	unsigned long long retries;  /// choreography messages resent, queue full
+} tClient;
+
+
+/************ CLIENT FUNCTIONS ************/
+
+/**
+ * Read acks
+ * @param block			1: wait for at least one ack
+ * @return 0 on success, != 0 if the connection failed
+ */
+int client_readAcks(tClient *cl, int block)
+{
+	tProtoAck ack;
+
+	while (cl->unacked > 0) {
+		ssize_t len = recv(cl->fd, &ack, sizeof(ack), block ? 0 : MSG_DONTWAIT);
+
+		if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		}
+		if (len != sizeof(ack)) {
+			printf("Connection to servo daemon lost\n");
+			return -1;
+		}
+		cl->unacked--;
+		cl->frames += ack.accepted;
+		if (ack.status != PROTO_OK) {
+			printf("Message %u: %s, %u keyframes queued\n", ack.seq,
+					ack.status == PROTO_ERR_FULL ? "queue full" : "malformed", ack.accepted);
+			cl->errors++;
+		}
+		block = 0;
+	}
+	return 0;
+}
+
+/**
+ * Send keyframes in messages of up to batch, keeping at most CLIENT_WINDOW unacked
+ * @param flags			PROTO_FLAG_* of the first message
+ * @return 0 on success, != 0 otherwise
+ */
+int client_send(tClient *cl, const tKeyframe *frames, size_t count, unsigned int batch, unsigned int flags)
+{
+	for (size_t i = 0; i < count; i += batch) {
+		unsigned int n = count - i < batch ? count - i : batch;
+
+		if (client_readAcks(cl, cl->unacked >= CLIENT_WINDOW) != 0
+		 || proto_send(cl->fd, cl->seq++, flags, 0, &frames[i], n) != 0) {
+			perror("Sending to servo daemon failed");
+			return -1;
+		}
+		cl->unacked++;
+		flags = 0;
+	}
+	return 0;
+}
+
+/**
+ * Wait until a servo_nowNs() time
+ */
+void client_sleepUntil(unsigned long long t_ns)
+{
+	struct timespec due = {t_ns / 1000000000ULL, t_ns % 1000000000ULL};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+		;
+}
+
+/**
+ * Play a choreography, sending the keyframes due within CLIENT_HORIZON_NS and
+ * waiting for each ack, all messages counting from the start of the playback
+ * @param ks			choreography, pages are dropped once sent
+ * @return 0 on success, != 0 otherwise
+ */
+int client_play(tClient *cl, tKeyframeStream *ks)
+{
+	unsigned long long start = servo_nowNs();
+	unsigned int flags = PROTO_FLAG_REPLACE;
+	size_t sent = 0;
+	tProtoAck ack;
+
+	while (sent < ks->count) {
+		unsigned long long elapsed = servo_nowNs() - start;
+		unsigned long long horizon = elapsed + CLIENT_HORIZON_NS;
+		unsigned int n = 0;
+
+		// top up in batches rather than one keyframe whenever one comes in range
+		if (ks->frames[sent].t_us * 1000ULL > elapsed + CLIENT_HORIZON_NS / 2) {
+			client_sleepUntil(start + ks->frames[sent].t_us * 1000ULL - CLIENT_HORIZON_NS / 2);
+			continue;
+		}
+		while (sent + n < ks->count && n < PROTO_MAX_FRAMES && ks->frames[sent + n].t_us * 1000ULL <= horizon) {
+			n++;
+		}
+		if (proto_send(cl->fd, cl->seq++, flags, start, &ks->frames[sent], n) != 0
+		 || recv(cl->fd, &ack, sizeof(ack), 0) != sizeof(ack)) {
+			perror("Playing through servo daemon failed");
+			return -1;
+		}
+		if (ack.status == PROTO_ERR_FORMAT) {
+			printf("Message %u: malformed\n", ack.seq);
+			cl->errors++;
+			return -1;
+		}
+		// the keyframes replaced are gone, resends must not drop the accepted ones
+		flags = 0;
+		sent += ack.accepted;
+		cl->frames += ack.accepted;
+		keyframe_drop(ks, sent);
+		if (ack.status == PROTO_ERR_FULL) {
+			cl->retries++;
+			client_sleepUntil(servo_nowNs() + CLIENT_BACKOFF_NS);
+		}
+	}
+	if (cl->retries > 0) {
+		printf("Queue full %llu times, the keyframes refused were sent again\n", cl->retries);
+	}
+	return 0;
+}
+
+/**
+ * a keyframe moving the joints in mask, now
+ */
+void client_frame(tKeyframe *kf, unsigned int mask, const int posn[JOINT_COUNT], int speed)
+{
+	memset(kf, 0, sizeof(*kf));
+	kf->mask = mask;
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		kf->posn[j] = posn[j];
+		kf->speed[j] = speed;
+	}
+}
+
+/**
+ * Stream setpoints, each moving all joints a little around home
+ * @param count			setpoints
+ * @param batch			setpoints per message
+ * @return 0 on success, != 0 otherwise
+ */
+int client_stream(tClient *cl, size_t count, unsigned int batch)
+{
+	tKeyframe *frames = (tKeyframe *)malloc(batch * sizeof(tKeyframe));
+	int posn[JOINT_COUNT];
+
+	if (frames == NULL) {
+		return -1;
+	}
+	unsigned long long start = servo_nowNs();
+	for (size_t i = 0; i < count; i += batch) {
+		unsigned int n = count - i < batch ? count - i : batch;
+		for (unsigned int k = 0; k < n; ++k) {
+			for (int j = 0; j < JOINT_COUNT; ++j) {
+				posn[j] = gJoints[j].home - 8 + (i + k + j) % 16;
+			}
+			client_frame(&frames[k], (1 << JOINT_COUNT) - 1, posn, CLIENT_DEFAULT_SPEED);
+		}
+		if (client_send(cl, frames, n, batch, 0) != 0) {
+			free(frames);
+			return -1;
+		}
+	}
+	while (cl->unacked > 0 && client_readAcks(cl, 1) == 0)
+		;
+	unsigned long long ns = servo_nowNs() - start;
+	free(frames);
+
+	printf("%llu setpoints acked in %.1f ms: %.0f setpoints/s, %.0f messages/s\n", cl->frames, ns / 1e6,
+			1e9 * cl->frames / ns, 1e9 * cl->seq / ns);
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	tClient cl;
+	tKeyframe kf;
+	tKeyframeStream choreo;
+	int posn[JOINT_COUNT];
+	int failed;
+
+	memset(&cl, 0, sizeof(cl));
+	memset(posn, 0, sizeof(posn));
+	if (argc < 2) {
+		printf("Usage: servoClient base bicep elbow wrist gripper [speed]\n"
+		       "       servoClient -j joint(1-5) position [speed]\n"
+		       "       servoClient -p choreography\n"
+		       "       servoClient -s count [batch]\n");
+		return -1;
+	}
+	if (strcmp(argv[1], "-p") == 0 && argc == 3 && keyframe_open(&choreo, argv[2]) != 0) {
+		return -1;
+	}
+
+	cl.fd = proto_connect();
+	if (cl.fd == -1) {
+		return -1;
+	}
+
+	if (strcmp(argv[1], "-s") == 0 && argc >= 3) {
+		int batch = argc > 3 ? atoi(argv[3]) : CLIENT_DEFAULT_BATCH;
+		if (batch < 1 || batch > PROTO_MAX_FRAMES) {
+			batch = CLIENT_DEFAULT_BATCH;
+		}
+		failed = client_stream(&cl, strtoul(argv[2], NULL, 10), batch);
+	} else if (strcmp(argv[1], "-p") == 0 && argc == 3) {
+		failed = client_play(&cl, &choreo);
+		keyframe_close(&choreo);
+	} else if (strcmp(argv[1], "-j") == 0 && argc >= 4) {
+		int joint = atoi(argv[2]) - 1;
+		if (joint < 0 || joint >= JOINT_COUNT) {
+			printf("Joint must be 1 .. %d\n", JOINT_COUNT);
+			close(cl.fd);
+			return -1;
+		}
+		posn[joint] = atoi(argv[3]);
+		client_frame(&kf, 1 << joint, posn, argc > 4 ? atoi(argv[4]) : CLIENT_DEFAULT_SPEED);
+		failed = client_send(&cl, &kf, 1, 1, 0);
+	} else if (argc >= 1 + JOINT_COUNT) {
+		for (int j = 0; j < JOINT_COUNT; ++j) {
+			posn[j] = atoi(argv[1 + j]);
+		}
+		client_frame(&kf, (1 << JOINT_COUNT) - 1, posn, argc > 1 + JOINT_COUNT ? atoi(argv[1 + JOINT_COUNT])
+				: CLIENT_DEFAULT_SPEED);
+		failed = client_send(&cl, &kf, 1, 1, 0);
+	} else {
+		printf("Invalid arguments, run without any for usage\n");
+		failed = -1;
+	}
+
+	while (!failed && cl.unacked > 0) {
+		failed = client_readAcks(&cl, 1);
+	}
+	close(cl.fd);
+	return failed || cl.errors ? -1 : 0;
+}
@@ -0,0 +1,425 @@
+/**
+ * Servo daemon: owns the servos and takes commands from local programs
+ *
+ * Usage: servoDaemon
+ *
+ * Clients connect to a Unix domain socket and send batches of keyframes in the
+ * binary protocol of servoProtocol.h, servoClient is one such client. Every
+ * message is acked as soon as it is read. Keyframes for now go to the shadow
+ * registers right away, later ones are queued by due time, counted from the
+ * start time of the message so all batches of one playback share a time base.
+ * A full queue takes no more keyframes, the ack tells the client how many were
+ * queued so it can resend the rest once some have played. Once per servo tick
+ * (SERVO_PERIOD_NS) the queued keyframes due are applied as well and all
+ * changed registers go out in one flush, so a later target for a joint
+ * replaces an earlier one of the same tick. Commands are checked like all
+ * others (servoSafety.h), several clients can stream at once.
+ *
+ * Environment:
+ *   SERVO_SOCKET    socket path, /tmp/servoDaemon.sock if unset
+ *   SERVO_BACKEND   devmem (default), sim or null, see servoBackend.h
+ *   SERVO_RT_PRIO   real-time mode, see rtMode.h
+ *   SERVO_RT_CPU    CPU to pin to in real-time mode
+ *   SERVO_TELEMETRY_HZ  sample the registers into shared memory, see telemetry.h
+ *
+ * SIGINT or SIGTERM stop the daemon. Build with -lm -pthread, the servo
+ * functions are the ones of ServoControl_HW.c.
+ */
+#define SERVO_HW_NO_MAIN
+#include "ServoControl_HW.c"
+
+#include <errno.h>
+#include <signal.h>
+
+#include "reactor.h"
+#include "servoProtocol.h"
+#include "telemetry.h"
+
+
+/************ DAEMON CONSTANTS ************/
+
+/** clients connected at once */
+#define DAEMON_MAX_CLIENTS 8
+
+/** keyframes queued over all clients */
+#define DAEMON_QUEUE_LEN 8192
+
+/** pending connections */
+#define DAEMON_BACKLOG 8
+
+
+/************ DAEMON TYPES ************/
+
+/**
+ * queued keyframe
+ */
+typedef struct {
+	unsigned long long due_ns;  /// CLOCK_MONOTONIC time to apply it
+	unsigned long long order;   /// arrival order, keyframes due together apply first come first
+	unsigned int owner;         /// connection that sent it
+	tKeyframe kf;               /// joints to move
+} tDaemonItem;
+
+/**
+ * connected client
+ */
+typedef struct {
+	int fd;                     /// socket, -1 if the slot is free
+	unsigned int id;            /// connection number, owner of its queued keyframes
+} tDaemonClient;
+
+/**
+ * daemon state
+ */
+typedef struct {
+	tReactor reactor;                       /// listening socket, clients and the servo tick
+	int listenFd;                           /// listening socket
+	struct sockaddr_un addr;                /// its address
+	tDaemonClient clients[DAEMON_MAX_CLIENTS]; /// connected clients
+	unsigned int connections;               /// connections accepted so far
+	tDaemonItem queue[DAEMON_QUEUE_LEN];    /// min-heap on (due_ns, order)
+	unsigned int queued;                    /// keyframes in the queue
+	unsigned long long order;               /// keyframes queued so far
+	unsigned long long messages;            /// messages received
+	unsigned long long malformed;           /// messages rejected
+	unsigned long long dropped;             /// keyframes not queued, queue full
+	unsigned long long applied;             /// keyframes applied, right away or from the queue
+	unsigned long long acksLost;            /// acks a client did not read in time
+	tHist lateness;                         /// applied after due, ns
+	tTelemetry telemetry;                   /// register sampler, off unless SERVO_TELEMETRY_HZ is set
+	unsigned char msg[PROTO_MAX_MSG];       /// receive buffer
+} tDaemon;
+
+
+/**
+ * global daemon state
+ */
+static tDaemon gDaemon;
+
+
+/************ DAEMON FUNCTIONS ************/
+
+/**
+ * queue order: due time, then arrival
+ */
+static inline int daemon_before(const tDaemonItem *a, const tDaemonItem *b)
+{
+	return a->due_ns < b->due_ns || (a->due_ns == b->due_ns && a->order < b->order);
+}
+
+/**
+ * restore the heap below slot i
+ */
+void daemon_siftDown(tDaemon *d, unsigned int i)
+{
+	for (;;) {
+		unsigned int least = i, l = 2 * i + 1, r = l + 1;
+
+		if (l < d->queued && daemon_before(&d->queue[l], &d->queue[least])) {
+			least = l;
+		}
+		if (r < d->queued && daemon_before(&d->queue[r], &d->queue[least])) {
+			least = r;
+		}
+		if (least == i) {
+			return;
+		}
+		tDaemonItem t = d->queue[i];
+		d->queue[i] = d->queue[least];
+		d->queue[least] = t;
+		i = least;
+	}
+}
+
+/**
+ * Queue a keyframe
+ * @return 0 on success, != 0 if the queue is full
+ */
+int daemon_push(tDaemon *d, const tDaemonItem *item)
+{
+	unsigned int i = d->queued;
+
+	if (i == DAEMON_QUEUE_LEN) {
+		return -1;
+	}
+	d->queued++;
+	while (i > 0 && daemon_before(item, &d->queue[(i - 1) / 2])) {
+		d->queue[i] = d->queue[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	d->queue[i] = *item;
+	return 0;
+}
+
+/**
+ * Drop all keyframes a connection has queued
+ * @param owner			connection number
+ */
+void daemon_dropOwner(tDaemon *d, unsigned int owner)
+{
+	unsigned int kept = 0;
+
+	for (unsigned int i = 0; i < d->queued; ++i) {
+		if (d->queue[i].owner != owner) {
+			d->queue[kept++] = d->queue[i];
+		}
+	}
+	d->queued = kept;
+	for (int i = (int)kept / 2 - 1; i >= 0; --i) {
+		daemon_siftDown(d, i);
+	}
+}
+
+/**
+ * Move the joints of a keyframe, registers are written on the next servo_flush()
+ */
+void daemon_apply(const tKeyframe *kf)
+{
+	// the joints move together, check the pose they lead to rather than each step to it
+	if (safety_checkPose(&gServos.safety, gServos.posn, kf->posn, kf->mask) != 0) {
+		return;
+	}
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		if (kf->mask & (1 << j)) {
+			servo_move(j, gServos.posn[j], kf->speed[j]);
+		}
+	}
+}
+
+/**
+ * servo tick: apply everything due, one flush for all of it
+ */
+void daemon_onTick(int fd, void *ctx)
+{
+	tDaemon *d = (tDaemon *)ctx;
+	unsigned long long now = servo_nowNs();
+
+	while (d->queued > 0 && d->queue[0].due_ns <= now) {
+		tDaemonItem item = d->queue[0];
+
+		d->queue[0] = d->queue[--d->queued];
+		daemon_siftDown(d, 0);
+
+		daemon_apply(&item.kf);
+		hist_record(&d->lateness, now - item.due_ns);
+		d->applied++;
+	}
+	servo_flush();
+}
+
+/**
+ * Answer a message, never blocks on a client that does not read its acks
+ */
+void daemon_ack(tDaemon *d, int fd, unsigned int seq, unsigned int status, unsigned int accepted)
+{
+	tProtoAck ack = {seq, status, accepted};
+
+	if (send(fd, &ack, sizeof(ack), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(ack)) {
+		d->acksLost++;
+	}
+}
+
+/**
+ * Queue the keyframes of one message
+ * @param len			message length
+ */
+void daemon_onMessage(tDaemon *d, tDaemonClient *c, size_t len)
+{
+	const tProtoHeader *header = (const tProtoHeader *)d->msg;
+	const tKeyframe *frames = (const tKeyframe *)(header + 1);
+	int count = proto_parse(d->msg, len);
+	unsigned long long now = servo_nowNs();
+	unsigned int accepted = 0;
+	unsigned long long start;
+
+	d->messages++;
+	if (count < 0) {
+		d->malformed++;
+		daemon_ack(d, c->fd, len >= sizeof(*header) ? header->seq : 0, PROTO_ERR_FORMAT, 0);
+		return;
+	}
+	if (header->flags & PROTO_FLAG_REPLACE) {
+		daemon_dropOwner(d, c->id);
+	}
+	start = header->start_ns != 0 ? header->start_ns : now;
+
+	for (; (int)accepted < count; ++accepted) {
+		if (frames[accepted].t_us == 0 && header->start_ns == 0) {
+			// a target for now, the tick flushes it
+			daemon_apply(&frames[accepted]);
+			d->applied++;
+			continue;
+		}
+		// due already if the client sent it late, the next tick applies it in order
+		tDaemonItem item = {start + frames[accepted].t_us * 1000ULL, d->order++, c->id, frames[accepted]};
+		if (daemon_push(d, &item) != 0) {
+			d->dropped += count - accepted;
+			break;
+		}
+	}
+	daemon_ack(d, c->fd, header->seq, (int)accepted == count ? PROTO_OK : PROTO_ERR_FULL, accepted);
+}
+
+/**
+ * client socket readable: handle every message waiting, close on hang-up
+ */
+void daemon_onClient(int fd, void *ctx)
+{
+	tDaemonClient *c = (tDaemonClient *)ctx;
+	tDaemon *d = &gDaemon;
+
+	for (;;) {
+		// MSG_TRUNC: the length of an oversized message, so it is rejected as a whole
+		ssize_t len = recv(fd, d->msg, sizeof(d->msg), MSG_DONTWAIT | MSG_TRUNC);
+
+		if (len > 0) {
+			daemon_onMessage(d, c, (size_t)len);
+		} else if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		} else if (len == -1 && errno == EINTR) {
+			continue;
+		} else {
+			// hang-up or error, keyframes already queued still play
+			reactor_remove(&d->reactor, fd);
+			close(fd);
+			c->fd = -1;
+			return;
+		}
+	}
+}
+
+/**
+ * listening socket readable: accept all pending clients
+ */
+void daemon_onAccept(int fd, void *ctx)
+{
+	tDaemon *d = (tDaemon *)ctx;
+	int cfd;
+
+	// accept4() would need _GNU_SOURCE
+	while ((cfd = accept(fd, NULL, NULL)) != -1) {
+		tDaemonClient *c = NULL;
+
+		fcntl(cfd, F_SETFL, O_NONBLOCK);
+		fcntl(cfd, F_SETFD, FD_CLOEXEC);
+
+		for (int i = 0; i < DAEMON_MAX_CLIENTS && c == NULL; ++i) {
+			if (d->clients[i].fd == -1) {
+				c = &d->clients[i];
+			}
+		}
+		if (c == NULL || reactor_add(&d->reactor, cfd, daemon_onClient, c) != 0) {
+			printf("Refusing client, %d connected already\n", DAEMON_MAX_CLIENTS);
+			close(cfd);
+			continue;
+		}
+		c->fd = cfd;
+		c->id = ++d->connections;
+	}
+}
+
+/**
+ * Create the listening socket
+ * @return 0 on success, != 0 otherwise
+ */
+int daemon_listen(tDaemon *d)
+{
+	if (proto_address(&d->addr) != 0) {
+		return -1;
+	}
+
+	// a socket file left over is removed, one a daemon still answers on is not
+	int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (probe != -1 && connect(probe, (struct sockaddr *)&d->addr, sizeof(d->addr)) == 0) {
+		printf("Another servo daemon is running on '%s'\n", d->addr.sun_path);
+		close(probe);
+		return -1;
+	}
+	if (probe != -1) {
+		close(probe);
+	}
+	unlink(d->addr.sun_path);
+
+	d->listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (d->listenFd == -1 || bind(d->listenFd, (struct sockaddr *)&d->addr, sizeof(d->addr)) != 0
+	 || listen(d->listenFd, DAEMON_BACKLOG) != 0) {
+		perror("Could not listen for servo clients");
+		if (d->listenFd != -1) {
+			close(d->listenFd);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * SIGINT / SIGTERM: leave the reactor loop
+ */
+void daemon_onSignal(int sig) {
+	gDaemon.reactor.stop = 1;
+}
+
+
+int main()
+{
+	tDaemon *d = &gDaemon;
+	struct sigaction sa;
+	tRtConfig rt;
+
+	if (rt_configure(&rt) != 0) {
+		return -1;
+	}
+	for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i) {
+		d->clients[i].fd = -1;
+	}
+	hist_init(&d->lateness, "keyframe lateness");
+
+	if (servo_init() != 0) {
+		return -1;
+	}
+	gServos.deferWrites = 1;
+
+	// started before rt_enter(), the sampler thread does not run real-time
+	if (telem_start(&d->telemetry, &gServos.backend) != 0 || daemon_listen(d) != 0) {
+		telem_stop(&d->telemetry);
+		servo_release();
+		return -1;
+	}
+	if (reactor_init(&d->reactor) != 0
+	 || reactor_add(&d->reactor, d->listenFd, daemon_onAccept, d) != 0
+	 || reactor_addTimer(&d->reactor, SERVO_PERIOD_NS, daemon_onTick, d) != 0) {
+		close(d->listenFd);
+		unlink(d->addr.sun_path);
+		telem_stop(&d->telemetry);
+		servo_release();
+		return -1;
+	}
+
+	// no SA_RESTART: epoll_wait() returns and the loop sees the stop flag
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_onSignal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("Servo daemon listening on '%s'\n", d->addr.sun_path);
+	rt_enter(&rt);
+	reactor_run(&d->reactor);
+
+	for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i) {
+		if (d->clients[i].fd != -1) {
+			close(d->clients[i].fd);
+		}
+	}
+	reactor_close(&d->reactor);
+	close(d->listenFd);
+	unlink(d->addr.sun_path);
+	telem_stop(&d->telemetry);
+	servo_release();
+
+	printf("messages: %llu, malformed: %llu, keyframes applied: %llu, dropped: %llu, still queued: %u, acks lost: %llu\n",
+			d->messages, d->malformed, d->applied, d->dropped, d->queued, d->acksLost);
+	shadow_print(&gServos.shadow, stdout);
+	safety_print(&gServos.safety, stdout);
+	hist_print(&d->lateness, stdout);
+	return 0;
+}
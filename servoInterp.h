@@ -0,0 +1,90 @@
+/**
+ * Fixed point linear interpolator for servo moves
+ *
+ * Positions are kept in Q16.16. The per tick step is split into its Q16.16
+ * quotient and a remainder that is diffused Bresenham style, so after exactly
+ * numPeriods ticks the position is the target, bit for bit, for any distance
+ * and any number of ticks. A tick is one add of the step plus the error update,
+ * no multiply, divide or float conversion.
+ */
+#ifndef SERVO_INTERP_H
+#define SERVO_INTERP_H
+
+
+/************ INTERPOLATOR CONSTANTS ************/
+
+/** fractional bits of the position */
+#define INTERP_FRAC_BITS 16
+#define INTERP_ONE (1 << INTERP_FRAC_BITS)
+
+
+/************ INTERPOLATOR TYPES ************/
+
+/**
+ * linear interpolation state of one joint
+ */
+typedef struct {
+	int pos;        /// current position, Q16.16, biased by 1/2 for rounding
+	int step;       /// position step per tick, Q16.16 (truncated toward -inf)
+	int rem;        /// remainder of the step, in 1/numPeriods LSB
+	int err;        /// diffused error, in 1/numPeriods LSB
+	int numPeriods; /// ticks of the move
+} tInterp;
+
+
+/************ INTERPOLATOR FUNCTIONS ************/
+
+/**
+ * Prepare a move
+ * @param from			start position
+ * @param to			end position
+ * @param numPeriods	number of ticks of the move (>0)
+ */
+static inline void interp_start(tInterp *ip, int from, int to, int numPeriods)
+{
+	long long delta = (long long)(to - from) << INTERP_FRAC_BITS;
+	long long step = delta / numPeriods;
+	long long rem = delta % numPeriods;
+
+	// floor division so the remainder is never negative
+	if (rem < 0) {
+		step--;
+		rem += numPeriods;
+	}
+
+	ip->pos = (from << INTERP_FRAC_BITS) + INTERP_ONE / 2;
+	ip->step = (int)step;
+	ip->rem = (int)rem;
+	ip->err = numPeriods / 2;
+	ip->numPeriods = numPeriods;
+}
+
+/**
+ * Advance one tick
+ * @return position after the tick, rounded to integer
+ */
+static inline int interp_next(tInterp *ip)
+{
+	// carry is -1 once the accumulated remainder is worth one more LSB, 0 otherwise
+	int err = ip->err - ip->rem;
+	int carry = err >> 31;
+
+	ip->err = err + (carry & ip->numPeriods);
+	ip->pos += ip->step - carry;
+	return ip->pos >> INTERP_FRAC_BITS;
+}
+
+/**
+ * Number of servo periods a move takes, rounded to the nearest period
+ * @param dist			distance in degree
+ * @param speed			speed in degree per second (>0)
+ * @param ticksPerSec	periods per second
+ * @return number of periods, at least 1
+ */
+static inline int interp_periods(int dist, int speed, int ticksPerSec)
+{
+	int numPeriods = (int)(((long long)dist * ticksPerSec + speed / 2) / speed);
+	return numPeriods > 0 ? numPeriods : 1;
+}
+
+#endif /* SERVO_INTERP_H */
@@ -0,0 +1,115 @@
+/**
+ * Joints of the arm and their servo registers
+ *
+ * JOINT_TABLE is the one place that describes the joints: register offset,
+ * position limits and home position. The joint ids, the Base_OFFSET ..
+ * Gripper_OFFSET constants and the gJoints descriptor table are all
+ * generated from it, so a servo_move() looks its register up instead of
+ * switching over the joints.
+ *
+ * Joints are numbered from 0 (Base) to JOINT_COUNT - 1 (Gripper) in all code,
+ * only prompts for the user count from 1. The registers are contiguous and 4
+ * bytes apart, so any run of them can be written in one burst.
+ */
+#ifndef SERVO_JOINTS_H
+#define SERVO_JOINTS_H
+
+
+/************ JOINT CONSTANTS ************/
+
+/** number of joints (Base, Bicep, Elbow, Wrist, Gripper) */
+#define JOINT_COUNT 5
+
+/**
+ * one X(id, name, register offset, min, max, home) per joint, positions in degree
+ */
+#define JOINT_TABLE(X) \
+	X(BASE,    Base,    0x100, 60, 240, 150) \
+	X(BICEP,   Bicep,   0x104, 60, 240, 150) \
+	X(ELBOW,   Elbow,   0x108, 60, 240, 150) \
+	X(WRIST,   Wrist,   0x10C, 60, 240, 150) \
+	X(GRIPPER, Gripper, 0x110, 60, 240, 150)
+
+/** speed the home position is approached with, degree / 20ms */
+#define JOINT_HOME_SPEED 100
+
+
+/************ JOINT TYPES ************/
+
+/**
+ * joint ids, JOINT_BASE (0) .. JOINT_GRIPPER
+ */
+typedef enum {
+#define JOINT_ID(id, name, off, min, max, home) JOINT_##id,
+	JOINT_TABLE(JOINT_ID)
+#undef JOINT_ID
+	JOINT_ENTRIES
+} tJointId;
+
+/** register offsets Base_OFFSET .. Gripper_OFFSET */
+enum {
+#define JOINT_OFFSET(id, name, off, min, max, home) name##_OFFSET = off,
+	JOINT_TABLE(JOINT_OFFSET)
+#undef JOINT_OFFSET
+};
+
+/**
+ * joint descriptor
+ */
+typedef struct {
+	const char *name;       /// joint name
+	unsigned int offset;    /// servo register offset
+	unsigned char min;      /// lowest position, degree
+	unsigned char max;      /// highest position, degree
+	unsigned char home;     /// position on init and release, degree
+} tJointDesc;
+
+/** descriptors, indexed by tJointId */
+static const tJointDesc gJoints[JOINT_COUNT] = {
+#define JOINT_DESC(id, name, off, min, max, home) {#name, off, min, max, home},
+	JOINT_TABLE(JOINT_DESC)
+#undef JOINT_DESC
+};
+
+/** the table has to hold JOINT_COUNT joints with contiguous registers */
+typedef char joint_checkCount[JOINT_ENTRIES == JOINT_COUNT ? 1 : -1];
+typedef char joint_checkBlock[Gripper_OFFSET - Base_OFFSET == 4 * (JOINT_COUNT - 1) ? 1 : -1];
+
+
+/************ JOINT FUNCTIONS ************/
+
+/**
+ * Keep a position within the limits of a joint
+ * @param joint			joint id
+ * @param position		position in degree
+ * @return position clamped to the joint limits
+ */
+static inline int joint_clamp(int joint, int position)
+{
+	return position < gJoints[joint].min ? gJoints[joint].min
+	     : position > gJoints[joint].max ? gJoints[joint].max : position;
+}
+
+/**
+ * Servo register value
+ * @param position		position in degree
+ * @param speed			speed in degree / 20ms
+ * @return bits 0..7 position, bits 8..15 speed, bits 16..31 all 0
+ */
+static inline unsigned int joint_regValue(unsigned char position, unsigned char speed)
+{
+	return 0 << 16 | speed << 8 | position;
+}
+
+/**
+ * Home position of all joints
+ * @param pose			receives the position per joint
+ */
+static inline void joint_homePose(unsigned char pose[JOINT_COUNT])
+{
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		pose[j] = gJoints[j].home;
+	}
+}
+
+#endif /* SERVO_JOINTS_H */
@@ -2,83 +2,54 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
 
-#define BASE_ADDRESS 0x400D0000
+#include "servoTick.h"
+#include "servoInterp.h"
+#include "servoJoints.h"
 
-//Servo motor offsets
-#define Base_OFFSET 0x100
-#define Bicep_OFFSET 0x104
-#define Elbow_OFFSET 0x108
-#define Wrist_OFFSET 0x10C
-#define Gripper_OFFSET 0x110
+#define BASE_ADDRESS 0x400D0000
 
 #define REG_WRITE(addr, off, val) (*(volatile int*)(addr+off)=(val))
 
 /**
  * Move Servo given a speed.
- * @param servoNr		selected servo number
+ * @param joint			joint to move, JOINT_BASE (0) .. JOINT_GRIPPER
  * @param from			start position (0-180)
  * @param to			end position (0-180)
  * @param speed			speed (degree/sec) >0
  */
-void servoMove(unsigned int servoNr, int from, int to, int speed)
+void servoMove(unsigned int joint, int from, int to, int speed)
 {
 	int startCyc = (10*from) + 600;
   	int endCyc = (10*to) + 600;
-  	
-  	int numPeriods = (abs((to - from)) / speed) * 50;
-  	int increment = (endCyc - startCyc) / numPeriods;
-	
-	switch (servoNr) {
-        	case 0:  //Base
-        			for (int i = 0; i < numPeriods; ++i) {
-                		//REG_WRITE(gServos.test_base, Base_OFFSET, (startCyc + (increment * i));
-                		printf("\nDuty Cycle: %i", (startCyc + (increment * i)));
-                		usleep(20000);
-                	}
-                	break;
-
-           	case 1:  //Bicep
-           			for (int i = 0; i < numPeriods; ++i) {
-                		//REG_WRITE(gServos.test_base, Bicep_OFFSET, (startCyc + (increment * i)));
-                		printf("\nDuty Cycle: %i", (startCyc + (increment * i)));
-                		usleep(20000);
-                	}
-                	break;
-
-          	case 2:  //Elbow
-          			for (int i = 0; i < numPeriods; ++i) {
-                		//REG_WRITE(gServos.test_base, Elbow_OFFSET, (startCyc + (increment * i)));
-                		printf("\nDuty Cycle: %i", (startCyc + (increment * i)));
-                		usleep(20000);
-                	}
-                	break;
-
-           	case 3:  //Wrist
-           			for (int i = 0; i < numPeriods; ++i) {
-                		//REG_WRITE(gServos.test_base, Wrist_OFFSET, (startCyc + (increment * i)));
-                		printf("\nDuty Cycle: %i", (startCyc + (increment * i)));
-                		usleep(20000);
-                	}
-                	break;
-
-           	case 4:  //Gripper
-           			for (int i = 0; i < numPeriods; ++i) {
-                		//REG_WRITE(gServos.test_base, Gripper_OFFSET, (startCyc + (increment * i)));
-                		printf("\nDuty Cycle: %i", (startCyc + (increment * i)));
-                		usleep(20000);
-                	}
-                	break;
-
-           	default:
-                	break;
+  	int offset;
+  	tInterp ip;
+  	tTick tick;
+
+  	if (speed <= 0 || joint >= JOINT_COUNT) {
+  		return;
+  	}
+  	offset = gJoints[joint].offset;
+
+  	// rounded, not truncated: short moves still run and take |to - from| / speed seconds
+  	int numPeriods = interp_periods(abs(to - from), speed, SERVO_TICKS_PER_SEC);
+  	// duty cycle steps with error diffusion, ends exactly on endCyc
+  	interp_start(&ip, startCyc, endCyc, numPeriods);
+
+	tick_start(&tick, SERVO_PERIOD_NS);
+	for (int i = 1; i <= numPeriods; ++i) {
+		tick_wait(&tick);
+		int dutyCyc = interp_next(&ip);
+		//REG_WRITE(gServos.test_base, offset, dutyCyc);
+		printf("\nDuty Cycle: %i (offset 0x%X)", dutyCyc, offset);
 	}
 }
 
 
 int main()
 {
-	servoMove(0, 10, 100, 36);
+	servoMove(JOINT_BASE, 10, 100, 36);
 
 	return 0;
 }
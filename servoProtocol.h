@@ -0,0 +1,170 @@
+/**
+ * Binary command protocol of servoDaemon
+ *
+ * Clients connect to a Unix domain SOCK_SEQPACKET socket, so every send() is
+ * one message and message boundaries survive without framing. A message is a
+ * tProtoHeader followed by header.count keyframes (keyframe.h): each moves the
+ * joints in its mask, t_us after header.start_ns, or after the message arrived
+ * if start_ns is 0. A batch can be a set of joint targets (all t_us 0) or a
+ * piece of a trajectory. Long trajectories go in several messages sharing one
+ * start_ns, sent as they come due, since the daemon only queues so many.
+ *
+ * Every message is answered with a tProtoAck carrying the client's sequence
+ * number. Clients do not wait for it: they keep sending and read the acks
+ * whenever convenient, the socket buffers both directions.
+ *
+ * All fields are in host byte order, both ends run on the same machine.
+ */
+#ifndef SERVO_PROTOCOL_H
+#define SERVO_PROTOCOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "keyframe.h"
+
+
+/************ PROTOCOL CONSTANTS ************/
+
+/** header magic and version */
+#define PROTO_MAGIC 0x5653 /* "SV" */
+#define PROTO_VERSION 2
+
+/** socket used if SERVO_SOCKET is not set */
+#define PROTO_DEFAULT_PATH "/tmp/servoDaemon.sock"
+
+/** most keyframes per message */
+#define PROTO_MAX_FRAMES 1024
+
+/** largest message */
+#define PROTO_MAX_MSG (sizeof(tProtoHeader) + PROTO_MAX_FRAMES * sizeof(tKeyframe))
+
+/** header flags */
+#define PROTO_FLAG_REPLACE 0x1  /* drop everything this client queued before */
+
+/** ack status */
+#define PROTO_OK 0
+#define PROTO_ERR_FORMAT 1     /* malformed message, nothing queued */
+#define PROTO_ERR_FULL 2       /* queue full, only the first accepted frames are queued, resend the rest later */
+
+
+/************ PROTOCOL TYPES ************/
+
+/**
+ * message header, followed by count keyframes
+ */
+typedef struct {
+	unsigned short magic;   /// PROTO_MAGIC
+	unsigned char version;  /// PROTO_VERSION
+	unsigned char flags;    /// PROTO_FLAG_*
+	unsigned int seq;       /// chosen by the client, echoed in the ack
+	unsigned int count;     /// keyframes following
+	unsigned int reserved;  /// 0
+	unsigned long long start_ns; /// CLOCK_MONOTONIC time t_us counts from, 0: arrival of the message
+} tProtoHeader;
+
+/**
+ * answer to every message
+ */
+typedef struct {
+	unsigned int seq;       /// seq of the message
+	unsigned short status;  /// PROTO_OK or PROTO_ERR_*
+	unsigned short accepted; /// keyframes queued
+} tProtoAck;
+
+
+/************ PROTOCOL FUNCTIONS ************/
+
+/**
+ * Socket address of the daemon, SERVO_SOCKET or PROTO_DEFAULT_PATH
+ * @param addr			receives the address
+ * @return 0 on success, != 0 if the path is too long
+ */
+static inline int proto_address(struct sockaddr_un *addr)
+{
+	const char *path = getenv("SERVO_SOCKET");
+
+	if (path == NULL) {
+		path = PROTO_DEFAULT_PATH;
+	}
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		printf("Socket path '%s' too long\n", path);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+/**
+ * Connect to the daemon
+ * @return socket, -1 on error
+ */
+static inline int proto_connect(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (proto_address(&addr) != 0) {
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror("Could not connect to servo daemon");
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Send one batch of keyframes as one message
+ * @param fd			connected socket
+ * @param seq			sequence number echoed in the ack
+ * @param flags			PROTO_FLAG_*
+ * @param start_ns		servo_nowNs() time the keyframe times count from, 0: arrival of the message
+ * @param frames		keyframes
+ * @param count			number of keyframes (<= PROTO_MAX_FRAMES)
+ * @return 0 on success, != 0 otherwise
+ */
+static inline int proto_send(int fd, unsigned int seq, unsigned int flags, unsigned long long start_ns,
+		const tKeyframe *frames, unsigned int count)
+{
+	tProtoHeader header = {PROTO_MAGIC, PROTO_VERSION, flags, seq, count, 0, start_ns};
+	struct iovec iov[2] = {{&header, sizeof(header)}, {(void *)frames, count * sizeof(tKeyframe)}};
+	struct msghdr msg;
+
+	if (count > PROTO_MAX_FRAMES) {
+		return -1;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)(sizeof(header) + iov[1].iov_len) ? 0 : -1;
+}
+
+/**
+ * Check a received message
+ * @param msg			message
+ * @param len			message length
+ * @return keyframe count, -1 if malformed
+ */
+static inline int proto_parse(const void *msg, size_t len)
+{
+	const tProtoHeader *header = (const tProtoHeader *)msg;
+
+	if (len < sizeof(*header) || header->magic != PROTO_MAGIC || header->version != PROTO_VERSION
+	 || header->count > PROTO_MAX_FRAMES || len != sizeof(*header) + header->count * sizeof(tKeyframe)) {
+		return -1;
+	}
+	return (int)header->count;
+}
+
+#endif /* SERVO_PROTOCOL_H */
@@ -0,0 +1,209 @@
+/**
+ * Safety limits for servo commands
+ *
+ * Every command is clamped into the joint limits (servoJoints.h). Bicep,
+ * Elbow and Wrist together decide whether the arm hits the table or itself,
+ * the Base only turns the arm about the vertical axis and the Gripper stays
+ * clear. At startup forward kinematics (armKinematics.h) is evaluated over a
+ * grid of those three joints and every grid cell whose corners are all safe
+ * is marked in a bitmap of about 12 KiB. A command is then checked with one
+ * lookup of the pose it leads to; if that pose is not safe the joint keeps its
+ * previous position. Commands for several joints at once (keyframes, poses)
+ * are checked as a whole and dropped if unsafe.
+ *
+ * Only commanded end poses are checked, the path the FPGA takes between two
+ * safe poses is not.
+ */
+#ifndef SERVO_SAFETY_H
+#define SERVO_SAFETY_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "armKinematics.h"
+#include "servoJoints.h"
+
+
+/************ SAFETY CONSTANTS ************/
+
+/** joints (Base, Bicep, Elbow, Wrist, Gripper) */
+#define SAFETY_JOINTS JOINT_COUNT
+
+/** position range covered by the grid, degree, holds the limits of every joint (servoJoints.h) */
+#define SAFETY_POSN_MIN 60
+#define SAFETY_POSN_MAX 240
+
+/** grid cell size in degree and cells per joint */
+#define SAFETY_STEP 4
+#define SAFETY_CELLS ((SAFETY_POSN_MAX - SAFETY_POSN_MIN) / SAFETY_STEP + 1)
+#define SAFETY_GRID_BYTES ((SAFETY_CELLS * SAFETY_CELLS * SAFETY_CELLS + 7) / 8)
+
+/** elbow, wrist and gripper tip stay this high above the table, mm */
+#define SAFETY_TABLE_CLEARANCE 15.0f
+
+/** wrist and gripper tip stay out of the base column up to this height, mm */
+#define SAFETY_BASE_RADIUS 60.0f
+#define SAFETY_BASE_TOP (IK_BASE_HEIGHT + 20.0f)
+
+/** shortest distance from bicep axis to wrist before forearm and bicep touch, mm */
+#define SAFETY_FOLD_MIN 80.0f
+
+
+/************ SAFETY TYPES ************/
+
+/**
+ * safety limits and counters
+ */
+typedef struct {
+	unsigned char grid[SAFETY_GRID_BYTES]; /// bit per (Bicep, Elbow, Wrist) cell: pose is safe
+	unsigned long long clamped;            /// commands moved into the joint limits
+	unsigned long long blocked;            /// commands refused, the pose would collide
+} tServoSafety;
+
+
+/************ SAFETY FUNCTIONS ************/
+
+/**
+ * check a pose of Bicep, Elbow and Wrist against table and self collision
+ * @return 1 if safe, 0 otherwise
+ */
+static inline int safety_evalPose(int bicep, int elbow, int wrist)
+{
+	const unsigned char posn[IK_JOINTS] = {IK_SERVO_MIDDLE, bicep, elbow, wrist};
+	tIkJoints j;
+
+	ik_fromServo(posn, &j);
+
+	// joints in the arm plane: r from the base axis, z from the table
+	float a1 = j.q[1];
+	float a2 = a1 + j.q[2];
+	float a3 = a2 + j.q[3];
+	float er = IK_BICEP_LEN * cosf(a1), ez = IK_BASE_HEIGHT + IK_BICEP_LEN * sinf(a1);
+	float wr = er + IK_FOREARM_LEN * cosf(a2), wz = ez + IK_FOREARM_LEN * sinf(a2);
+	float tr = wr + IK_GRIPPER_LEN * cosf(a3), tz = wz + IK_GRIPPER_LEN * sinf(a3);
+
+	if (ez < SAFETY_TABLE_CLEARANCE || wz < SAFETY_TABLE_CLEARANCE || tz < SAFETY_TABLE_CLEARANCE) {
+		return 0;
+	}
+	if ((fabsf(wr) < SAFETY_BASE_RADIUS && wz < SAFETY_BASE_TOP)
+	 || (fabsf(tr) < SAFETY_BASE_RADIUS && tz < SAFETY_BASE_TOP)) {
+		return 0;
+	}
+	if (wr * wr + (wz - IK_BASE_HEIGHT) * (wz - IK_BASE_HEIGHT) < SAFETY_FOLD_MIN * SAFETY_FOLD_MIN) {
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Build the safety grid
+ */
+static inline void safety_init(tServoSafety *s)
+{
+	// pose checked at every cell corner, corner i is at SAFETY_POSN_MIN + i * SAFETY_STEP
+	static unsigned char corner[SAFETY_CELLS + 1][SAFETY_CELLS + 1][SAFETY_CELLS + 1];
+
+	memset(s, 0, sizeof(*s));
+	for (int b = 0; b <= SAFETY_CELLS; ++b) {
+		for (int e = 0; e <= SAFETY_CELLS; ++e) {
+			for (int w = 0; w <= SAFETY_CELLS; ++w) {
+				corner[b][e][w] = safety_evalPose(SAFETY_POSN_MIN + b * SAFETY_STEP,
+						SAFETY_POSN_MIN + e * SAFETY_STEP, SAFETY_POSN_MIN + w * SAFETY_STEP);
+			}
+		}
+	}
+
+	for (int b = 0; b < SAFETY_CELLS; ++b) {
+		for (int e = 0; e < SAFETY_CELLS; ++e) {
+			for (int w = 0; w < SAFETY_CELLS; ++w) {
+				int safe = 1;
+				for (int c = 0; c < 8; ++c) {
+					safe &= corner[b + (c & 1)][e + ((c >> 1) & 1)][w + (c >> 2)];
+				}
+				unsigned int idx = (b * SAFETY_CELLS + e) * SAFETY_CELLS + w;
+				s->grid[idx >> 3] |= safe << (idx & 7);
+			}
+		}
+	}
+}
+
+/**
+ * Look up a pose of Bicep, Elbow and Wrist, each within the joint limits
+ * @return 1 if safe, 0 otherwise
+ */
+static inline int safety_poseSafe(const tServoSafety *s, int bicep, int elbow, int wrist)
+{
+	unsigned int idx = (((bicep - SAFETY_POSN_MIN) / SAFETY_STEP * SAFETY_CELLS
+	                   + (elbow - SAFETY_POSN_MIN) / SAFETY_STEP) * SAFETY_CELLS
+	                   + (wrist - SAFETY_POSN_MIN) / SAFETY_STEP);
+	return (s->grid[idx >> 3] >> (idx & 7)) & 1;
+}
+
+/**
+ * Check a command for one joint
+ * @param posn			currently commanded position per joint, index 0 (Base) .. 4 (Gripper)
+ * @param joint			joint to move, 0 .. 4
+ * @param position		position asked for
+ * @return position to command: within the joint limits, the current one if the new pose is not safe
+ */
+static inline int safety_check(tServoSafety *s, const unsigned char posn[SAFETY_JOINTS], int joint, int position)
+{
+	int clamped = joint_clamp(joint, position);
+
+	if (clamped != position) {
+		position = clamped;
+		s->clamped++;
+	}
+	if (joint < JOINT_BICEP || joint > JOINT_WRIST) {
+		return position;
+	}
+
+	int pose[SAFETY_JOINTS];
+	for (int k = JOINT_BICEP; k <= JOINT_WRIST; ++k) {
+		pose[k] = joint_clamp(k, posn[k]);
+	}
+	pose[joint] = position;
+	if (!safety_poseSafe(s, pose[JOINT_BICEP], pose[JOINT_ELBOW], pose[JOINT_WRIST])) {
+		s->blocked++;
+		return posn[joint];
+	}
+	return position;
+}
+
+/**
+ * Check a command moving several joints at once, e.g. a keyframe whose
+ * registers reach the FPGA in one flush: only the pose they lead to together
+ * counts, not the order the joints are set in
+ * @param posn			currently commanded position per joint, receives the new pose if it is safe
+ * @param pose			position asked for per joint
+ * @param mask			bit j set: joint j moves
+ * @return 0 if the pose is safe (moved joints clamped into the joint limits), != 0 otherwise (posn untouched)
+ */
+static inline int safety_checkPose(tServoSafety *s, unsigned char posn[SAFETY_JOINTS],
+		const unsigned char pose[SAFETY_JOINTS], unsigned int mask)
+{
+	unsigned char next[SAFETY_JOINTS];
+
+	for (int k = 0; k < SAFETY_JOINTS; ++k) {
+		int p = (mask & (1 << k)) ? pose[k] : posn[k];
+		next[k] = joint_clamp(k, p);
+		s->clamped += (next[k] != p) & (mask >> k);
+	}
+	if (!safety_poseSafe(s, next[JOINT_BICEP], next[JOINT_ELBOW], next[JOINT_WRIST])) {
+		s->blocked++;
+		return -1;
+	}
+	memcpy(posn, next, sizeof(next));
+	return 0;
+}
+
+/**
+ * Print clamped and blocked command counters
+ * @param out			stream to print to
+ */
+static inline void safety_print(const tServoSafety *s, FILE *out)
+{
+	fprintf(out, "servo commands clamped to limits: %llu, blocked by collision check: %llu\n", s->clamped, s->blocked);
+}
+
+#endif /* SERVO_SAFETY_H */
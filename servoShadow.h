@@ -0,0 +1,110 @@
+/**
+ * Shadow copy of the servo registers
+ *
+ * Register writes go to the shadow first. A write of the value the FPGA
+ * already holds is suppressed, changed registers are marked dirty and written
+ * by shadow_flush(), either right away or once per control tick so that
+ * several updates of the same register in one tick cost a single bus write.
+ * Adjacent dirty registers are flushed together in one burst.
+ */
+#ifndef SERVO_SHADOW_H
+#define SERVO_SHADOW_H
+
+#include "servoBackend.h"
+#include "servoJoints.h"
+
+
+/************ SHADOW CONSTANTS ************/
+
+/** first servo register (Base) */
+#define SERVO_REG_FIRST Base_OFFSET
+
+/** number of servo registers, 4 bytes apart */
+#define SERVO_REG_COUNT JOINT_COUNT
+
+
+/************ SHADOW TYPES ************/
+
+/**
+ * shadow register cache
+ */
+typedef struct {
+	unsigned int hw[SERVO_REG_COUNT];     /// value last written to the FPGA
+	unsigned int value[SERVO_REG_COUNT];  /// value to be written on next flush
+	unsigned int valid;                   /// bit per register: hw[] is known
+	unsigned int dirty;                   /// bit per register: value[] differs from hw[]
+	unsigned long long issued;            /// register writes done
+	unsigned long long bursts;            /// runs of adjacent registers written at once
+	unsigned long long suppressed;        /// register writes avoided
+} tServoShadow;
+
+
+/************ SHADOW FUNCTIONS ************/
+
+/**
+ * Initialize shadow, nothing is known about the FPGA registers yet
+ */
+static inline void shadow_init(tServoShadow *sh)
+{
+	memset(sh, 0, sizeof(*sh));
+}
+
+/**
+ * Set a register in the shadow, marks it dirty if it differs from the FPGA
+ * @param off			register offset (SERVO_REG_FIRST + 4 * n)
+ * @param val			new value
+ */
+static inline void shadow_set(tServoShadow *sh, unsigned int off, unsigned int val)
+{
+	unsigned int idx = (off - SERVO_REG_FIRST) >> 2;
+	unsigned int bit = 1u << idx;
+
+	if (sh->dirty & bit) {
+		// pending value replaced before it reached the FPGA
+		sh->suppressed++;
+	}
+	sh->value[idx] = val;
+
+	if ((sh->valid & bit) && sh->hw[idx] == val) {
+		if (!(sh->dirty & bit)) {
+			sh->suppressed++;
+		}
+		sh->dirty &= ~bit;
+	} else {
+		sh->dirty |= bit;
+	}
+}
+
+/**
+ * Write all dirty registers to the FPGA, each run of adjacent ones in one burst
+ * @param be			register backend
+ */
+static inline void shadow_flush(tServoShadow *sh, tServoBackend *be)
+{
+	unsigned int dirty = sh->dirty;
+
+	while (dirty != 0) {
+		unsigned int idx = __builtin_ctz(dirty);
+		unsigned int run = __builtin_ctz(~(dirty >> idx));
+		dirty &= ~(((1u << run) - 1) << idx);
+
+		be->writeBlock(be, SERVO_REG_FIRST + 4 * idx, &sh->value[idx], run);
+		memcpy(&sh->hw[idx], &sh->value[idx], run * sizeof(sh->hw[0]));
+		sh->issued += run;
+		sh->bursts++;
+	}
+	sh->valid |= sh->dirty;
+	sh->dirty = 0;
+}
+
+/**
+ * Print issued and suppressed write counters
+ * @param out			stream to print to
+ */
+static inline void shadow_print(const tServoShadow *sh, FILE *out)
+{
+	fprintf(out, "servo register writes issued: %llu in %llu bursts, suppressed: %llu\n",
+			sh->issued, sh->bursts, sh->suppressed);
+}
+
+#endif /* SERVO_SHADOW_H */
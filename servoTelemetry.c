@@ -0,0 +1,126 @@
+/**
+ * Monitor of the servo register telemetry
+ *
+ * Usage: servoTelemetry            print the latest sample and exit
+ *        servoTelemetry -f [every] follow the samples, print every one (or every nth)
+ *
+ * Reads the ring a ServoControl_SW or servoDaemon started with
+ * SERVO_TELEMETRY_HZ writes (telemetry.h). The file is mapped read-only and
+ * the samples are read in place, the sampler never waits for this monitor.
+ * Samples overwritten before they were read are counted as lost.
+ *
+ * Environment:
+ *   SERVO_TELEMETRY_PATH   shared memory file, /dev/shm/servoTelemetry if unset
+ *
+ * SIGINT stops following.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "telemetry.h"
+
+
+/************ MONITOR CONSTANTS ************/
+
+/** pause when no new sample is there, ns */
+#define MONITOR_POLL_NS 1000000L
+
+
+/************ MONITOR FUNCTIONS ************/
+
+/** set by SIGINT */
+volatile sig_atomic_t gStop;
+
+void monitor_onSignal(int sig)
+{
+	(void)sig;
+	gStop = 1;
+}
+
+/**
+ * Print one sample, positions and speeds decoded
+ */
+void monitor_print(const tTelemSample *s)
+{
+	printf("%llu %llu.%09llu", s->seq - 1, s->t_ns / NSEC_PER_SEC, s->t_ns % NSEC_PER_SEC);
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		printf("  %s %3u@%u", gJoints[j].name, s->regs[j] & 0xFF, (s->regs[j] >> 8) & 0xFF);
+	}
+	printf("\n");
+}
+
+/**
+ * Follow the ring until SIGINT
+ * @param every			print every nth sample
+ */
+void monitor_follow(const tTelemetry *tm, unsigned int every)
+{
+	struct timespec pause = {0, MONITOR_POLL_NS};
+	unsigned long long next = telem_head(tm);
+	unsigned long long read = 0, lost = 0;
+	tTelemSample s;
+
+	while (!gStop) {
+		unsigned long long head = telem_head(tm);
+
+		if (next == head) {
+			nanosleep(&pause, NULL);
+			continue;
+		}
+		// the sampler lapped us, skip what is gone
+		if (head - next > TELEM_RING_LEN) {
+			lost += head - TELEM_RING_LEN - next;
+			next = head - TELEM_RING_LEN;
+		}
+		for (; next < head; ++next) {
+			if (telem_read(tm, next, &s) != 0) {
+				lost++;
+				continue;
+			}
+			if (read++ % every == 0) {
+				monitor_print(&s);
+			}
+		}
+	}
+	printf("samples read: %llu, lost: %llu, sampler overruns: %llu\n", read, lost,
+			__atomic_load_n(&tm->shm->overruns, __ATOMIC_RELAXED));
+}
+
+
+int main(int argc, char *argv[])
+{
+	tTelemetry tm;
+	tTelemSample s;
+	struct sigaction sa;
+
+	if (telem_attach(&tm) != 0) {
+		return -1;
+	}
+
+	if (argc >= 2 && strcmp(argv[1], "-f") == 0) {
+		int every = argc > 2 ? atoi(argv[2]) : 1;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = monitor_onSignal;
+		sigaction(SIGINT, &sa, NULL);
+		printf("Following %ld Hz telemetry, Ctrl-C stops\n", NSEC_PER_SEC / tm.shm->period_ns);
+		monitor_follow(&tm, every > 0 ? every : 1);
+	} else {
+		unsigned long long head = telem_head(&tm);
+
+		// retry if the newest sample is rewritten while it is read
+		while (head > 0 && telem_read(&tm, head - 1, &s) != 0) {
+			head = telem_head(&tm);
+		}
+		if (head == 0) {
+			printf("No samples yet\n");
+		} else {
+			monitor_print(&s);
+		}
+	}
+
+	telem_detach(&tm);
+	return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * Periodic tick for servo control, paced by absolute deadlines
+ *
+ * Every tick is scheduled relative to the first one (deadline += period),
+ * so sleeping late once does not shift the whole sequence and the
+ * CPU is idle between ticks.
+ */
+#ifndef SERVO_TICK_H
+#define SERVO_TICK_H
+
+#include <time.h>
+#include <errno.h>
+
+
+/************ TICK CONSTANTS ************/
+
+/** servo PWM period in ns (20 ms, 50 Hz) */
+#define SERVO_PERIOD_NS 20000000L
+
+/** servo PWM periods per second */
+#define SERVO_TICKS_PER_SEC (1000000000L / SERVO_PERIOD_NS)
+
+#define NSEC_PER_SEC 1000000000L
+
+
+/************ TICK TYPES ************/
+
+/**
+ * data structure for a periodic tick
+ */
+typedef struct {
+	struct timespec deadline; /// absolute time of the next tick (CLOCK_MONOTONIC)
+	long period_ns;           /// tick period in ns
+	unsigned long count;      /// number of ticks elapsed
+	unsigned long overruns;   /// number of deadlines missed entirely
+	long long late_ns;        /// wake-up jitter of the last tick: time woken up after its deadline
+} tTick;
+
+
+/************ TICK FUNCTIONS ************/
+
+/**
+ * add ns nanoseconds to a timespec
+ * @param ts		time to advance
+ * @param ns		nanoseconds to add (>= 0)
+ */
+static inline void tick_tsAdd(struct timespec *ts, long long ns)
+{
+	ts->tv_sec += ns / NSEC_PER_SEC;
+	ts->tv_nsec += ns % NSEC_PER_SEC;
+	if (ts->tv_nsec >= NSEC_PER_SEC) {
+		ts->tv_nsec -= NSEC_PER_SEC;
+		ts->tv_sec++;
+	}
+}
+
+/**
+ * difference a - b of two timespecs
+ * @return difference in ns
+ */
+static inline long long tick_tsDiff(const struct timespec *a, const struct timespec *b)
+{
+	return (long long)(a->tv_sec - b->tv_sec) * NSEC_PER_SEC + (a->tv_nsec - b->tv_nsec);
+}
+
+/**
+ * Start a periodic tick. The first deadline is one period from now.
+ * @param tick			tick to start
+ * @param period_ns		tick period in ns
+ */
+static inline void tick_start(tTick *tick, long period_ns)
+{
+	tick->period_ns = period_ns;
+	tick->count = 0;
+	tick->overruns = 0;
+	tick->late_ns = 0;
+	clock_gettime(CLOCK_MONOTONIC, &tick->deadline);
+	tick_tsAdd(&tick->deadline, period_ns);
+}
+
+/**
+ * Sleep until the next deadline and advance it by one period.
+ * If we are already late by one or more whole periods those ticks are
+ * skipped (and counted) rather than fired back to back.
+ * @param tick			tick to wait on
+ * @return number of deadlines skipped (0 if on time)
+ */
+static inline int tick_wait(tTick *tick)
+{
+	struct timespec now;
+	long long late;
+	int skipped = 0;
+
+	// sleep until absolute deadline, restart if interrupted by a signal
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick->deadline, NULL) == EINTR)
+		;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	late = tick_tsDiff(&now, &tick->deadline);
+	tick->late_ns = late;
+	if (late >= tick->period_ns) {
+		skipped = (int)(late / tick->period_ns);
+		tick_tsAdd(&tick->deadline, (long long)skipped * tick->period_ns);
+		tick->overruns += skipped;
+	}
+
+	tick_tsAdd(&tick->deadline, tick->period_ns);
+	tick->count++;
+
+	return skipped;
+}
+
+#endif /* SERVO_TICK_H */
@@ -0,0 +1,129 @@
+/**
+ * Lock-free single producer / single consumer ring of fixed size items
+ *
+ * The producer never waits: when the ring is full the oldest item is
+ * overwritten. Every slot carries a sequence number (odd while being written)
+ * so the consumer can detect items that were overwritten while it copied them;
+ * those are skipped and counted in drops. Exactly one thread may push and one
+ * thread may pop. A producer that must not lose items can check spsc_full()
+ * before pushing and wait for the consumer instead.
+ */
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <string.h>
+
+
+/************ RING CONSTANTS ************/
+
+/** number of slots (power of 2) */
+#define SPSC_RING_LEN 256
+
+/** largest item size in bytes */
+#define SPSC_RING_ITEM_MAX 64
+
+
+/************ RING TYPES ************/
+
+/**
+ * one ring slot
+ */
+typedef struct {
+	unsigned long long seq;                 /// 2*n+1 while item n is written, 2*n+2 once complete
+	unsigned char data[SPSC_RING_ITEM_MAX]; /// item payload
+} tSpscSlot;
+
+/**
+ * structure for ring object
+ */
+typedef struct {
+	tSpscSlot slots[SPSC_RING_LEN]; /// item storage
+	unsigned int itemSize;          /// size of one item (<= SPSC_RING_ITEM_MAX)
+	unsigned long long head;        /// items pushed so far (written by producer)
+	unsigned long long tail;        /// next item to pop (written by consumer)
+	unsigned long long drops;       /// items overwritten before they were popped (consumer only)
+} tSpscRing;
+
+
+/************ RING FUNCTIONS ************/
+
+/**
+ * Initialize ring
+ * @param itemSize		size of one item in bytes
+ * @return 0 on success, != 0 if the item is too large
+ */
+static inline int spsc_init(tSpscRing *ring, unsigned int itemSize)
+{
+	if (itemSize > SPSC_RING_ITEM_MAX) {
+		return -1;
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->itemSize = itemSize;
+	return 0;
+}
+
+/**
+ * Append an item, overwriting the oldest one if the ring is full (producer only)
+ * @param item			item to copy into the ring
+ */
+static inline void spsc_push(tSpscRing *ring, const void *item)
+{
+	unsigned long long n = ring->head;
+	tSpscSlot *slot = &ring->slots[n & (SPSC_RING_LEN - 1)];
+
+	// mark slot as being written before touching the payload
+	__atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(slot->data, item, ring->itemSize);
+	__atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check if the next push would overwrite an item not popped yet (producer only)
+ * @return 1 if the ring is full, 0 otherwise
+ */
+static inline int spsc_full(const tSpscRing *ring)
+{
+	return ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= SPSC_RING_LEN;
+}
+
+/**
+ * Take the oldest item still in the ring (consumer only)
+ * @param item			receives a copy of the item
+ * @return 1 if an item was taken, 0 if the ring is empty
+ */
+static inline int spsc_pop(tSpscRing *ring, void *item)
+{
+	for (;;) {
+		unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long long n = ring->tail;
+
+		if (n == head) {
+			return 0;
+		}
+		// fell behind by more than a full ring: everything older is gone
+		if (head - n > SPSC_RING_LEN) {
+			ring->drops += head - n - SPSC_RING_LEN;
+			n = head - SPSC_RING_LEN;
+			__atomic_store_n(&ring->tail, n, __ATOMIC_RELEASE);
+		}
+
+		tSpscSlot *slot = &ring->slots[n & (SPSC_RING_LEN - 1)];
+		unsigned long long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == 2 * n + 2) {
+			memcpy(item, slot->data, ring->itemSize);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			// still the same item after copying?
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+				__atomic_store_n(&ring->tail, n + 1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+		// producer lapped us on this slot (before or while copying), skip it
+		ring->drops++;
+		__atomic_store_n(&ring->tail, n + 1, __ATOMIC_RELEASE);
+	}
+}
+
+#endif /* SPSC_RING_H */
@@ -0,0 +1,284 @@
+/**
+ * Servo register telemetry in shared memory
+ *
+ * A sampler thread reads the servo register block at a fixed rate and stores
+ * every sample, time stamped, into a ring in a shared memory file. Monitoring
+ * tools map the same file read-only and read the samples in place: there is
+ * no lock, the sampler never waits for a reader and the control thread is not
+ * involved at all.
+ *
+ * Each slot carries the number of the sample it holds. The sampler marks the
+ * slot invalid, writes the sample, then publishes its number and the ring head
+ * (release). A reader copies a slot and accepts it only if the number is the
+ * one it expected both before and after the copy, so a slot overwritten while
+ * being read is detected instead of returned half old, half new.
+ *
+ * Environment:
+ *   SERVO_TELEMETRY_HZ     sample rate, telemetry is off if unset
+ *   SERVO_TELEMETRY_PATH   shared memory file, /dev/shm/servoTelemetry if unset
+ *
+ * The sampler runs on its own thread, build with -pthread.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "servoBackend.h"
+#include "servoJoints.h"
+#include "servoTick.h"
+
+
+/************ TELEMETRY CONSTANTS ************/
+
+/** file magic and version */
+#define TELEM_MAGIC 0x4D4C4554 /* "TELM" */
+#define TELEM_VERSION 1
+
+/** samples kept (power of 2) */
+#define TELEM_RING_LEN 8192
+
+/** shared memory file if SERVO_TELEMETRY_PATH is not set */
+#define TELEM_DEFAULT_PATH "/dev/shm/servoTelemetry"
+
+/** highest sample rate, Hz */
+#define TELEM_MAX_HZ 100000
+
+
+/************ TELEMETRY TYPES ************/
+
+/**
+ * one sample of the servo registers
+ */
+typedef struct {
+	unsigned long long seq;            /// sample number + 1, 0 while being written
+	unsigned long long t_ns;           /// CLOCK_MONOTONIC time of the read
+	unsigned int regs[JOINT_COUNT];    /// register values, Base .. Gripper
+} tTelemSample;
+
+/**
+ * layout of the shared memory file
+ */
+typedef struct {
+	unsigned int magic;                    /// TELEM_MAGIC
+	unsigned short version;                /// TELEM_VERSION
+	unsigned short joints;                 /// JOINT_COUNT
+	unsigned int ringLen;                  /// TELEM_RING_LEN
+	unsigned int period_ns;                /// sample period
+	unsigned long long head;               /// samples written, next slot is head % ringLen
+	unsigned long long overruns;           /// sample periods missed by the sampler
+	tTelemSample ring[TELEM_RING_LEN];     /// most recent samples
+} tTelemShm;
+
+/**
+ * sampler (writer) or monitor (reader) end of the telemetry
+ */
+typedef struct {
+	tTelemShm *shm;             /// mapped file, NULL if telemetry is off
+	tServoBackend *backend;     /// registers sampled (sampler only)
+	pthread_t thread;           /// sampler thread
+	volatile int stop;          /// ends the sampler thread
+} tTelemetry;
+
+
+/************ TELEMETRY FUNCTIONS ************/
+
+/**
+ * shared memory file name
+ */
+static inline const char *telem_path(void)
+{
+	const char *path = getenv("SERVO_TELEMETRY_PATH");
+	return path != NULL ? path : TELEM_DEFAULT_PATH;
+}
+
+/**
+ * map the shared memory file
+ * @param writable		1: sampler, creates and sizes the file; 0: monitor
+ * @return 0 on success, != 0 otherwise
+ */
+static inline int telem_map(tTelemetry *tm, int writable)
+{
+	const char *path = telem_path();
+	int fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+
+	if (fd == -1 || (writable && ftruncate(fd, sizeof(tTelemShm)) != 0)) {
+		printf("Could not open telemetry '%s'\n", path);
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	tm->shm = (tTelemShm *)mmap(NULL, sizeof(tTelemShm), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (tm->shm == MAP_FAILED) {
+		perror("Mapping telemetry failed");
+		tm->shm = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Take one sample of the servo registers
+ */
+static inline void telem_sample(tTelemetry *tm)
+{
+	tTelemShm *shm = tm->shm;
+	unsigned long long n = shm->head;
+	tTelemSample *s = &shm->ring[n & (TELEM_RING_LEN - 1)];
+
+	__atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+	// the invalid mark has to land before any of the new data
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->t_ns = servo_nowNs();
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		s->regs[j] = tm->backend->read(tm->backend, gJoints[j].offset);
+	}
+	__atomic_store_n(&s->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&shm->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * sampler thread: one sample per period
+ */
+static inline void *telem_thread(void *arg)
+{
+	tTelemetry *tm = (tTelemetry *)arg;
+	tTick tick;
+
+	tick_start(&tick, tm->shm->period_ns);
+	while (!tm->stop) {
+		tm->shm->overruns += tick_wait(&tick);
+		telem_sample(tm);
+	}
+	return NULL;
+}
+
+/**
+ * Start sampling the registers if SERVO_TELEMETRY_HZ is set
+ * @param be			backend the registers are read through
+ * @return 0 on success or if telemetry is off, != 0 otherwise
+ */
+static inline int telem_start(tTelemetry *tm, tServoBackend *be)
+{
+	const char *hz = getenv("SERVO_TELEMETRY_HZ");
+
+	memset(tm, 0, sizeof(*tm));
+	if (hz == NULL) {
+		return 0;
+	}
+	int rate = atoi(hz);
+	if (rate < 1 || rate > TELEM_MAX_HZ) {
+		printf("SERVO_TELEMETRY_HZ must be 1 .. %d\n", TELEM_MAX_HZ);
+		return -1;
+	}
+	if (telem_map(tm, 1) != 0) {
+		return -1;
+	}
+
+	// a fresh ring, monitors attached to an older run start over
+	memset(tm->shm, 0, sizeof(tTelemShm));
+	tm->shm->magic = TELEM_MAGIC;
+	tm->shm->version = TELEM_VERSION;
+	tm->shm->joints = JOINT_COUNT;
+	tm->shm->ringLen = TELEM_RING_LEN;
+	tm->shm->period_ns = NSEC_PER_SEC / rate;
+	tm->backend = be;
+
+	if (pthread_create(&tm->thread, NULL, telem_thread, tm) != 0) {
+		printf("Could not start telemetry thread\n");
+		munmap(tm->shm, sizeof(tTelemShm));
+		tm->shm = NULL;
+		return -1;
+	}
+	printf("Telemetry: %d Hz into '%s'\n", rate, telem_path());
+	return 0;
+}
+
+/**
+ * Stop sampling, the file stays for monitors to read
+ */
+static inline void telem_stop(tTelemetry *tm)
+{
+	if (tm->shm == NULL) {
+		return;
+	}
+	tm->stop = 1;
+	pthread_join(tm->thread, NULL);
+	munmap(tm->shm, sizeof(tTelemShm));
+	tm->shm = NULL;
+}
+
+/**
+ * Attach a monitor to the telemetry of a running program
+ * @return 0 on success, != 0 otherwise
+ */
+static inline int telem_attach(tTelemetry *tm)
+{
+	memset(tm, 0, sizeof(*tm));
+	if (telem_map(tm, 0) != 0) {
+		return -1;
+	}
+	if (tm->shm->magic != TELEM_MAGIC || tm->shm->version != TELEM_VERSION
+	 || tm->shm->joints != JOINT_COUNT || tm->shm->ringLen != TELEM_RING_LEN) {
+		printf("'%s' holds no telemetry of this version\n", telem_path());
+		munmap(tm->shm, sizeof(tTelemShm));
+		tm->shm = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Release a monitor
+ */
+static inline void telem_detach(tTelemetry *tm)
+{
+	if (tm->shm != NULL) {
+		munmap(tm->shm, sizeof(tTelemShm));
+		tm->shm = NULL;
+	}
+}
+
+/**
+ * number of samples written so far
+ */
+static inline unsigned long long telem_head(const tTelemetry *tm)
+{
+	return __atomic_load_n(&tm->shm->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Read one sample
+ * @param n				sample number, below telem_head()
+ * @param out			receives the sample
+ * @return 0 on success, != 0 if it was overwritten already (or just now)
+ */
+static inline int telem_read(const tTelemetry *tm, unsigned long long n, tTelemSample *out)
+{
+	const tTelemSample *s = &tm->shm->ring[n & (TELEM_RING_LEN - 1)];
+
+	if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != n + 1) {
+		return -1;
+	}
+	out->t_ns = s->t_ns;
+	memcpy(out->regs, s->regs, sizeof(out->regs));
+	// the copy has to be complete before the number is checked again
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != n + 1) {
+		return -1;
+	}
+	out->seq = n + 1;
+	return 0;
+}
+
+#endif /* TELEMETRY_H */
@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include "reactor.h"
+
 
 /************ constants ****************/
 
@@ -101,6 +103,16 @@ typedef struct {
 tWiiMote gWiiMote;
 
 
+/**
+ * printing state shared by the reactor handlers
+ */
+typedef struct {
+	tReactor reactor;     /// input reactor (event0, event2)
+	unsigned char accelX; /// print X acceleration
+	unsigned char accelY; /// print Y acceleration
+} tSkel;
+
+
 /************ functions ****************/
 
 /**
@@ -121,8 +133,8 @@ int wiimote_init(void){
 	}
 
 
-	// open file for accelerometer -- blocking
-	gWiiMote.fileEvt0 = open(WIIMOTE_EVT0_FNAME , O_RDONLY); //Opens the event2 file in read only mode
+	// open file for accelerometer -- non blocking as well, the reactor tells us when data is there
+	gWiiMote.fileEvt0 = open(WIIMOTE_EVT0_FNAME , O_RDONLY | O_NONBLOCK); //Opens the event0 file in read only mode
 
 	// failed to open file?
 	if (gWiiMote.fileEvt0  == -1) {
@@ -190,7 +202,7 @@ tWiiMoteButton wiimote_buttonGet(){
 
 /**
  * get acceleration events from wiimote
- * @return acceleration event
+ * @return acceleration event, code 0 if none available
  */
 tWiiMoteAccel wiimote_accelGet() {
 	unsigned char buf[WIIMOTE_EVT0_PKT_SIZE]; //each packet of data is 16 bytes
@@ -201,7 +213,10 @@ tWiiMoteAccel wiimote_accelGet() {
 	accel.code = 0; // start out with nothing received
 
 	// read 16 bytes from the file and put it in the buffer
-	read(gWiiMote.fileEvt0, buf, WIIMOTE_EVT0_PKT_SIZE);
+	// (non blocking, nothing received if no complete packet is available)
+	if (read(gWiiMote.fileEvt0, buf, WIIMOTE_EVT0_PKT_SIZE) != WIIMOTE_EVT0_PKT_SIZE) {
+		return accel;
+	}
 
 	accel.code = buf[WIIMOTE_EVT0_CODE];       // extract code byte
 
@@ -226,53 +241,72 @@ void wiimote_close() {
 }
 
 
+/**
+ * event0 readable: print the acceleration if enabled
+ */
+void skel_onAccel(int fd, void *ctx) {
+	tSkel *skel = (tSkel *)ctx;
+	tWiiMoteAccel accel = wiimote_accelGet();
+
+	// did we get an accel event?
+	if (accel.code != 0) { // ignore the zeroes
+		if( (skel->accelX && accel.code == WIIMOTE_EVT0_ACCEL_X)
+		 || (skel->accelY && accel.code == WIIMOTE_EVT0_ACCEL_Y ) ) {
+			//print content
+			printf("code: %X, value %d\n", accel.code, accel.value);
+		}
+	}
+}
+
+/**
+ * event2 readable: toggle printing, quit on "Home"
+ */
+void skel_onButton(int fd, void *ctx) {
+	tSkel *skel = (tSkel *)ctx;
+	tWiiMoteButton button = wiimote_buttonGet();
+
+	switch (button.code) {
+	case 0: // nothing received
+		break;
+	case PLUS: // - key
+		// enable / disable printing of X accel depending on if pushed / released
+		skel->accelX = button.value;
+		break;
+	case MINUS: // + key
+		// enable / disable printing of X accel depending on if pushed / released
+		skel->accelY = button.value;
+		break;
+	case HOME: // stop on "Home" button pressed (or relased)
+		skel->reactor.stop = 1;
+		break;
+	default:
+		break;
+	}
+}
+
+
 /**
  * Main function
  * @return 0 upon success, -1 on error
  */
 int main(int argc, char* argv[]) {
-	tWiiMoteButton button;
-	tWiiMoteAccel accel;
-	unsigned char accelX =0;
-	unsigned char accelY =0;
+	tSkel skel = {0};
 
 	if (wiimote_init() != 0) {
 		printf("Failed to init WiiMote\n");
 		return -1;
 	}
 
-
-	do {
-		// read acceleration (blocking)
-		accel = wiimote_accelGet();
-		// read button events that have accumulated since then.
-		button = wiimote_buttonGet();
-
-		// did we get an accel event?
-		if (accel.code != 0) { // ignore the zeroes
-			if( (accelX && accel.code == WIIMOTE_EVT0_ACCEL_X)
-			 || (accelY && accel.code == WIIMOTE_EVT0_ACCEL_Y ) ) {
-				//print content
-				printf("code: %X, value %d\n", accel.code, accel.value);
-			}
-		}
-
-		switch (button.code) {
-		case 0: // nothing received
-			break;
-		case PLUS: // - key
-			// enable / disable printing of X accel depending on if pushed / released
-			accelX = button.value;
-			break;
-		case MINUS: // + key
-			// enable / disable printing of X accel depending on if pushed / released
-			accelY = button.value;
-			break;
-		}
-
+	// handle accel and button events in the order they arrive
+	if (reactor_init(&skel.reactor) != 0
+	 || reactor_add(&skel.reactor, gWiiMote.fileEvt0, skel_onAccel, &skel) != 0
+	 || reactor_add(&skel.reactor, gWiiMote.fileEvt2, skel_onButton, &skel) != 0) {
+		return -1;
+	}
 
 	// repeat until "Home" button is pressed (or relased)
-	} while(button.code != HOME);
+	reactor_run(&skel.reactor);
+	reactor_close(&skel.reactor);
 
 	wiimote_close();
 	return 0;
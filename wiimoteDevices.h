@@ -0,0 +1,251 @@
+/**
+ * WiiMote input device discovery and hotplug
+ *
+ * The kernel driver (hid-wiimote) gives every Wii Remote several event
+ * devices under /dev/input, numbered in whatever order they appeared. Instead
+ * of fixed eventN names, devices are matched by what they are: the name
+ * (EVIOCGNAME) has to start with the WiiMote name, and the capabilities
+ * (EVIOCGBIT) tell the accelerometer (ABS_RX, ABS_RY, ABS_RZ, no keys) from
+ * the buttons (BTN_A, no axes). The Motion Plus gyro reports the same three
+ * axes, it is told apart by their range (EVIOCGABS): about +-500 on the
+ * accelerometer, +-16000 on the gyro. Nunchuk, Motion Plus and Pro Controller
+ * are left alone that way. Both devices of one remote carry the same unique id
+ * (EVIOCGUNIQ, the Bluetooth address), which pairs them.
+ *
+ * Hotplug: an inotify watch on /dev/input reports every new event node. It is
+ * probed once it is created and again when udev has set its permissions, a
+ * remote that reconnects is back within milliseconds. Removal needs no watch,
+ * the event file of a disconnected device reports a hangup.
+ */
+#ifndef WIIMOTE_DEVICES_H
+#define WIIMOTE_DEVICES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+
+/************ DEVICE CONSTANTS ************/
+
+/** directory of the event device nodes */
+#define WIIDEV_DIR "/dev/input"
+
+/** name prefix of the WiiMote devices, WIIMOTE_DEVICE overrides it */
+#define WIIDEV_NAME "Nintendo Wii Remote"
+
+/** widest axis range of the accelerometer, the Motion Plus gyro is far wider */
+#define WIIDEV_ACCEL_MAX_RANGE 1000
+
+/** room for names and unique ids */
+#define WIIDEV_ID_LEN 64
+
+/** room for a device node path, the directory and any entry name */
+#define WIIDEV_PATH_LEN (sizeof(WIIDEV_DIR) + 256)
+
+/** bits in an unsigned long */
+#define WIIDEV_LONG_BITS (8 * sizeof(unsigned long))
+
+/** test a bit of an EVIOCGBIT mask */
+#define WIIDEV_TEST_BIT(bits, n) (((bits)[(n) / WIIDEV_LONG_BITS] >> ((n) % WIIDEV_LONG_BITS)) & 1)
+
+
+/************ DEVICE TYPES ************/
+
+/**
+ * what an event device is to us
+ */
+typedef enum {
+	WIIDEV_OTHER = 0,   /// not a WiiMote device
+	WIIDEV_ACCEL,       /// WiiMote accelerometer
+	WIIDEV_BUTTONS      /// WiiMote buttons
+} tWiiDevKind;
+
+/**
+ * probed event device
+ */
+typedef struct {
+	tWiiDevKind kind;               /// accelerometer, buttons or other
+	char path[WIIDEV_PATH_LEN];     /// device node
+	char name[WIIDEV_ID_LEN];       /// device name
+	char id[WIIDEV_ID_LEN];         /// unique id, the physical path if the driver sets none
+	dev_t rdev;                     /// device number, tells a node already open
+} tWiiDevInfo;
+
+/**
+ * called for every event node found
+ * @param path			device node
+ * @param ctx			context given to the scan or the watch
+ */
+typedef void (*tWiiDevFound)(const char *path, void *ctx);
+
+/**
+ * hotplug watch on the device directory
+ */
+typedef struct {
+	int fd;                         /// inotify instance, -1 if not watching
+} tWiiDevWatch;
+
+
+/************ DEVICE FUNCTIONS ************/
+
+/**
+ * Check if a directory entry is an event device node
+ * @return 1 for eventN, 0 otherwise
+ */
+static inline int wiidev_isEvent(const char *name)
+{
+	return strncmp(name, "event", 5) == 0 && name[5] >= '0' && name[5] <= '9';
+}
+
+/**
+ * Open and classify an event device
+ * @param path			device node
+ * @param info			receives what the device is
+ * @return open non-blocking file descriptor of a WiiMote device, -1 for any other
+ * device or if it cannot be opened (yet)
+ */
+static inline int wiidev_probe(const char *path, tWiiDevInfo *info)
+{
+	unsigned long abs[ABS_MAX / WIIDEV_LONG_BITS + 1];
+	unsigned long key[KEY_MAX / WIIDEV_LONG_BITS + 1];
+	const char *prefix = getenv("WIIMOTE_DEVICE");
+	struct input_absinfo range;
+	struct stat st;
+
+	memset(info, 0, sizeof(*info));
+	snprintf(info->path, sizeof(info->path), "%s", path);
+	prefix = prefix != NULL ? prefix : WIIDEV_NAME;
+
+	int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || ioctl(fd, EVIOCGNAME(sizeof(info->name) - 1), info->name) < 0
+	 || strncmp(info->name, prefix, strlen(prefix)) != 0) {
+		close(fd);
+		return -1;
+	}
+	info->rdev = st.st_rdev;
+	if (ioctl(fd, EVIOCGUNIQ(sizeof(info->id) - 1), info->id) <= 1) {
+		memset(info->id, 0, sizeof(info->id));
+		ioctl(fd, EVIOCGPHYS(sizeof(info->id) - 1), info->id);
+	}
+
+	memset(abs, 0, sizeof(abs));
+	memset(key, 0, sizeof(key));
+	ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs);
+	ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key)), key);
+	int hasKeys = 0, hasAxes = 0;
+	for (size_t i = 0; i < sizeof(key) / sizeof(key[0]); ++i) {
+		hasKeys |= key[i] != 0;
+	}
+	for (size_t i = 0; i < sizeof(abs) / sizeof(abs[0]); ++i) {
+		hasAxes |= abs[i] != 0;
+	}
+
+	memset(&range, 0, sizeof(range));
+	ioctl(fd, EVIOCGABS(ABS_RX), &range);
+
+	if (!hasKeys && WIIDEV_TEST_BIT(abs, ABS_RX) && WIIDEV_TEST_BIT(abs, ABS_RY) && WIIDEV_TEST_BIT(abs, ABS_RZ)
+	 && range.maximum <= WIIDEV_ACCEL_MAX_RANGE) {
+		// the accelerometer, not the Motion Plus gyro with the same axes
+		info->kind = WIIDEV_ACCEL;
+	} else if (!hasAxes && WIIDEV_TEST_BIT(key, BTN_A)) {
+		info->kind = WIIDEV_BUTTONS;
+	} else {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Report every event node present now
+ * @param found			called per node
+ * @param ctx			passed to found
+ * @return 0 on success, != 0 if the directory cannot be read
+ */
+static inline int wiidev_scan(tWiiDevFound found, void *ctx)
+{
+	char path[WIIDEV_PATH_LEN];
+	struct dirent *ent;
+
+	DIR *dir = opendir(WIIDEV_DIR);
+	if (dir == NULL) {
+		printf("Could not read '%s'\n", WIIDEV_DIR);
+		return -1;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		if (wiidev_isEvent(ent->d_name)) {
+			snprintf(path, sizeof(path), "%s/%s", WIIDEV_DIR, ent->d_name);
+			found(path, ctx);
+		}
+	}
+	closedir(dir);
+	return 0;
+}
+
+/**
+ * Start watching the device directory for new nodes, before the first scan
+ * so no device slips through between the two
+ * @return 0 on success, != 0 otherwise
+ */
+static inline int wiidev_watchOpen(tWiiDevWatch *w)
+{
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd == -1) {
+		perror("Could not create inotify instance");
+		return -1;
+	}
+	// created, or its permissions set by udev after it could not be opened yet
+	if (inotify_add_watch(w->fd, WIIDEV_DIR, IN_CREATE | IN_ATTRIB) == -1) {
+		perror("Could not watch " WIIDEV_DIR);
+		close(w->fd);
+		w->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Report the event nodes that appeared or changed, call when the watch is readable
+ * @param found			called per node, may see a node more than once
+ * @param ctx			passed to found
+ */
+static inline void wiidev_watchRead(tWiiDevWatch *w, tWiiDevFound found, void *ctx)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char path[WIIDEV_PATH_LEN];
+	ssize_t len;
+
+	while ((len = read(w->fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			if (ev->len > 0 && wiidev_isEvent(ev->name)) {
+				snprintf(path, sizeof(path), "%s/%s", WIIDEV_DIR, ev->name);
+				found(path, ctx);
+			}
+		}
+	}
+}
+
+/**
+ * Stop watching
+ */
+static inline void wiidev_watchClose(tWiiDevWatch *w)
+{
+	if (w->fd != -1) {
+		close(w->fd);
+		w->fd = -1;
+	}
+}
+
+#endif /* WIIMOTE_DEVICES_H */
@@ -0,0 +1,333 @@
+/**
+ * Binary record / replay of WiiMote input sessions
+ *
+ * Recording appends every input event read from the WiiMote event files, with
+ * its kernel time stamp, to a compact binary log (16 bytes per event).
+ *
+ * Replay memory maps such a log and feeds the events into pipes that stand in
+ * for the event files, so the program parses them exactly like live input.
+ * Events are delivered either at their original spacing, stamped with the
+ * delivery time like the kernel would, or as fast as the reader takes them,
+ * keeping their recorded time stamps so the consumer can run on the recorded
+ * time line. After the last event a "Home" press is injected so the control
+ * loop terminates.
+ *
+ * Programs using it have to be built with -pthread.
+ */
+#ifndef WIIMOTE_LOG_H
+#define WIIMOTE_LOG_H
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+
+/************ LOG CONSTANTS ************/
+
+/** file magic and version */
+#define WIILOG_MAGIC "WIIL"
+#define WIILOG_VERSION 1
+
+/** source device ids in a record */
+#define WIILOG_DEV_EVT0 0
+#define WIILOG_DEV_EVT2 2
+
+/** key code injected at the end of a replay ("Home") */
+#define WIILOG_HOME_CODE 0x13C
+
+
+/************ LOG TYPES ************/
+
+/**
+ * log file header
+ */
+typedef struct {
+	char magic[4];        /// WIILOG_MAGIC
+	unsigned int version; /// WIILOG_VERSION
+} tWiiLogHeader;
+
+/**
+ * one recorded input event
+ */
+typedef struct {
+	unsigned long long t_ns; /// kernel time stamp in ns
+	unsigned char dev;       /// source event file (WIILOG_DEV_*)
+	unsigned char type;      /// input event type
+	unsigned short code;     /// input event code
+	int value;               /// input event value
+} tWiiLogRecord;
+
+/**
+ * recorder
+ */
+typedef struct {
+	FILE *file;               /// log file, NULL if not recording
+	unsigned long long count; /// events recorded
+} tWiiLog;
+
+/**
+ * replay source
+ */
+typedef struct {
+	const tWiiLogRecord *records; /// mapped records
+	size_t count;                 /// number of records
+	void *map;                    /// mapping of the whole file
+	size_t mapLen;                /// size of the mapping
+	int fast;                     /// 1: as fast as possible, 0: original timing
+	int pipeEvt0[2];              /// stands in for event0
+	int pipeEvt2[2];              /// stands in for event2
+	pthread_t thread;             /// feeding thread
+	int running;                  /// feeding thread started
+	volatile int stop;            /// set to end the replay early
+} tWiiReplay;
+
+
+/************ LOG FUNCTIONS ************/
+
+/**
+ * Open a log for appending, writes the header to a new file
+ * @param path			log file name
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int wiilog_open(tWiiLog *log, const char *path)
+{
+	tWiiLogHeader header = {{'W', 'I', 'I', 'L'}, WIILOG_VERSION};
+
+	log->count = 0;
+	log->file = fopen(path, "ab");
+	if (log->file == NULL) {
+		printf("Could not open log file '%s'\n", path);
+		return -1;
+	}
+	if (ftell(log->file) == 0) {
+		fwrite(&header, sizeof(header), 1, log->file);
+	}
+	return 0;
+}
+
+/**
+ * Append one input event
+ * @param dev			source event file (WIILOG_DEV_*)
+ * @param evt			event as read from the event file
+ */
+static inline void wiilog_record(tWiiLog *log, unsigned char dev, const struct input_event *evt)
+{
+	tWiiLogRecord rec;
+
+	if (log->file == NULL) {
+		return;
+	}
+	rec.t_ns = (unsigned long long)evt->time.tv_sec * 1000000000ULL + evt->time.tv_usec * 1000ULL;
+	rec.dev = dev;
+	rec.type = (unsigned char)evt->type;
+	rec.code = evt->code;
+	rec.value = evt->value;
+	fwrite(&rec, sizeof(rec), 1, log->file);
+	log->count++;
+}
+
+/**
+ * Close the log
+ */
+static inline void wiilog_close(tWiiLog *log)
+{
+	if (log->file != NULL) {
+		fclose(log->file);
+		log->file = NULL;
+	}
+}
+
+/**
+ * write one event into the pipe standing in for its event file
+ * @param t_ns			time stamp to put into the event
+ * @return 0 on success, != 0 if the reader is gone
+ */
+static inline int wiireplay_emit(tWiiReplay *rp, unsigned char dev, unsigned short type,
+		unsigned short code, int value, unsigned long long t_ns)
+{
+	struct input_event evt;
+	int fd = (dev == WIILOG_DEV_EVT2) ? rp->pipeEvt2[1] : rp->pipeEvt0[1];
+
+	memset(&evt, 0, sizeof(evt));
+	evt.time.tv_sec = t_ns / 1000000000ULL;
+	evt.time.tv_usec = (t_ns % 1000000000ULL) / 1000;
+	evt.type = type;
+	evt.code = code;
+	evt.value = value;
+	return write(fd, &evt, sizeof(evt)) == sizeof(evt) ? 0 : -1;
+}
+
+/**
+ * wait until the reader has taken everything written to one pipe
+ * @param dev			source device of the pipe (WIILOG_DEV_*)
+ */
+static inline void wiireplay_drain(tWiiReplay *rp, unsigned char dev)
+{
+	int fd = (dev == WIILOG_DEV_EVT2) ? rp->pipeEvt2[0] : rp->pipeEvt0[0];
+	int pending;
+
+	while (!rp->stop && ioctl(fd, FIONREAD, &pending) == 0 && pending > 0) {
+		sched_yield();
+	}
+}
+
+/**
+ * replay thread: feed all records, then press "Home"
+ */
+static inline void *wiireplay_thread(void *arg)
+{
+	tWiiReplay *rp = (tWiiReplay *)arg;
+	struct timespec start, due, now;
+	unsigned long long t_ns = 0;
+	sigset_t pipeSig;
+
+	// a write to a pipe whose reader is gone must fail with EPIPE, not kill the
+	// program; SIGPIPE goes to the writing thread, so blocking it here is enough
+	sigemptyset(&pipeSig);
+	sigaddset(&pipeSig, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipeSig, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < rp->count && !rp->stop; ++i) {
+		const tWiiLogRecord *rec = &rp->records[i];
+
+		if (!rp->fast) {
+			// keep the original spacing relative to the first event
+			unsigned long long offset = rec->t_ns - rp->records[0].t_ns;
+			due = start;
+			due.tv_sec += offset / 1000000000ULL;
+			due.tv_nsec += offset % 1000000000ULL;
+			if (due.tv_nsec >= 1000000000L) {
+				due.tv_nsec -= 1000000000L;
+				due.tv_sec++;
+			}
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+				;
+		}
+
+		if (rp->fast) {
+			t_ns = rec->t_ns;
+		} else {
+			// stamp with the delivery time, like the kernel would
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			t_ns = (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+		}
+		if (wiireplay_emit(rp, rec->dev, rec->type, rec->code, rec->value, t_ns) != 0) {
+			return NULL;
+		}
+
+		// the reader collapses frames it finds queued up and picks whichever pipe it
+		// likes, hand over one frame at a time to keep every frame and their order
+		if (rp->fast && rec->type == EV_SYN) {
+			wiireplay_drain(rp, rec->dev);
+		}
+	}
+
+	// end of session: "Home" so the program terminates
+	if (!rp->fast) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		t_ns = (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	}
+	wiireplay_emit(rp, WIILOG_DEV_EVT2, EV_KEY, WIILOG_HOME_CODE, 1, t_ns);
+	wiireplay_emit(rp, WIILOG_DEV_EVT2, EV_SYN, SYN_REPORT, 0, t_ns);
+	return NULL;
+}
+
+/**
+ * Open a log for replay, events are fed once wiireplay_start() is called
+ * @param path			log file name
+ * @param fast			1: as fast as possible, 0: original timing
+ * @param fileEvt0		receives the descriptor standing in for event0 (non blocking)
+ * @param fileEvt2		receives the descriptor standing in for event2 (non blocking)
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int wiireplay_open(tWiiReplay *rp, const char *path, int fast, int *fileEvt0, int *fileEvt2)
+{
+	struct stat st;
+	const tWiiLogHeader *header;
+
+	memset(rp, 0, sizeof(*rp));
+	rp->fast = fast;
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(tWiiLogHeader)) {
+		printf("Could not open log file '%s'\n", path);
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	rp->mapLen = st.st_size;
+	rp->map = mmap(NULL, rp->mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (rp->map == MAP_FAILED) {
+		perror("Mapping log file failed");
+		return -1;
+	}
+
+	header = (const tWiiLogHeader *)rp->map;
+	if (memcmp(header->magic, WIILOG_MAGIC, 4) != 0 || header->version != WIILOG_VERSION) {
+		printf("'%s' is not a WiiMote log\n", path);
+		munmap(rp->map, rp->mapLen);
+		return -1;
+	}
+	rp->records = (const tWiiLogRecord *)(header + 1);
+	rp->count = (rp->mapLen - sizeof(*header)) / sizeof(tWiiLogRecord);
+	madvise(rp->map, rp->mapLen, MADV_SEQUENTIAL);
+
+	if (pipe(rp->pipeEvt0) != 0 || pipe(rp->pipeEvt2) != 0) {
+		perror("Could not create replay pipes");
+		munmap(rp->map, rp->mapLen);
+		return -1;
+	}
+	// readers are non blocking like the event files, the feeding side blocks when the pipe is full
+	fcntl(rp->pipeEvt0[0], F_SETFL, O_NONBLOCK);
+	fcntl(rp->pipeEvt2[0], F_SETFL, O_NONBLOCK);
+	*fileEvt0 = rp->pipeEvt0[0];
+	*fileEvt2 = rp->pipeEvt2[0];
+	return 0;
+}
+
+/**
+ * Start feeding the events, call once the reader is ready for them
+ * @return 0 on success, != 0 otherwise.
+ */
+static inline int wiireplay_start(tWiiReplay *rp)
+{
+	if (pthread_create(&rp->thread, NULL, wiireplay_thread, rp) != 0) {
+		printf("Failed to start replay thread\n");
+		return -1;
+	}
+	rp->running = 1;
+	return 0;
+}
+
+/**
+ * Stop the replay and release it. The descriptors standing in for the event files are closed too.
+ */
+static inline void wiireplay_stop(tWiiReplay *rp)
+{
+	rp->stop = 1;
+	// the feeding thread may be waiting for the next event time or on a full pipe
+	if (rp->running) {
+		pthread_cancel(rp->thread);
+		pthread_join(rp->thread, NULL);
+	}
+	close(rp->pipeEvt0[0]);
+	close(rp->pipeEvt2[0]);
+	close(rp->pipeEvt0[1]);
+	close(rp->pipeEvt2[1]);
+	munmap(rp->map, rp->mapLen);
+}
+
+#endif /* WIIMOTE_LOG_H */
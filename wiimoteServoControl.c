@@ -1,6 +1,36 @@
 /**
  * Template for Servo Control from FPGA with Hardware Controlled Speed
  *
+ * WiiMote input runs on its own thread, build with -pthread -lm.
+ *
+ * Buttons A, B, 1, 2 and Down select Base, Bicep, Elbow, Wrist and Gripper,
+ * tilting moves the selected joint while its button is held. "+" switches to
+ * Cartesian mode: holding A tilting moves the gripper forward / back and left /
+ * right, holding B up / down, all joints follow. "Home" quits.
+ *
+ * WiiMotes are found by name and capabilities (wiimoteDevices.h), not by
+ * their /dev/input/eventN numbers, and may connect, disconnect and reconnect
+ * at any time while the arm keeps its pose. Up to WIIMOTE_MAX_REMOTES can be
+ * connected at once: the remote whose button was pressed last is in control,
+ * another one takes over once no selection button is held.
+ *
+ * Gestures (gesture.h) work while no selection button is held: shake switches
+ * between joint and Cartesian mode like "+", twist stores the current pose and
+ * flick moves the arm back to the stored pose (home until one is stored). Only
+ * the mode changes work from an idle remote; a flick moves the arm only while
+ * "-" is held, motion that is no gesture is taken for one now and then.
+ *
+ * Environment:
+ *   SERVO_BACKEND        devmem (default), sim or null, see servoBackend.h
+ *   WIIMOTE_DEVICE       name prefix of the WiiMote input devices (default "Nintendo Wii Remote")
+ *   WIIMOTE_RECORD       append all WiiMote input events to this log file
+ *   WIIMOTE_REPLAY       read input from this log file instead of the WiiMote
+ *   WIIMOTE_REPLAY_FAST  if set, replay as fast as possible instead of original timing,
+ *                        the control loop then ticks on the recorded time line
+ *   WIIMOTE_FILTER       accelerometer filter: none, ema, oneeuro (default) or kalman
+ *   WIIMOTE_GESTURES     0 turns the gesture recognizer off
+ *   SERVO_RT_PRIO        real-time mode for the control thread, see rtMode.h
+ *   SERVO_RT_CPU         CPU the control thread is pinned to in real-time mode
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,42 +41,51 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <linux/input.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+
+#include "servoBackend.h"
+#include "servoShadow.h"
+#include "servoTick.h"
+#include "reactor.h"
+#include "spscRing.h"
+#include "latencyHist.h"
+#include "wiimoteLog.h"
+#include "wiimoteDevices.h"
+#include "gesture.h"
+#include "accelFilter.h"
+#include "rtMode.h"
+#include "armKinematics.h"
+#include "servoSafety.h"
+#include "servoJoints.h"
 
 
 /************ SERVO CONSTANTS ************/
 
-#define BASE_ADDRESS 0x400D0000
+/** servo position range commanded from the WiiMote, degree */
+#define SERVO_POSN_MIN 60
+#define SERVO_POSN_MAX 240
 
-//Servo motor offsets
-#define Base_OFFSET 0x100
-#define Bicep_OFFSET 0x104
-#define Elbow_OFFSET 0x108
-#define Wrist_OFFSET 0x10C
-#define Gripper_OFFSET 0x110
+/** filtered tilt that reaches the end of the range, the accelerometer reads about 100 per g */
+#define ACCEL_FULL_TILT 100
 
-#define REG_WRITE(addr, off, val) (*(volatile int*)(addr+off)=(val))
+/** Cartesian mode: tilt ignored around level, gripper speed per count of tilt beyond that in mm/s */
+#define CARTESIAN_DEADBAND 20
+#define CARTESIAN_GAIN 0.5f
 
 
 /************ WIIMOTE CONSTANTS ****************/
 
-/** Event 2 is of 32 chars in size*/
-#define WIIMOTE_EVT2_PKT_SIZE 32
-
-/** device file name for event 2	*/
-#define WIIMOTE_EVT2_FNAME "/dev/input/event2"
-
-/** the code is placed in byte 10 */
-#define WIIMOTE_EVT2_CODE 10
-/** value is placed in byte 12	*/
-#define WIIMOTE_EVT2_VALUE 12
+/** most WiiMotes connected at once */
+#define WIIMOTE_MAX_REMOTES 4
 
 
 /** Event 2 is of 32 chars in size*/
 #define WIIMOTE_EVT0_PKT_SIZE 16
 
-/** device file name for event 2	*/
-#define WIIMOTE_EVT0_FNAME "/dev/input/event0"
-
 /** the code is placed in byte 10 */
 #define WIIMOTE_EVT0_CODE 10
 
@@ -63,6 +102,14 @@
 /** high portion of value is placed in byte 12	*/
 #define WIIMOTE_EVT0_VALUE_L 12
 
+/** number of input events drained from event 0 per read */
+#define WIIMOTE_EVT0_BATCH 64
+
+/** axis bits in tWiiMoteAccelFrame.updated */
+#define WIIMOTE_AXIS_X 0x1
+#define WIIMOTE_AXIS_Y 0x2
+#define WIIMOTE_AXIS_Z 0x4
+
 
 
 /**************** SERVO TYPES ****************/
@@ -71,9 +118,11 @@
  * data structure for servo instance
  */
 typedef struct {
-	unsigned char *test_base; /// base address of mapped virtual space
-	int fd;                   /// file desrcriptor for memory map
-	int map_len;              /// size of mapping window
+	tServoBackend backend;    /// register backend (/dev/mem, simulator or null)
+	tServoShadow shadow;      /// shadow copy of the servo registers
+	int deferWrites;          /// 1: registers only reach the FPGA on servo_flush()
+	unsigned char posn[JOINT_COUNT]; /// last commanded position, index 0 (Base) .. 4 (Gripper)
+	tServoSafety safety;      /// joint limits and collision grid checked on every command
 
 } tServo;
 
@@ -110,6 +159,7 @@ typedef enum {
 typedef struct {
 	buttonCode code;  /// event 2 code
 	unsigned char value; /// event 2 value
+	struct timeval time; /// kernel time stamp of the event
 
 } tWiiMoteButton;
 
@@ -121,33 +171,132 @@ typedef struct {
 	signed short value; /// event  0 value
 } tWiiMoteAccel;
 
+/**
+ * WiiMote accelerometer frame: latest value per axis up to a SYN_REPORT
+ */
+typedef struct {
+	signed short x;        /// X acceleration
+	signed short y;        /// Y acceleration
+	signed short z;        /// Z acceleration
+	unsigned char updated; /// axes changed since the previous frame (WIIMOTE_AXIS_*)
+	unsigned char gesture; /// gesture the frames completed (tGestureId), GESTURE_NONE if none
+	struct timeval time;   /// kernel time stamp of the SYN_REPORT
+} tWiiMoteAccelFrame;
+
+
+/**
+ * one connected (or once connected) WiiMote
+ */
+typedef struct {
+	char id[WIIDEV_ID_LEN]; // unique id pairing its event files, "" if the slot was never used
+	int fileEvt2; // file desriptor for event 2 (buttons), -1 if not connected
+	int fileEvt0; // file descriptor for event 0 (accelerometer), -1 if not connected
+	dev_t devEvt2; // device number of event 2
+	dev_t devEvt0; // device number of event 0
+	tWiiMoteAccelFrame accelPending; // axes received since the last SYN_REPORT
+	tGestureWindow gestures; // recognizer over the accelerometer frames
+} tWiiMoteRemote;
 
 /**
  * structure for WiiMote object
  */
 typedef struct {
-	int fileEvt2; // file desriptor for event 2
-	int fileEvt0; // file descriptor for event 0
+	tWiiMoteRemote remote[WIIMOTE_MAX_REMOTES]; // remotes, a reconnecting one gets its slot back
+	tWiiDevWatch watch;  // hotplug watch on /dev/input, fd -1 when replaying
+	tGestureSet gestures; // gesture templates of all remotes
+	int gesturesOn;      // 1 if gestures are recognized
+	tWiiLog log;         // recording of all events read, if enabled (all remotes)
+	tWiiReplay replay;   // replay source standing in for the event files of remote 0
+	int replaying;       // 1 if input comes from replay
 } tWiiMote;
 
 
-/** instantiate one WiiMote object. It is assumed to be a singleton
- * for this application (i.e. exactly one instance)
+/** instantiate one WiiMote object holding all remotes. It is assumed to be
+ * a singleton for this application (i.e. exactly one instance)
  */
 tWiiMote gWiiMote;
 
 
+/************ CONTROL TYPES ****************/
+
+/**
+ * timestamped input frame passed from the input thread to the control thread
+ */
+typedef struct {
+	unsigned long long t_ns;  /// CLOCK_MONOTONIC receive time
+	int remote;               /// WiiMote the frame came from
+	int lost;                 /// 1: the WiiMote disconnected, no input in the frame
+	tWiiMoteButton button;    /// button event, code 0 if none
+	tWiiMoteAccelFrame accel; /// accelerometer frame, updated == 0 if none
+} tInputFrame;
+
+/**
+ * control state
+ */
+typedef struct {
+	// input thread
+	tReactor reactor;  /// input reactor (event0, event2 of every remote, hotplug)
+	pthread_t input;   /// input thread
+
+	// shared
+	tSpscRing ring;    /// input frames, input thread -> control thread
+	int quit;          /// set by the input thread on "Home"
+	int virtualTime;   /// 1: ticks follow the input time stamps (fast replay), no frame is dropped
+
+	// control thread
+	int remote;        /// WiiMote in control
+	int joint;         /// selected joint (tJointId)
+	int buttonValue;   /// selection button held
+	int armed;         /// "-" held: gestures may move the arm
+	tAccelFilter filter; /// accelerometer filter
+	long position;     /// position from the latest filtered X acceleration
+	int newAccel;      /// X sample arrived since last tick
+	int prevPosn;      /// last commanded position
+	int speed;         /// speed in degree / 20ms
+	int tilt[FILTER_AXES]; /// latest filtered acceleration
+	int cartesian;     /// 1: tilt moves the gripper in x/y/z ("+" toggles)
+	unsigned char storedPose[JOINT_COUNT]; /// pose stored by a twist, a flick moves back to it
+	tIkTarget target;  /// gripper target in Cartesian mode
+	unsigned long long ticks; /// control ticks run
+
+	// latency of the latest X sample, all CLOCK_MONOTONIC ns
+	unsigned long long sampleKernelNs; /// kernel event time stamp
+	unsigned long long sampleRecvNs;   /// received by the input thread
+	tHist latRecv;     /// kernel event -> userspace receive
+	tHist latDecide;   /// userspace receive -> control decision
+	tHist latWrite;    /// control decision -> register written
+	tHist latTotal;    /// kernel event -> register written
+	tHist latTick;     /// control tick wake-up jitter
+	tHist latIk;       /// inverse kinematics solve time
+	unsigned long tickOverruns; /// control ticks missed entirely
+} tControl;
+
+/** set by SIGUSR1 to print the latency statistics */
+volatile sig_atomic_t gDumpStats = 0;
+
+
 /***************** SERVO FUNCTIONS *************/
 
 /**
- * This function takes the servo number and the position, and writes the values in
+ * This function takes the joint and the position, and writes the values in
  * appropriate address for the FPGA
- * @param test_base			base pointer for servos
- * @param servo_number		servo number to manipulate
+ * @param joint				joint to manipulate, JOINT_BASE (0) .. JOINT_GRIPPER
  * @param position			new postion in degree (0 .. 180)
  * @param speed				speed to move in degree / 20ms
  */
-void servo_move(unsigned char servo_number, unsigned char position, unsigned char speed);
+void servo_move(unsigned char joint, unsigned char position, unsigned char speed);
+
+/**
+ * Write all servo registers changed since the last flush to the FPGA
+ */
+void servo_flush();
+
+/**
+ * Move all joints, their registers reach the FPGA in one burst
+ * @param pose				new position per joint, index 0 (Base) .. JOINT_COUNT-1 (Gripper)
+ * @param speed				speed per joint in degree / 20ms
+ */
+void servo_writeAll(const unsigned char pose[JOINT_COUNT], const unsigned char speed[JOINT_COUNT]);
 
 
 /**
@@ -156,88 +305,84 @@ void servo_move(unsigned char servo_number, unsigned char position, unsigned cha
  */
 int servo_init() {
 
-	//Open the file regarding memory mapped IO to write values for the FPGA	
-	gServos.fd = open( "/dev/mem", O_RDWR);
-	
-	unsigned long int PhysicalAddress = BASE_ADDRESS;
-	gServos.map_len= 0xFF;  //size of mapping window
-
-	// map physical memory startin at BASE_ADDRESS into own virtual memory
-	gServos.test_base = (unsigned char*)mmap(NULL, gServos.map_len, PROT_READ | PROT_WRITE, MAP_SHARED, gServos.fd, (off_t)PhysicalAddress);
-
-	// did it work?
-	if(gServos.test_base == MAP_FAILED)	{
-		perror("Mapping memory for absolute memory access failed -- Test Try\n");
+	// open register backend selected by SERVO_BACKEND (default /dev/mem)
+	if (servo_backendOpen(&gServos.backend) != 0) {
 		return 1;
 	}
+	shadow_init(&gServos.shadow);
+	safety_init(&gServos.safety);
+	// the pose is unknown until commanded, check the first move against the home position
+	joint_homePose(gServos.posn);
 
-	//Initialize all servo motors to middle position, go there fast
-	servo_move(0, 150, 100);
-	servo_move(1, 150, 100);
-	servo_move(2, 150, 100);
-	servo_move(3, 150, 100);
-	servo_move(4, 150, 100);
-	servo_move(5, 150, 100);
+	//Initialize all servo motors to home position, go there fast
+	const unsigned char speed[JOINT_COUNT] = {JOINT_HOME_SPEED, JOINT_HOME_SPEED, JOINT_HOME_SPEED,
+			JOINT_HOME_SPEED, JOINT_HOME_SPEED};
+	servo_writeAll(gServos.posn, speed);
 
  	return 0;
 }
 
 
 /**
- * This function takes the servo number and the position, and writes the values in
+ * This function takes the joint and the position, and writes the values in
  * appropriate address for the FPGA
- * @param test_base			base pointer for servos
- * @param servo_number		servo number to manipulate
+ * @param joint				joint to manipulate, JOINT_BASE (0) .. JOINT_GRIPPER
  * @param position			new postion in degree (0 .. 180)
  * @param speed				speed to move in degree / 20ms
  */
-void servo_move(unsigned char servo_number, unsigned char position, unsigned char speed) {
+void servo_move(unsigned char joint, unsigned char position, unsigned char speed) {
 
-	/* writeValue bits 0..7    position
-	 * 			  bits 8..15   speed
-	 * 			  bits 16..31  all 0
-	 */
-	unsigned int writeValue = 0 << 16 | speed << 8 | position;
+	if (joint >= JOINT_COUNT) {
+		return;
+	}
 
-	switch (servo_number) {
-        	case 1:  //Base
-                	REG_WRITE(gServos.test_base, Base_OFFSET, writeValue);
-                	break;
+	// within the joint limits, an unsafe pose keeps the joint where it is
+	position = safety_check(&gServos.safety, gServos.posn, joint, position);
+	gServos.posn[joint] = position;
 
-           	case 2:  //Bicep
-                	REG_WRITE(gServos.test_base, Bicep_OFFSET, writeValue);
-                	break;
+	shadow_set(&gServos.shadow, gJoints[joint].offset, joint_regValue(position, speed));
 
-          	case 3:  //Elbow
-                	REG_WRITE(gServos.test_base, Elbow_OFFSET, writeValue);
-                	break;
+	// write through unless the caller flushes once per tick
+	if (!gServos.deferWrites) {
+		servo_flush();
+	}
+}
 
-           	case 4:  //Wrist
-                	REG_WRITE(gServos.test_base, Wrist_OFFSET, writeValue);
-                	break;
+/**
+ * Write all servo registers changed since the last flush to the FPGA
+ */
+void servo_flush() {
+	shadow_flush(&gServos.shadow, &gServos.backend);
+}
 
-           	case 5:  //Gripper
-                	REG_WRITE(gServos.test_base, Gripper_OFFSET, writeValue);
-                	break;
+/**
+ * Move all joints, their registers reach the FPGA in one burst
+ * @param pose				new position per joint, index 0 (Base) .. JOINT_COUNT-1 (Gripper)
+ * @param speed				speed per joint in degree / 20ms
+ */
+void servo_writeAll(const unsigned char pose[JOINT_COUNT], const unsigned char speed[JOINT_COUNT]) {
+	int deferWrites = gServos.deferWrites;
 
-           	default:
-                	break;
+	gServos.deferWrites = 1;
+	for (int j = 0; j < JOINT_COUNT; ++j) {
+		servo_move(j, pose[j], speed[j]);
 	}
+	servo_flush();
+	gServos.deferWrites = deferWrites;
 }
 
 /**
  * Deinitialize Servos
  */
 void servo_release(){
-  servo_move(0, 150, 100);
-	servo_move(1, 150, 100);
-	servo_move(2, 150, 100);
-	servo_move(3, 150, 100);
-	servo_move(4, 150, 100);
-	servo_move(5, 150, 100);
-	// Releasing the mapping in memory
-	munmap((void *)gServos.test_base, gServos.map_len);
-	close(gServos.fd);
+	unsigned char home[JOINT_COUNT];
+	const unsigned char speed[JOINT_COUNT] = {JOINT_HOME_SPEED, JOINT_HOME_SPEED, JOINT_HOME_SPEED,
+			JOINT_HOME_SPEED, JOINT_HOME_SPEED};
+
+	joint_homePose(home);
+	servo_writeAll(home, speed);
+	// Releasing the register backend
+	gServos.backend.close(&gServos.backend);
 }
 
 
@@ -245,62 +390,214 @@ void servo_release(){
 
 /************ WIIMOTE FUNCTIONS ****************/
 
+/**
+ * Find the remote an event file belongs to
+ * @param fd			file descriptor of event 0 or event 2
+ * @return remote number, -1 if none
+ */
+int wiimote_remoteOf(int fd) {
+	for (int n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+		if (gWiiMote.remote[n].fileEvt0 == fd || gWiiMote.remote[n].fileEvt2 == fd) {
+			return n;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Find the slot for a remote: its own if it was connected before, else one
+ * never used, else one whose remote is gone
+ * @param id			unique id of the remote
+ * @return remote number, -1 if all are in use
+ */
+int wiimote_slot(const char *id) {
+	int unused = -1, gone = -1;
+
+	for (int n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+		const tWiiMoteRemote *rm = &gWiiMote.remote[n];
+		if (rm->id[0] == '\0') {
+			unused = unused == -1 ? n : unused;
+		} else if (strcmp(rm->id, id) == 0) {
+			return n;
+		} else if (rm->fileEvt0 == -1 && rm->fileEvt2 == -1) {
+			gone = gone == -1 ? n : gone;
+		}
+	}
+	return unused != -1 ? unused : gone;
+}
+
+/**
+ * Open an event device if it belongs to a WiiMote and file it with its remote.
+ * A remote that was connected before gets its old number back.
+ * @param path			device node
+ * @return file descriptor (non blocking), -1 if the device is no WiiMote, already open or there is no room
+ */
+int wiimote_attach(const char *path) {
+	tWiiDevInfo info;
+	struct stat st;
+	int n;
+
+	// a node is reported again when udev sets its permissions, keep the one open
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+	for (n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+		const tWiiMoteRemote *rm = &gWiiMote.remote[n];
+		if ((rm->fileEvt0 != -1 && rm->devEvt0 == st.st_rdev) || (rm->fileEvt2 != -1 && rm->devEvt2 == st.st_rdev)) {
+			return -1;
+		}
+	}
+	int fd = wiidev_probe(path, &info);
+	if (fd == -1) {
+		return -1;
+	}
+
+	n = wiimote_slot(info.id);
+	tWiiMoteRemote *rm = n != -1 ? &gWiiMote.remote[n] : NULL;
+	if (rm == NULL || (info.kind == WIIDEV_ACCEL ? rm->fileEvt0 : rm->fileEvt2) != -1) {
+		printf("No room for WiiMote device '%s' (%s)\n", info.name, path);
+		close(fd);
+		return -1;
+	}
+
+	snprintf(rm->id, sizeof(rm->id), "%s", info.id);
+	if (info.kind == WIIDEV_ACCEL) {
+		rm->fileEvt0 = fd;
+		rm->devEvt0 = info.rdev;
+		memset(&rm->accelPending, 0, sizeof(rm->accelPending));
+		gesture_init(&rm->gestures, gWiiMote.gesturesOn ? &gWiiMote.gestures : NULL);
+	} else {
+		rm->fileEvt2 = fd;
+		rm->devEvt2 = info.rdev;
+	}
+
+	// have the kernel stamp events with CLOCK_MONOTONIC so latencies can be measured
+	// (not fatal if unsupported, the latency statistics are just meaningless then)
+	int clockId = CLOCK_MONOTONIC;
+	ioctl(fd, EVIOCSCLOCKID, &clockId);
+
+	printf("WiiMote %d: '%s' connected at %s\n", n + 1, info.name, path);
+	return fd;
+}
+
+/**
+ * Close an event file of a remote whose device is gone
+ * @param fd			file descriptor of event 0 or event 2
+ * @return remote number, -1 if the file belongs to none
+ */
+int wiimote_detach(int fd) {
+	int n = wiimote_remoteOf(fd);
+
+	if (n == -1) {
+		return -1;
+	}
+	tWiiMoteRemote *rm = &gWiiMote.remote[n];
+	printf("WiiMote %d: %s disconnected\n", n + 1, rm->fileEvt0 == fd ? "accelerometer" : "buttons");
+	if (rm->fileEvt0 == fd) {
+		rm->fileEvt0 = -1;
+	} else {
+		rm->fileEvt2 = -1;
+	}
+	close(fd);
+	return n;
+}
+
+/**
+ * device found at start up: attach it if it is a WiiMote
+ */
+void wiimote_onFound(const char *path, void *ctx) {
+	wiimote_attach(path);
+}
+
 /**
  * Initialize WiiMote accelerometer and button read
  * @return 0 on success, != 0 otherwise.
  */
 int wiimote_init(void){
-	//Opens the event2 file in read only mode
-	// also set O_NONBLOCK which makes read calls non blocking, i.e. if less data is available
-	// than asked for, the read call returns and errno is set to EWOULDBLOCK
-	gWiiMote.fileEvt2 = open(WIIMOTE_EVT2_FNAME , O_RDONLY | O_NONBLOCK);
-
-	// failed to open file?
-	if (gWiiMote.fileEvt2 == -1) {
-		// error handling, print error and exit with code
-		printf("Could not open event file '%s'\n", WIIMOTE_EVT2_FNAME);
-		return -1;
+	const char *replayFile = getenv("WIIMOTE_REPLAY");
+	const char *recordFile = getenv("WIIMOTE_RECORD");
+
+	for (int n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+		gWiiMote.remote[n].fileEvt0 = -1;
+		gWiiMote.remote[n].fileEvt2 = -1;
 	}
+	gWiiMote.watch.fd = -1;
 
+	// gestures unless turned off, the templates are shared by all remotes
+	gWiiMote.gesturesOn = getenv("WIIMOTE_GESTURES") == NULL || strcmp(getenv("WIIMOTE_GESTURES"), "0") != 0;
+	if (gWiiMote.gesturesOn) {
+		gesture_build(&gWiiMote.gestures);
+	}
+
+	// replay a recorded session instead of the live WiiMote?
+	if (replayFile != NULL) {
+		gWiiMote.replaying = 1;
+		gesture_init(&gWiiMote.remote[0].gestures, gWiiMote.gesturesOn ? &gWiiMote.gestures : NULL);
+		return wiireplay_open(&gWiiMote.replay, replayFile, getenv("WIIMOTE_REPLAY_FAST") != NULL,
+				&gWiiMote.remote[0].fileEvt0, &gWiiMote.remote[0].fileEvt2);
+	}
 
-	// open file for accelerometer -- blocking
-	gWiiMote.fileEvt0 = open(WIIMOTE_EVT0_FNAME , O_RDONLY); //Opens the event2 file in read only mode
+	// watch before looking, a remote connecting in between is reported by the watch
+	if (wiidev_watchOpen(&gWiiMote.watch) != 0 || wiidev_scan(wiimote_onFound, NULL) != 0) {
+		return -1;
+	}
+	int connected = 0;
+	for (int n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+		connected |= gWiiMote.remote[n].fileEvt0 != -1 || gWiiMote.remote[n].fileEvt2 != -1;
+	}
+	if (!connected) {
+		printf("No WiiMote connected yet, waiting for one\n");
+	}
 
-	// failed to open file?
-	if (gWiiMote.fileEvt0  == -1) {
-		// error handling, print error and exit with code
-		printf("Could not open event file '%s'\n", WIIMOTE_EVT0_FNAME);
+	// record the session?
+	if (recordFile != NULL && wiilog_open(&gWiiMote.log, recordFile) != 0) {
 		return -1;
 	}
 
+	return 0;
+}
 
+/**
+ * Start delivering input, call once somebody is reading the event files.
+ * Only a replay has to be started, the live WiiMote delivers on its own.
+ * @return 0 on success, != 0 otherwise.
+ */
+int wiimote_start(void) {
+	if (gWiiMote.replaying) {
+		return wiireplay_start(&gWiiMote.replay);
+	}
 	return 0;
 }
 
 /**
  * get event codes for wii buttons
- *
+ * @param rm			remote to read
  * @return button even, if no button code detected return (0,0)
  */
-tWiiMoteButton wiimote_buttonGet(){
-	unsigned char buf[WIIMOTE_EVT2_PKT_SIZE]; // allocate data for packet buffer
+tWiiMoteButton wiimote_buttonGet(tWiiMoteRemote *rm){
+	struct input_event evt; // one input event per call
 	tWiiMoteButton button;
 
 	// start out with nothing received
 	button.code = 0;
 	button.value = 0;
+	button.time.tv_sec = 0;
+	button.time.tv_usec = 0;
 
-	// blocking read of  32 bytes from  file and put them into buf
-	// Without O_NONBLOCK read blocks (does not return) until sufficient bytes are available
-	// with O_NONBLOCK read immediately returns even if fewer bytes than asked for are availble, but it sets
-	// errno then.
+	// non blocking read of one event, returns immediately if none is available and sets errno then.
 
-	// only continue if we got all bytes asked for.
-	if (WIIMOTE_EVT2_PKT_SIZE == read(gWiiMote.fileEvt2, buf, WIIMOTE_EVT2_PKT_SIZE)) {
+	// only continue if we got a whole event.
+	if (sizeof(evt) == read(rm->fileEvt2, &evt, sizeof(evt))) {
+		wiilog_record(&gWiiMote.log, WIILOG_DEV_EVT2, &evt);
 
+		// only key events carry buttons (SYN_REPORT follows each one)
+		if (evt.type != EV_KEY) {
+			return button;
+		}
 
-		// extract code from packet and set button.code accordingly
-   switch (buf[WIIMOTE_EVT2_CODE]) {
+		// extract code from event and set button.code accordingly
+		// (the low byte identifies the WiiMote key)
+   switch (evt.code & 0xFF) {
    case 0x30:
         button.code = A;
         break;
@@ -319,12 +616,19 @@ tWiiMoteButton wiimote_buttonGet(){
    case 0x3C:
         button.code = HOME;
         break;
+   case 0x97:
+        button.code = PLUS;
+        break;
+   case 0x9C:
+        button.code = MINUS;
+        break;
    default:
         break;
    }
 
-		// extract value from packet
-		button.value = buf[WIIMOTE_EVT2_VALUE];
+		// extract value from event
+		button.value = evt.value;
+		button.time = evt.time;
 
 	} else {
 		// got fewer bytes ,,,
@@ -341,9 +645,10 @@ tWiiMoteButton wiimote_buttonGet(){
 
 /**
  * get acceleration events from wiimote
- * @return acceleration event
+ * @param rm			remote to read
+ * @return acceleration event, code 0 if none available
  */
-tWiiMoteAccel wiimote_accelGet() {
+tWiiMoteAccel wiimote_accelGet(tWiiMoteRemote *rm) {
 	unsigned char buf[WIIMOTE_EVT0_PKT_SIZE]; //each packet of data is 16 bytes
 	unsigned char evt0ValueL; /// event 0 value Low
 	unsigned char evt0ValueH; /// event 0 value Low
@@ -352,7 +657,10 @@ tWiiMoteAccel wiimote_accelGet() {
 	accel.code = 0; // start out with nothing received
 
 	// read 16 bytes from the file and put it in the buffer
-	read(gWiiMote.fileEvt0, buf, WIIMOTE_EVT0_PKT_SIZE);
+	// (non blocking, nothing received if no complete packet is available)
+	if (read(rm->fileEvt0, buf, WIIMOTE_EVT0_PKT_SIZE) != WIIMOTE_EVT0_PKT_SIZE) {
+		return accel;
+	}
 
 	accel.code = buf[WIIMOTE_EVT0_CODE];       // extract code byte
 
@@ -368,34 +676,582 @@ tWiiMoteAccel wiimote_accelGet() {
 }
 
 
+/**
+ * get the latest acceleration frame from wiimote
+ * All pending events are drained with as few reads as possible and parsed in place
+ * in the read buffer. Frames completed in the meantime are collapsed into the latest
+ * value per axis, so the caller always gets the freshest sample. Every frame
+ * goes through the gesture recognizer of the remote though, none is skipped.
+ * Axes of a frame not closed by its SYN_REPORT yet stay pending for the next call.
+ * @param rm			remote to read
+ * @param frame			latest complete frame, only written if one was completed
+ * @return number of frames completed since the last call (0 if none)
+ */
+int wiimote_accelFrameGet(tWiiMoteRemote *rm, tWiiMoteAccelFrame *frame) {
+	struct input_event buf[WIIMOTE_EVT0_BATCH]; // room for many packets per read
+	tWiiMoteAccelFrame *pending = &rm->accelPending;
+	tWiiMoteAccelFrame done; // latest frame closed by a SYN_REPORT
+	unsigned char updated = 0; // axes changed over all collapsed frames
+	unsigned char gesture = GESTURE_NONE; // latest gesture over all collapsed frames
+	int frames = 0;
+	ssize_t len;
+
+	do {
+		// non blocking read of everything available, up to WIIMOTE_EVT0_BATCH events
+		len = read(rm->fileEvt0, buf, sizeof(buf));
+		if (len < (ssize_t)sizeof(buf[0])) {
+			// if error is different than it would block then report
+			if (len == -1 && errno != EWOULDBLOCK) {
+				printf("Unknown error %d\n", errno);
+			}
+			break;
+		}
+
+		const struct input_event *evt = buf;
+		const struct input_event *end = buf + len / sizeof(buf[0]);
+		for (; evt < end; ++evt) {
+			wiilog_record(&gWiiMote.log, WIILOG_DEV_EVT0, evt);
+			if (evt->type == EV_ABS) {
+				switch (evt->code) {
+				case WIIMOTE_EVT0_ACCEL_X:
+					pending->x = evt->value;
+					pending->updated |= WIIMOTE_AXIS_X;
+					break;
+				case WIIMOTE_EVT0_ACCEL_Y:
+					pending->y = evt->value;
+					pending->updated |= WIIMOTE_AXIS_Y;
+					break;
+				case WIIMOTE_EVT0_ACCEL_Z:
+					pending->z = evt->value;
+					pending->updated |= WIIMOTE_AXIS_Z;
+					break;
+				default:
+					break;
+				}
+			} else if (evt->type == EV_SYN && evt->code == SYN_REPORT) {
+				// frame complete, newer frames overwrite older ones
+				pending->time = evt->time;
+				updated |= pending->updated;
+				pending->updated = 0;
+				done = *pending;
+				frames++;
+				if (rm->gestures.set != NULL) {
+					tGestureId id = gesture_push(&rm->gestures, done.x, done.y, done.z);
+					gesture = id != GESTURE_NONE ? id : gesture;
+				}
+			}
+		}
+	// a full buffer means there may be more waiting
+	} while (len == sizeof(buf));
+
+	if (frames != 0) {
+		*frame = done;
+		frame->updated = updated;
+		frame->gesture = gesture;
+	}
+	return frames;
+}
+
+
 /**
  * close the wiimote connection
  */
 void wiimote_close() {
-	close(gWiiMote.fileEvt0); // close acceleration file
-	close(gWiiMote.fileEvt2); // close button file
+	if (gWiiMote.replaying) {
+		wiireplay_stop(&gWiiMote.replay); // closes the replay pipes
+	} else {
+		for (int n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+			if (gWiiMote.remote[n].fileEvt0 != -1) {
+				close(gWiiMote.remote[n].fileEvt0); // close acceleration file
+			}
+			if (gWiiMote.remote[n].fileEvt2 != -1) {
+				close(gWiiMote.remote[n].fileEvt2); // close button file
+			}
+		}
+		wiidev_watchClose(&gWiiMote.watch);
+	}
+	wiilog_close(&gWiiMote.log);
+}
+
+
+/************** INPUT THREAD ***********************/
+
+/**
+ * pass a frame to the control thread. Live input never waits, the oldest frame is dropped
+ * if the control thread falls behind. In virtual time nothing may be lost, wait for room.
+ */
+void input_push(tControl *ctl, const tInputFrame *in) {
+	if (ctl->virtualTime) {
+		while (spsc_full(&ctl->ring)) {
+			sched_yield();
+		}
+	}
+	spsc_push(&ctl->ring, in);
+}
+
+/**
+ * event0 readable: drain it and pass the freshest accelerometer frame on
+ */
+void input_onAccel(int fd, void *ctx) {
+	tControl *ctl = (tControl *)ctx;
+	tInputFrame in = {0};
+
+	in.remote = wiimote_remoteOf(fd);
+	if (wiimote_accelFrameGet(&gWiiMote.remote[in.remote], &in.accel) != 0) {
+		in.t_ns = servo_nowNs();
+		input_push(ctl, &in);
+	}
+}
+
+/**
+ * event2 readable: pass the button on, stop reading on "Home"
+ */
+void input_onButton(int fd, void *ctx) {
+	tControl *ctl = (tControl *)ctx;
+	tInputFrame in = {0};
+
+	in.remote = wiimote_remoteOf(fd);
+	in.button = wiimote_buttonGet(&gWiiMote.remote[in.remote]);
+	if (in.button.code == 0) {
+		return;
+	}
+	in.t_ns = servo_nowNs();
+	input_push(ctl, &in);
+
+	if (in.button.code == HOME) {
+		// "Home" pressed (or released), tell control thread even if the frame gets dropped
+		__atomic_store_n(&ctl->quit, 1, __ATOMIC_RELEASE);
+		ctl->reactor.stop = 1;
+	}
+}
+
+/**
+ * event file of a WiiMote hung up, it disconnected: forget it, the control loop goes on
+ */
+void input_onHangup(int fd, void *ctx) {
+	tControl *ctl = (tControl *)ctx;
+	tInputFrame in = {0};
+
+	reactor_remove(&ctl->reactor, fd);
+	in.remote = wiimote_detach(fd);
+	in.lost = 1;
+	in.t_ns = servo_nowNs();
+	input_push(ctl, &in);
+}
+
+/**
+ * watch an event file of a remote, accelerometer or buttons
+ * @return 0 on success, != 0 otherwise.
+ */
+int input_watch(tControl *ctl, int fd) {
+	const tWiiMoteRemote *rm = &gWiiMote.remote[wiimote_remoteOf(fd)];
+
+	// the replay pipes hang up when the replay ends, that is no disconnect
+	return reactor_watch(&ctl->reactor, fd, fd == rm->fileEvt0 ? input_onAccel : input_onButton,
+			gWiiMote.replaying ? NULL : input_onHangup, ctl);
+}
+
+/**
+ * event node appeared: watch it if it is a WiiMote device
+ */
+void input_onDevice(const char *path, void *ctx) {
+	tControl *ctl = (tControl *)ctx;
+
+	int fd = wiimote_attach(path);
+	if (fd != -1 && input_watch(ctl, fd) != 0) {
+		wiimote_detach(fd);
+	}
+}
+
+/**
+ * hotplug watch readable: pick up the WiiMote devices that appeared
+ */
+void input_onHotplug(int fd, void *ctx) {
+	wiidev_watchRead(&gWiiMote.watch, input_onDevice, ctx);
+}
+
+/**
+ * Watch the event files of all remotes connected so far and the hotplug watch
+ * @return 0 on success, != 0 otherwise.
+ */
+int input_addSources(tControl *ctl) {
+	for (int n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+		if ((gWiiMote.remote[n].fileEvt0 != -1 && input_watch(ctl, gWiiMote.remote[n].fileEvt0) != 0)
+		 || (gWiiMote.remote[n].fileEvt2 != -1 && input_watch(ctl, gWiiMote.remote[n].fileEvt2) != 0)) {
+			return -1;
+		}
+	}
+	if (gWiiMote.watch.fd != -1) {
+		return reactor_add(&ctl->reactor, gWiiMote.watch.fd, input_onHotplug, ctl);
+	}
+	return 0;
+}
+
+/**
+ * input thread: dispatch WiiMote events as they arrive, never waits for the servos
+ */
+void *input_thread(void *arg) {
+	tControl *ctl = (tControl *)arg;
+
+	reactor_run(&ctl->reactor);
+	return NULL;
+}
+
+
+/************** CONTROL THREAD ***********************/
+
+/**
+ * put the gripper target where the arm was last commanded to
+ */
+void control_syncTarget(tControl *ctl) {
+	unsigned char posn[IK_JOINTS];
+	tIkJoints j;
+
+	for (int k = 0; k < IK_JOINTS; ++k) {
+		posn[k] = gServos.shadow.value[k] & 0xFF;
+	}
+	ik_fromServo(posn, &j);
+	ik_forward(&j, &ctl->target);
+}
+
+/**
+ * switch between moving single joints and moving the gripper in x/y/z.
+ * Cartesian mode starts out wherever the arm was last commanded to.
+ */
+void control_toggleCartesian(tControl *ctl) {
+	ctl->cartesian = !ctl->cartesian;
+	if (ctl->cartesian) {
+		control_syncTarget(ctl);
+	}
+	printf("%s mode\n", ctl->cartesian ? "Cartesian" : "Joint");
+}
+
+/**
+ * Cartesian mode: move the gripper target by the tilt and solve for the joints
+ * @param posn			receives the servo positions Base .. Wrist
+ * @return 0 if the new target is reachable and safe, != 0 otherwise (target kept)
+ */
+int control_solveGripper(tControl *ctl, unsigned char posn[IK_JOINTS]) {
+	const float mmPerTick = CARTESIAN_GAIN / SERVO_TICKS_PER_SEC;
+	float v[FILTER_AXES];
+	tIkTarget t = ctl->target;
+	tIkJoints j;
+
+	for (int a = 0; a < FILTER_AXES; ++a) {
+		int tilt = ctl->tilt[a];
+		v[a] = tilt > CARTESIAN_DEADBAND ? tilt - CARTESIAN_DEADBAND
+		     : tilt < -CARTESIAN_DEADBAND ? tilt + CARTESIAN_DEADBAND : 0;
+		v[a] *= mmPerTick;
+	}
+	if (ctl->joint == JOINT_BASE) {
+		// A: pitch forward reaches out, roll moves sideways
+		t.x -= v[1];
+		t.y -= v[0];
+	} else if (ctl->joint == JOINT_BICEP) {
+		// B: pitch moves up and down
+		t.z += v[1];
+	} else {
+		return -1;
+	}
+
+	unsigned long long start = servo_nowNs();
+	int failed = ik_solve(&t, &j) != 0 || ik_toServo(&j, posn) != 0;
+	hist_record(&ctl->latIk, servo_nowNs() - start);
+	if (failed) {
+		return -1;
+	}
+
+	// the joints move together, check the pose they lead to rather than each step to it
+	unsigned char pose[JOINT_COUNT] = {0};
+	memcpy(pose, posn, IK_JOINTS);
+	if (safety_checkPose(&gServos.safety, gServos.posn, pose, (1 << IK_JOINTS) - 1) != 0) {
+		return -1;
+	}
+	ctl->target = t;
+	return 0;
+}
+
+/**
+ * act on a gesture: shake toggles Cartesian mode, twist stores the pose, flick
+ * moves the arm back to it if "-" is held
+ */
+void control_gesture(tControl *ctl, tGestureId gesture) {
+	unsigned char speed[JOINT_COUNT];
+
+	switch (gesture) {
+	case GESTURE_SHAKE:
+		control_toggleCartesian(ctl);
+		break;
+	case GESTURE_TWIST:
+		memcpy(ctl->storedPose, gServos.posn, sizeof(ctl->storedPose));
+		printf("Pose stored\n");
+		break;
+	case GESTURE_FLICK:
+		if (!ctl->armed) {
+			printf("Flick ignored, hold \"-\" to move the arm with it\n");
+			break;
+		}
+		memset(speed, ctl->speed, sizeof(speed));
+		servo_writeAll(ctl->storedPose, speed);
+		// the gripper target follows the arm
+		control_syncTarget(ctl);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * apply one input frame to the control state
+ */
+void control_apply(tControl *ctl, const tInputFrame *in) {
+
+	if (in->lost) {
+		// the remote in control is gone, and with it the button it held
+		if (in->remote == ctl->remote) {
+			ctl->buttonValue = 0;
+			ctl->armed = 0;
+		}
+		return;
+	}
+	if (in->remote != ctl->remote) {
+		// another remote takes over with a button press, unless a selection button is held
+		if (ctl->buttonValue || in->button.code == 0 || !in->button.value) {
+			return;
+		}
+		ctl->remote = in->remote;
+		ctl->armed = 0;
+		filter_init(&ctl->filter, ctl->filter.id);
+	}
+
+	// gestures only while tilting moves nothing
+	if (in->accel.gesture != GESTURE_NONE && !ctl->buttonValue) {
+		control_gesture(ctl, (tGestureId)in->accel.gesture);
+	}
+
+	// did we get a new X acceleration?
+	if (in->accel.updated & WIIMOTE_AXIS_X) {
+		const short raw[FILTER_AXES] = {in->accel.x, in->accel.y, in->accel.z};
+		int filtered[FILTER_AXES];
+
+		ctl->sampleKernelNs = (unsigned long long)in->accel.time.tv_sec * 1000000000ULL
+		                    + in->accel.time.tv_usec * 1000ULL;
+		ctl->sampleRecvNs = in->t_ns;
+
+		// tilt maps to a position around the middle, filtered instead of integrating raw samples
+		filter_apply(&ctl->filter, raw, ctl->sampleKernelNs, filtered);
+		memcpy(ctl->tilt, filtered, sizeof(ctl->tilt));
+		ctl->position = 150 + filtered[0] * (SERVO_POSN_MAX - 150) / ACCEL_FULL_TILT;
+		if (ctl->position < SERVO_POSN_MIN) {
+			ctl->position = SERVO_POSN_MIN;
+		} else if (ctl->position > SERVO_POSN_MAX) {
+			ctl->position = SERVO_POSN_MAX;
+		}
+		ctl->newAccel = 1;
+	}
+
+	switch (in->button.code) {
+	case A:
+		ctl->joint = JOINT_BASE;
+		ctl->buttonValue = in->button.value;
+		break;
+	case B:
+		ctl->joint = JOINT_BICEP;
+		ctl->buttonValue = in->button.value;
+		break;
+	case ONE:
+		ctl->joint = JOINT_ELBOW;
+		ctl->buttonValue = in->button.value;
+		break;
+	case TWO:
+		ctl->joint = JOINT_WRIST;
+		ctl->buttonValue = in->button.value;
+		break;
+	case DOWN:
+		ctl->joint = JOINT_GRIPPER;
+		ctl->buttonValue = in->button.value;
+		break;
+	case PLUS:
+		if (in->button.value) {
+			control_toggleCartesian(ctl);
+		}
+		break;
+	case MINUS:
+		ctl->armed = in->button.value;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * print the latency statistics
+ */
+void control_printStats(tControl *ctl) {
+	printf("\n-------------  input to actuation latency  --------------------\n");
+	hist_print(&ctl->latRecv, stdout);
+	hist_print(&ctl->latDecide, stdout);
+	hist_print(&ctl->latWrite, stdout);
+	hist_print(&ctl->latTotal, stdout);
+	hist_print(&ctl->latTick, stdout);
+	hist_print(&ctl->latIk, stdout);
+	for (int n = 0; n < WIIMOTE_MAX_REMOTES; ++n) {
+		const tGestureWindow *w = &gWiiMote.remote[n].gestures;
+		if (w->n != 0) {
+			printf("WiiMote %d gestures:", n + 1);
+			for (int g = GESTURE_NONE + 1; g < GESTURE_COUNT; ++g) {
+				printf(" %s %llu", gGestureNames[g], w->triggered[g]);
+			}
+			printf("\n");
+		}
+	}
+	printf("control ticks missed: %lu\n", ctl->tickOverruns);
+	printf("control ticks: %llu, input frames dropped: %llu\n", ctl->ticks, ctl->ring.drops);
+	shadow_print(&gServos.shadow, stdout);
+	safety_print(&gServos.safety, stdout);
+}
+
+/**
+ * SIGUSR1: request the latency statistics, printed by the control thread
+ */
+void control_onSigusr1(int sig) {
+	gDumpStats = 1;
+}
+
+/**
+ * one control tick: act on the latest sample if a servo is selected
+ * @param measure		1: record latencies (wall clock input only)
+ */
+void control_step(tControl *ctl, int measure) {
+	unsigned char posn[IK_JOINTS];
+
+	if (ctl->buttonValue && ctl->newAccel
+	 && (!ctl->cartesian || control_solveGripper(ctl, posn) == 0)) {
+		unsigned long long decided = servo_nowNs();
+		if (ctl->cartesian) {
+			// all joints at once, they reach the FPGA in one flush
+			for (int k = 0; k < IK_JOINTS; ++k) {
+				servo_move(k, posn[k], ctl->speed);
+			}
+		} else {
+			servo_move(ctl->joint, ctl->position, ctl->speed);
+			ctl->prevPosn = ctl->position;
+		}
+		servo_flush();
+		unsigned long long written = servo_nowNs();
+		//printf("%d, %d \n", ctl->position, ctl->joint);
+
+		if (measure) {
+			hist_record(&ctl->latRecv, ctl->sampleRecvNs - ctl->sampleKernelNs);
+			hist_record(&ctl->latDecide, decided - ctl->sampleRecvNs);
+			hist_record(&ctl->latWrite, written - decided);
+			hist_record(&ctl->latTotal, written - ctl->sampleKernelNs);
+		}
+	}
+	ctl->newAccel = 0;
+	ctl->ticks++;
+}
+
+/**
+ * kernel time stamp of an input frame
+ * @return time in ns
+ */
+unsigned long long control_frameNs(const tInputFrame *in) {
+	const struct timeval *tv = in->accel.updated ? &in->accel.time : &in->button.time;
+	return (unsigned long long)tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+/**
+ * control loop, once per servo PWM period: take all pending input, act on the latest sample
+ */
+void control_run(tControl *ctl) {
+	tInputFrame in;
+	tTick tick;
+
+	tick_start(&tick, SERVO_PERIOD_NS);
+	while (!__atomic_load_n(&ctl->quit, __ATOMIC_ACQUIRE)) {
+		tick_wait(&tick);
+		hist_record(&ctl->latTick, tick.late_ns > 0 ? tick.late_ns : 0);
+		ctl->tickOverruns = tick.overruns;
+
+		while (spsc_pop(&ctl->ring, &in)) {
+			control_apply(ctl, &in);
+		}
+		control_step(ctl, 1);
+
+		if (gDumpStats) {
+			gDumpStats = 0;
+			control_printStats(ctl);
+		}
+	}
+}
+
+/**
+ * control loop on the input time line (fast replay): a tick is due whenever the
+ * next frame is a servo period or more past the previous tick, so every tick sees
+ * the same input as it did live, just without waiting for the wall clock
+ */
+void control_runVirtual(tControl *ctl) {
+	tInputFrame in;
+	int pending = 0;
+	unsigned long long deadline = 0;
+
+	for (;;) {
+		if (!pending) {
+			// quit has to be read before the ring is found empty, "Home" is pushed first
+			int quit = __atomic_load_n(&ctl->quit, __ATOMIC_ACQUIRE);
+			if (!spsc_pop(&ctl->ring, &in)) {
+				if (quit) {
+					break;
+				}
+				sched_yield();
+				continue;
+			}
+			pending = 1;
+		}
+
+		unsigned long long t_ns = control_frameNs(&in);
+		if (deadline == 0) {
+			deadline = t_ns + SERVO_PERIOD_NS;
+		}
+		if (t_ns >= deadline) {
+			control_step(ctl, 0);
+			deadline += SERVO_PERIOD_NS;
+			continue;
+		}
+		control_apply(ctl, &in);
+		pending = 0;
+	}
+	control_step(ctl, 0);
 }
 
 
 /************** MAIN ***********************/
 
+// servoBench.c builds this file without main() to benchmark it
+#ifndef WIIMOTE_NO_MAIN
 
 int main()
 {
+	static tControl ctl; // large (input ring), keep it off the stack
+
 	//Servo variables
-	int servo_number = 0;
-	long position = 0;
-  int prevPosn = 150;
-  int speed = 10;
-  
-  //Wiimote variables
-  tWiiMoteButton button;
-	tWiiMoteAccel accel;
-	unsigned char accelX =0;
-	unsigned char accelY =0;
- 
-  int buttonValue = 0;
- 
+	ctl.prevPosn = 150;
+	ctl.speed = 10;
+	joint_homePose(ctl.storedPose);
+
+	tFilterId filterId = filter_byName(getenv("WIIMOTE_FILTER"), FILTER_ONE_EURO_ID);
+	if (filterId == FILTER_COUNT) {
+		printf("Unknown filter '%s'\n", getenv("WIIMOTE_FILTER"));
+		return -1;
+	}
+	filter_init(&ctl.filter, filterId);
+
+	tRtConfig rt;
+	if (rt_configure(&rt) != 0) {
+		return -1;
+	}
+
   // Initialize wiimote
   if (wiimote_init() != 0) {
 		printf("Failed to init WiiMote\n");
@@ -404,62 +1260,58 @@ int main()
 
 	printf("\n-------------  ATTENTION ROBOT WILL BE MOVING!  --------------------\n\n");
 	printf("Please ensure robot power is OFF. Hold it in middle position. Then, turn it on.\n");
-	sleep(1);
+	if (!gWiiMote.replaying) {
+		sleep(1);
+	}
 
 	/* initialize servos */
 	if (servo_init() != 0) {
 		return -1; // exit if init fails
 	}
- 
-
- 
- do {
-		// read acceleration (blocking)
-		accel = wiimote_accelGet();
-		// read button events that have accumulated since then.
-		button = wiimote_buttonGet();
-
-   position = ((accel.value * 18) / 1000) + 150;
-   
- 		switch (button.code) {
-		case A:
-			servo_number = 1;
-      buttonValue = 1;
-			break;
-		case B:
-			servo_number = 2;
-      buttonValue = 1;
-			break;
-    case ONE:
-			servo_number = 3;
-      buttonValue = 1;
-			break;
-    case TWO:
-			servo_number = 4;
-      buttonValue = 1;
-			break;
-    case DOWN:
-			servo_number = 5;
-      buttonValue = 1;
-			break;
-    default:
-      buttonValue = 0;
-      break;
-		}
-   
-		// did we get an accel event?
-		if (accel.code != 0) { // ignore the zeroes
-			if( buttonValue && (accel.code == WIIMOTE_EVT0_ACCEL_X)) {
-				servo_move(servo_number, prevPosn += position, speed);
-        //printf("%d, %d \n", position, servo_number);
-			}
-		}
+	// servo registers are written once per control tick
+	gServos.deferWrites = 1;
+
+	hist_init(&ctl.latRecv, "kernel -> receive");
+	hist_init(&ctl.latDecide, "receive -> decision");
+	hist_init(&ctl.latWrite, "decision -> write");
+	hist_init(&ctl.latTotal, "kernel -> write");
+	hist_init(&ctl.latTick, "tick wake-up jitter");
+	hist_init(&ctl.latIk, "ik solve");
+	signal(SIGUSR1, control_onSigusr1);
+
+	// a fast replay runs on the recorded time line instead of the wall clock
+	ctl.virtualTime = gWiiMote.replaying && gWiiMote.replay.fast;
+
+	// input thread watches accelerometer and buttons of every remote and the hotplug
+	// watch, whichever is ready first is handled
+	spsc_init(&ctl.ring, sizeof(tInputFrame));
+	if (reactor_init(&ctl.reactor) != 0 || input_addSources(&ctl) != 0) {
+		return -1;
+	}
+	if (pthread_create(&ctl.input, NULL, input_thread, &ctl) != 0) {
+		printf("Failed to start input thread\n");
+		return -1;
+	}
+	if (wiimote_start() != 0) {
+		return -1;
+	}
 
+	// only the control thread (this one) runs real-time, input is handed over through the ring
+	rt_enter(&rt);
+
+	// run until "Home" button is pressed (or relased)
+	if (ctl.virtualTime) {
+		control_runVirtual(&ctl);
+	} else {
+		control_run(&ctl);
+	}
+	pthread_join(ctl.input, NULL);
+	reactor_close(&ctl.reactor);
+	control_printStats(&ctl);
 
-	// repeat until "Home" button is pressed (or relased)
-	} while(button.code != HOME);
- 
  wiimote_close();
  servo_release();
  return 0;
 }
+
+#endif /* WIIMOTE_NO_MAIN */